@@ -12,10 +12,16 @@ SRC = \
 	preamble.c \
 	adc.c \
 	uart.c \
+	uartUsi.c \
+	frame.c \
 	console.c \
 	fft.c \
+	sdft.c \
+	freq.c \
+	rms.c \
 	key.c \
 	nvParam.c \
+	prof.c \
 	stateMachine.c \
 	lungmate.c
 
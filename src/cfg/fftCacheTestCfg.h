@@ -0,0 +1,28 @@
+/**
+ *@ingroup fft
+ *@defgroup fft_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the FFT unit test with the twiddle cache.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the fft section for the test
+//
+
+/**
+ * Cache the twiddle factors in RAM. 50Hz is the bin 10 of the 64 point fft
+ *  which reads 16 factors in the pass 2 and 4 in the pass 4.
+ */
+#undef FFT_TWIDDLE_CACHE
+#define FFT_TWIDDLE_CACHE 20
+
+
+/* ----------------------------  End of file  ---------------------------- */
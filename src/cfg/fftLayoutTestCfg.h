@@ -0,0 +1,51 @@
+/**
+ *@ingroup fft
+ *@defgroup fft_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the test of the compact layout of the fft.
+ * fftLayoutTest.sh builds the test for each fft size by defining
+ *  FFT_LAYOUT_TEST_M, FFT_LAYOUT_TEST_FIXED_POINT and FFT_LAYOUT_TEST_BINS.
+ *  All the smaller windows down to 8 points are tested in each build.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the fft section for the test
+//
+
+/** The compact layout requires a single fft */
+#undef FFT_OVERLAP
+#define FFT_OVERLAP 0
+
+/** The standard layout is the reference */
+#undef FFT_COMPACT
+#define FFT_COMPACT 0
+
+#ifdef FFT_LAYOUT_TEST_M
+#  undef FFT_M
+#  define FFT_M FFT_LAYOUT_TEST_M
+#endif
+
+/** Test all the windows the fft can be given at run time */
+#undef FFT_MIN_M
+#define FFT_MIN_M 3
+
+#ifdef FFT_LAYOUT_TEST_FIXED_POINT
+#  undef FFT_FIXED_POINT
+#  define FFT_FIXED_POINT FFT_LAYOUT_TEST_FIXED_POINT
+#endif
+
+#ifdef FFT_LAYOUT_TEST_BINS
+#  undef FFT_MAX_BINS
+#  define FFT_MAX_BINS FFT_LAYOUT_TEST_BINS
+#endif
+
+
+/* ----------------------------  End of file  ---------------------------- */
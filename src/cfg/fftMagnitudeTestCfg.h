@@ -0,0 +1,28 @@
+/**
+ *@ingroup fft
+ *@defgroup fft_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the FFT unit test with a magnitude estimator.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the fft section for the test
+//
+
+/**
+ * Estimate the magnitude with shifts and adds only. Compare the worst case
+ *  timing of the last sample of the window with testFFT.
+ */
+#undef FFT_MAGNITUDE
+#define FFT_MAGNITUDE FFT_MAGNITUDE_ALPHA_MAX_BETA_MIN
+
+
+/* ----------------------------  End of file  ---------------------------- */
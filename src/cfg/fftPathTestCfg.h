@@ -0,0 +1,29 @@
+/**
+ *@ingroup fft
+ *@defgroup fft_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the FFT unit test with the per-bin twiddle tables.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the fft section for the test
+//
+
+/** Read the twiddle factors from the per-bin tables of twiddlePath.c */
+#undef FFT_TWIDDLE_PATH
+#define FFT_TWIDDLE_PATH 1
+
+/** The per-bin tables are in the order of the standard layout */
+#undef FFT_COMPACT
+#define FFT_COMPACT 0
+
+
+/* ----------------------------  End of file  ---------------------------- */
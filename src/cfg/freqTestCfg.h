@@ -0,0 +1,25 @@
+/**
+ *@ingroup freq
+ *@defgroup freq_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the frequency tracking unit test.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the freq section for the test
+//
+
+/** Track the mains, which lungmate leaves off */
+#undef FREQ_TRACKING
+#define FREQ_TRACKING 1
+
+
+/* ----------------------------  End of file  ---------------------------- */
@@ -59,6 +59,13 @@
 #define DBG_UART       1
 #define DBG_MAIN_LOOP  2
 
+/**
+ * Time the main loop and the interrupts, and report them on the console
+ *  (1). Takes 80 bytes of RAM, which the fft leaves with FFT_SLIDING_DFT
+ *  or a shorter window only.
+ */
+#define PROF_ENABLED 0
+
 
 // ---------------------------------------------------------------------------
 // Other configurations
@@ -89,6 +96,25 @@
 /** Common baud speed for the serial Tx */
 #define UART_BAUD      19200
 
+/** Number of characters queued for the Tx, a power of 2 */
+//#define UART_TX_QUEUE_SIZE 16
+
+/** Number of characters received waiting to be read, a power of 2 */
+//#define UART_RX_QUEUE_SIZE 4
+
+/**
+ * Detect the baud rate from the first carriage return (1), from UART_BAUD
+ *  up to the fastest rate the interrupts keep up with (38400 at 8.192MHz)
+ */
+//#define UART_AUTO_BAUD 0
+
+/**
+ * Shift the bits with the USI (1), the pins being then DO and DI. This
+ *  board has them on the debug pins and the inputs of the adc, so it needs
+ *  a new layout
+ */
+//#define UART_USI 0
+
 /** Pin to use to tramsmit serial data */
 #define UART_TX_PORT   PORTA
 #define UART_TX_BIT    5
@@ -108,17 +134,205 @@
 */
 #define ADC_MUX 0b100001
 
+/**
+ * Switch the gain between 1x, 8x, 20x and 32x to follow the load (1),
+ *  rather than staying at 8x (0). Small loads are then measured with 4
+ *  times the resolution, and large ones 8 times further before clipping.
+ *  The samples gain 3 bits, which requires FFT_RESULT_FRACTION_BITS of 0.
+ */
+#define ADC_AUTO_GAIN 1
+
+/** Mux setup of ADC0+ ADC1- at 20x and 32x, for ADC_AUTO_GAIN */
+#define ADC_MUX_HIGH_GAIN 0b100000
+
+/**
+ * Number of circuits monitored, each by a differential pair scanned in
+ *  turn. Each channel takes ADC_OVERSAMPLING conversions per sample, and
+ *  its own fft context (276 bytes for a 64 point window), so the RAM only
+ *  has room for one, or a few with the sliding DFT over 32 points.
+ */
+#define ADC_CHANNELS 1
+
+/** Mux setups of each channel at 1x/8x, then at 20x/32x */
+#define ADC_MUX_LIST { { ADC_MUX, ADC_MUX_HIGH_GAIN } }
+
+/**
+ * Mux setup shorting the inputs, to measure the offset at power up. Left
+ *  undefined, so the offset is measured on the pair itself over whole
+ *  mains cycles, which includes the bias of the Hall sensor.
+ */
+//#define ADC_ZERO_MUX 0b100011
+
+/**
+ * Time constant of the tracking of the offset while idle, in 2^n windows
+ *  of the fft.
+ */
+#define ADC_OFFSET_FILTER_SHIFT 6
+
+/**
+ * Start the conversions in hardware on the overflow of the timer1 (1), so
+ *  the samples are evenly spaced whatever the main loop and the uart do,
+ *  as the fft assumes. 0 starts them from the interrupt of the timer.
+ *  Left off until ADC_JITTER has measured both modes on the board.
+ */
+#define ADC_AUTO_TRIGGER 0
+
+/**
+ * Time the conversions, and report their jitter on the console (1). Costs
+ *  a few cycles per conversion.
+ */
+#define ADC_JITTER 0
+
 /** Sampling frequency (after decimation if used) */
 #define ADC_SAMPLE_FREQUENCY 320
 
+/**
+ * Number of conversions decimated into each sample, evenly spread over
+ *  the sampling period, a power of 2. At 8.192MHz and 320Hz, the adc has
+ *  the time for 8 at most.
+ */
+#define ADC_OVERSAMPLING 8
+
+/**
+ * Number of stages of the CIC decimation filter. Each stage adds an
+ *  addition per conversion and 8 bytes of RAM per channel, and deepens
+ *  the rejection of the frequencies folding onto the mains: 1 stage
+ *  attenuates them by 15dB, 3 stages by 44dB, which eases the analogue
+ *  anti-alias filter. The droop at the mains is compensated either way.
+ */
+#define ADC_CIC_ORDER 1
+
+/** Number of bits of the samples given to the fft */
+#define ADC_RESOLUTION 12
+
+/**
+ * Number of decimated values queued for the main loop, a power of 2. The
+ *  main loop can be late by ADC_QUEUE_SIZE-1 samples (3 at 320Hz is 9ms)
+ *  before any is lost. Each value takes 2 bytes of RAM.
+ */
+#define ADC_QUEUE_SIZE 4
+
 
 // ---------------------------------------------------------------------------
 // FFT configuration - required by the fft module
 // ---------------------------------------------------------------------------
 
-/** Size of the fft in 2^n */
+/** Size of the largest fft in 2^n. The buffers are sized for it */
 #define FFT_M 6
 
+/**
+ * Size of the smallest fft in 2^n. The size used is selected from
+ *  FFT_MIN_M to FFT_M by the fftWindow parameter, without reflashing.
+ *  A 128 point window (FFT_M 7) only fits in RAM with the sliding DFT.
+ */
+#define FFT_MIN_M 5
+
+/**
+ * Number of fractional bits of the magnitude of the results. The 15-bit
+ *  samples of ADC_AUTO_GAIN leave none in the 16 bits of the bins.
+ */
+#define FFT_RESULT_FRACTION_BITS 0
+
+/**
+ * Compute the fft butterflies in fixed point (1) rather than floating
+ *  point (0). Fixed point uses Q15 twiddle factors and 32-bit accumulators.
+ *  Left at 0 until testFFT has timed both on target.
+ */
+#define FFT_FIXED_POINT 0
+
+/**
+ * Replace the progressive fft (0) by a sliding DFT (1). The sliding DFT
+ *  updates the measurement with every sample rather than every FFT_N samples.
+ */
+#define FFT_SLIDING_DFT 0
+
+/**
+ * Run two progressive ffts staggered by half a window (1), for a new result
+ *  every FFT_N/2 samples (100ms) instead of every FFT_N samples (200ms).
+ *  This doubles the worst case of each sample, which testFFT has yet to
+ *  time on target.
+ */
+#define FFT_OVERLAP 0
+
+/**
+ * Number of bins measured by the fft: the center frequency followed by its
+ *  odd harmonics (3rd, 5th...), which are summed as RMS. Measuring harmonics
+ *  accounts for non-linear loads, but requires FFT_OVERLAP to be 0 with the
+ *  progressive fft.
+ */
+#define FFT_MAX_BINS 1
+
+/**
+ * Number of twiddle factors cached in RAM (4 bytes each) in the order the
+ *  fft uses them, or 0 to read them from flash. 50Hz requires 20 of them.
+ *  The RAM is too tight on the ATtiny861 alongside the 64 point fft.
+ */
+#define FFT_TWIDDLE_CACHE 0
+
+/**
+ * Read the twiddle factors from the per-bin tables of twiddlePath.c (1),
+ *  created by wgen.py, rather than from the full table (0).
+ */
+#define FFT_TWIDDLE_PATH 0
+
+/**
+ * Keep the first pass of the fft in the sample slots it has consumed (1),
+ *  which saves 2*FFT_N bytes of RAM for a single bin. Requires FFT_OVERLAP
+ *  to be 0. Without it, the static RAM leaves too little for the stack
+ *  (see docs/RAM.txt).
+ */
+#define FFT_COMPACT 1
+
+/**
+ * Report the exact square of the magnitude (FFT_MAGNITUDE_SQUARED), or an
+ *  estimate of the magnitude computed without multiplications
+ *  (FFT_MAGNITUDE_ALPHA_MAX_BETA_MIN within 3%, FFT_MAGNITUDE_CORDIC
+ *  within 0.25%). The thresholds of the state machine follow.
+ */
+#define FFT_MAGNITUDE FFT_MAGNITUDE_SQUARED
+
+
+// ---------------------------------------------------------------------------
+// True RMS configuration - required by the rms module
+// ---------------------------------------------------------------------------
+
+/**
+ * Measure the true RMS of the samples (1), selected by the trueRms
+ *  parameter. Costs a 16-bit multiplication per sample and 8 bytes of RAM
+ *  per channel. 0 only sums the samples of each window, for the offset.
+ */
+#define RMS_TRUE 0
+
+
+// ---------------------------------------------------------------------------
+// Frequency tracking configuration - required by the freq module
+// ---------------------------------------------------------------------------
+
+/**
+ * Measure the mains frequency from the phase of its bin (1), and trim the
+ *  sampling rate so the bin stays centred on it. The frequency is sent
+ *  before the power, which changes the line of text (see README.md). The
+ *  mains is tracked within +/-5Hz with FFT_OVERLAP or the sliding DFT,
+ *  +/-2.5Hz otherwise.
+ */
+#define FREQ_TRACKING 0
+
+/** Smallest bin, in sample units, the phase is measured from */
+#define FREQ_MIN_AMPLITUDE 16
+
+
+// ---------------------------------------------------------------------------
+// Binary frames configuration - required by the frame module
+// ---------------------------------------------------------------------------
+
+/**
+ * Send each result as a binary frame (1) rather than as text: the state of
+ *  the relay, the mode, the clipped channels and the overruns follow the
+ *  power, with a sequence number, in a COBS frame checked by a CRC16.
+ *  src/scripts/telemetry.py decodes the frames
+ */
+#define FRAME_RESULTS 0
+
 
 /*-
  *  Configure the state machine
@@ -0,0 +1,25 @@
+/**
+ *@ingroup rms
+ *@defgroup rms_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the true RMS unit test.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the rms section for the test
+//
+
+/** Measure the true RMS, which lungmate leaves off */
+#undef RMS_TRUE
+#define RMS_TRUE 1
+
+
+/* ----------------------------  End of file  ---------------------------- */
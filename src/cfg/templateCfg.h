@@ -68,6 +68,9 @@
 //#define DBG_XXX6       n
 //#define DBG_XXX7       n
 
+/** Time the main loop and the interrupts, and report them on the console */
+//#define PROF_ENABLED 0
+
 
 // ---------------------------------------------------------------------------
 // Key configuration - required by the key module
@@ -85,6 +88,21 @@
 /** Common baud speed for the serial Tx */
 //#define UART_BAUD      19200
 
+/** Number of characters queued for the Tx, a power of 2 */
+//#define UART_TX_QUEUE_SIZE 16
+
+/** Number of characters received waiting to be read, a power of 2 */
+//#define UART_RX_QUEUE_SIZE 4
+
+/**
+ * Detect the baud rate from the first carriage return (1), from UART_BAUD
+ *  up to the fastest rate the interrupts keep up with (38400 at 8.192MHz)
+ */
+//#define UART_AUTO_BAUD 0
+
+/** Shift the bits with the USI (1), the pins being then DO and DI */
+//#define UART_USI 0
+
 /** Pin to use to tramsmit serial data */
 //#define UART_TX_PORT   PORTx
 //#define UART_TX_BIT    n
@@ -104,17 +122,113 @@
 */ 
 //#define ADC_MUX 0b101101
 
+/** Switch the gain between 1x, 8x, 20x and 32x to follow the signal (1) */
+//#define ADC_AUTO_GAIN 0
+
+/** Mux setup of the pins of ADC_MUX at 20x and 32x */
+//#define ADC_MUX_HIGH_GAIN 0b101100
+
+/** Number of differential pairs scanned in turn */
+//#define ADC_CHANNELS 1
+
+/** Mux setups of each channel at 1x/8x, then at 20x/32x */
+//#define ADC_MUX_LIST { { 0b101101, 0b101100 } }
+
+/** Mux setup shorting the inputs, to measure the offset at power up */
+//#define ADC_ZERO_MUX 0b100011
+
+/** Time constant of the tracking of the offset while idle, in 2^n windows */
+//#define ADC_OFFSET_FILTER_SHIFT 6
+
+/** Start the conversions in hardware on the overflow of the timer1 (1) */
+//#define ADC_AUTO_TRIGGER 0
+
+/** Time the conversions, and report their jitter on the console (1) */
+//#define ADC_JITTER 0
+
 /** Sampling frequency (after decimation if used) */
 //#define ADC_SAMPLE_FREQUENCY 320
 
+/** Number of conversions decimated into each sample, a power of 2 */
+//#define ADC_OVERSAMPLING 8
+
+/** Number of stages of the CIC decimation filter */
+//#define ADC_CIC_ORDER 1
+
+/** Number of bits of the decimated values */
+//#define ADC_RESOLUTION 12
+
+/** Number of decimated values queued for the main loop, a power of 2 */
+//#define ADC_QUEUE_SIZE 4
+
 
 // ---------------------------------------------------------------------------
 // FFT configuration - required by the fft module
 // ---------------------------------------------------------------------------
 
-/** Size of the fft in 2^n */
+/** Size of the largest fft in 2^n. The buffers are sized for it */
 //#define FFT_M 6
 
+/** Size of the smallest fft in 2^n which can be selected at run time */
+//#define FFT_MIN_M 6
+
+/** Number of fractional bits of the magnitude of the results */
+//#define FFT_RESULT_FRACTION_BITS 3
+
+/** Compute the fft butterflies in fixed point (1) or floating point (0) */
+//#define FFT_FIXED_POINT 0
+
+/** Use a sliding DFT (1) rather than the progressive fft (0) */
+//#define FFT_SLIDING_DFT 0
+
+/** Run two progressive ffts staggered by half a window (1) */
+//#define FFT_OVERLAP 0
+
+/** Number of bins measured by the fft: the center frequency and harmonics */
+//#define FFT_MAX_BINS 1
+
+/** Number of twiddle factors cached in RAM in order of use, or 0 */
+//#define FFT_TWIDDLE_CACHE 0
+
+/** Read the twiddle factors from the per-bin tables of twiddlePath.c (1) */
+//#define FFT_TWIDDLE_PATH 0
+
+/** Keep the first pass in the consumed sample slots to save RAM (1) */
+//#define FFT_COMPACT 0
+
+/** Report the squared magnitude, or a magnitude estimate (see fft.h) */
+//#define FFT_MAGNITUDE FFT_MAGNITUDE_SQUARED
+
+
+// ---------------------------------------------------------------------------
+// True RMS configuration - required by the rms module
+// ---------------------------------------------------------------------------
+
+/** Measure the true RMS of the samples (1), or only their sum (0) */
+//#define RMS_TRUE 0
+
+
+// ---------------------------------------------------------------------------
+// Frequency tracking configuration - required by the freq module
+// ---------------------------------------------------------------------------
+
+/** Track the mains frequency and centre the bin of the fft on it (1) */
+//#define FREQ_TRACKING 0
+
+/** Smallest bin, in sample units, the phase is measured from */
+//#define FREQ_MIN_AMPLITUDE 16
+
+/** Filter of the frequency measured, as a right shift */
+//#define FREQ_FILTER_SHIFT 3
+
+
+// ---------------------------------------------------------------------------
+// Binary frames configuration - required by the frame module
+// ---------------------------------------------------------------------------
+
+/** Send the results in binary frames checked by a CRC16 (1) */
+//#define FRAME_RESULTS 0
+
 
 // ---------------------------------------------------------------------------
 // nvParam configuration relative to src/.
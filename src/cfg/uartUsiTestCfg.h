@@ -0,0 +1,51 @@
+/**
+ *@ingroup uart
+ *@defgroup uart_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Configuration for the uart unit test with the USI backend.
+ * The USI shifts the bits on DO (PB1) and DI (PB0), which the board uses
+ *  for the debug pins 0 and 1. These move to the unused pins of PORTA.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+// Use the default config for most parameters
+#include "cfg.h"
+
+//
+// Override the debug and uart sections for the test
+//
+
+/** Debug pin 0 moved off DI */
+#undef DBG_0_PORT
+#undef DBG_0_BIT
+#define DBG_0_PORT     PORTA
+#define DBG_0_BIT      2
+
+/** Debug pin 1 moved off DO */
+#undef DBG_1_PORT
+#undef DBG_1_BIT
+#define DBG_1_PORT     PORTA
+#define DBG_1_BIT      4
+
+/** Shift the bits with the USI */
+#undef UART_USI
+#define UART_USI 1
+
+/** Transmit on DO */
+#undef UART_TX_PORT
+#undef UART_TX_BIT
+#define UART_TX_PORT   PORTB
+#define UART_TX_BIT    1
+
+/** Receive on DI */
+#undef UART_RX_PORT
+#undef UART_RX_BIT
+#define UART_RX_PORT   PORTB
+#define UART_RX_BIT    0
+
+
+/* ----------------------------  End of file  ---------------------------- */
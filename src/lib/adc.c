@@ -5,27 +5,187 @@
  *@file
  *****************************************************************************
  * Manages the on-board ADC converter and implements the ADC API.
- * This API, once initialise, will make burst of 16 conversions at 320Hz
- *  using the timer1 to generate the main sampling rate and the ADC 
- *  conversion finished interrup to manage the burst.
- * The first conversion is started by entering sleep. The sleep mode
- *  cannot be ADC Save since we need the timer1 running.
+ * This API, once initialise, will make ADC_OVERSAMPLING conversions per
+ *  sample, evenly spread by the timer1, and decimate them to
+ *  ADC_SAMPLE_FREQUENCY with a CIC filter of ADC_CIC_ORDER stages.
+ * ADC_CHANNELS differential pairs, set by ADC_MUX_LIST, can be scanned in
+ *  turn, one per conversion. Each has its own CIC filter, and its own gain
+ *  with ADC_AUTO_GAIN. The values of all the channels for a sample are
+ *  queued together, once the last channel has been decimated.
+ * Each overflow of the timer1 turns the ADC on and starts a conversion
+ *  straight away, so the conversions do not wait for the main loop to
+ *  enter sleep. The ADC is turned off again by the end of conversion
+ *  interrupt, so entering sleep does not start any other conversion.
+ *  The conversion still starts late by the latency of the interrupt,
+ *  which moves with the instruction, or the section with the interrupts
+ *  disabled, it lands on.
+ * With ADC_AUTO_TRIGGER, the ADC is left on and the overflow of the timer1
+ *  starts the conversion in hardware instead (ADATE, ADTS=110). The
+ *  prescaler of the ADC is reset by the trigger, so each sample and hold
+ *  comes at a fixed delay from the overflow, and the sample instants do
+ *  not jitter at all. The overflow flag must go down for the next
+ *  overflow to trigger again, which the end of conversion interrupt does,
+ *  so the timer interrupt is not used. A conversion only takes 13.5 ADC
+ *  clocks, as the ADC is not turned on each time, which leaves the room
+ *  for twice as many conversions.
+ * With ADC_JITTER, the delay from the overflow of the timer1 to the end of
+ *  conversion interrupt is timed, and the earliest and latest kept for
+ *  adcGetJitter. Their spread is the jitter of the sample instants, plus
+ *  the latency of the end of conversion interrupt, which does not move
+ *  the samples. With ADC_AUTO_TRIGGER, only the latter is left.
+ * With PROF_ENABLED, the periods of the timer1 are counted, so adcGetTime
+ *  can extend its count into a time for the prof module, and both
+ *  interrupts are timed.
+ * The CIC filter integrates each conversion ADC_CIC_ORDER times, and
+ *  differentiates the integrals as many times at the decimated rate. This
+ *  is a moving sum over ADC_OVERSAMPLING conversions, applied
+ *  ADC_CIC_ORDER times, costing one addition per stage and conversion.
+ *  The nulls at the multiples of ADC_SAMPLE_FREQUENCY deepen with each
+ *  stage, which rejects what would alias onto the mains: 3 stages of 8
+ *  conversions attenuate 270Hz and 370Hz by 44dB at least, where the
+ *  moving sum over a burst of 16 conversions gave 3dB, and a single
+ *  stage by 15dB. The response droops at the mains, by 3.9% per stage at
+ *  50Hz and 5.6% at 60Hz. adcCompensateDroop scales the calibration of
+ *  the power up by the gain of all the stages at the frequency measured,
+ *  so the readings do not depend on ADC_CIC_ORDER.
+ * The integrals wrap around harmlessly, since the output fits within
+ *  their 32 bits.
+ * The decimated values are queued for the main loop in a ring buffer of
+ *  ADC_QUEUE_SIZE samples, so a loop which was late, for example while
+ *  transmitting, catches up on all of them. The interrupt only moves the
+ *  head, and the main loop only the tail, so no lock is needed. A value
+ *  arriving while the queue is full is lost and counted as an overrun.
  * The caller can check whether a new value is ready by calling adcHasNewValue.
  * There should be no other running interrupts whilst a conversion is taking
  *  place to limit the noise.
  * Each new conversion cycle will inverted the debug pin. Each end of 
  *  conversion interrupt will revert the pin polarity so a blip can be seen.
+ * The sampling rate can be trimmed around ADC_SAMPLE_FREQUENCY with
+ *  adcSetSampleFrequency, to follow the frequency of the mains (see freq.c).
+ * With ADC_AUTO_GAIN, the largest conversion of each window of the fft is
+ *  kept. At the end of the window, the gain drops to 1x if the conversions
+ *  came close to clipping, or rises to the largest gain at which the peak
+ *  would still be under half of the full scale. The margin between both
+ *  keeps the gain from hunting.
+ *  The 20x and 32x gains are only given by the second mux code of each
+ *  channel in ADC_MUX_LIST.
+ * The conversions clipped at either end of the range of the adc are
+ *  counted for each channel and sample, with arithmetic rather than a
+ *  branch, and queued with the values.
+ * The DC offset of each channel, the bias of its sensor and the offset of
+ *  the adc, is removed from the output of the CIC filter, where it is
+ *  known with all the bits of the filter. This is the same as removing it
+ *  from each conversion, since the filter is linear, but only costs a
+ *  subtraction per sample. adcZero measures it at boot as the mean of the
+ *  input over whole cycles of the mains, which the load does not move, or
+ *  of the inputs shorted by ADC_ZERO_MUX if the config gives one. It is
+ *  then followed with a first order low pass by adcTrackOffset, with the
+ *  mean of the windows while the circuit is idle.
+ *  Each conversion is multiplied by the ratio of its gain to 32x before
+ *  entering the CIC filter, so the conversions either side of a change
+ *  give a continuous signal to the fft. The ratio has ADC_GAIN_SCALE_BITS
+ *  fractional bits, so 20x is out by 0.1%.
  *
  * @author software@arreckx.com
  *****************************************************************************
  */
 
+#include <string.h>
 #include "wgx.h"
 #include "adc.h"
 #include "dbg.h"
+#include "prof.h"
+
+#if (ADC_OVERSAMPLING & (ADC_OVERSAMPLING - 1)) != 0 || ADC_OVERSAMPLING > 128
+   #error "ADC_OVERSAMPLING must be a power of 2, up to 128"
+#endif
+
+/** Rate of the conversions of all the channels, before decimation */
+#define ADC_CONVERSION_FREQUENCY \
+   (1L * ADC_SAMPLE_FREQUENCY * ADC_OVERSAMPLING * ADC_CHANNELS)
+
+/** Prescaler of the ADC clock, set by ADPS2:0 */
+#define ADC_CLOCK_PRESCALE 64
+
+#if ADC_AUTO_TRIGGER
+   /** CPU cycles taken by an auto triggered conversion, 13.5 ADC clocks */
+   #define ADC_CONVERSION_CYCLES (14 * ADC_CLOCK_PRESCALE)
+#else
+   /** CPU cycles taken by a conversion, the first after turning the ADC on */
+   #define ADC_CONVERSION_CYCLES (25 * ADC_CLOCK_PRESCALE)
+#endif
+
+#if ADC_CONVERSION_CYCLES >= SYS_CLOCK / ADC_CONVERSION_FREQUENCY
+   #error "ADC_OVERSAMPLING times ADC_CHANNELS is too high for the adc to convert in time"
+#endif
+
+/** log2(ADC_OVERSAMPLING) */
+#define ADC_OVERSAMPLING_BITS \
+   ( (ADC_OVERSAMPLING >= 2) + (ADC_OVERSAMPLING >= 4) + \
+     (ADC_OVERSAMPLING >= 8) + (ADC_OVERSAMPLING >= 16) + \
+     (ADC_OVERSAMPLING >= 32) + (ADC_OVERSAMPLING >= 64) + \
+     (ADC_OVERSAMPLING >= 128) )
+
+#if ADC_AUTO_GAIN
+   /** Number of fractional bits of the ratios of the gains to 32x */
+   #define ADC_GAIN_SCALE_BITS 7
+
+   /**
+    * Bits of a conversion at 8x, once scaled to the unit of 32x, that is
+    *  4 times smaller, with ADC_GAIN_SCALE_BITS fractional bits
+    */
+   #define ADC_CONVERSION_BITS (10 + 2 + ADC_GAIN_SCALE_BITS)
+#else
+   /** Bits of a conversion */
+   #define ADC_CONVERSION_BITS 10
+#endif
+
+/**
+ * Bits of the output of the CIC filter at 8x. Its gain is
+ *  ADC_OVERSAMPLING^order
+ */
+#define ADC_CIC_BITS (ADC_CONVERSION_BITS + ADC_CIC_ORDER * ADC_OVERSAMPLING_BITS)
+
+#if ADC_CIC_BITS + ADC_SAMPLE_BITS - ADC_RESOLUTION > 32
+   #error "The CIC filter does not fit in 32 bits. Reduce ADC_CIC_ORDER or ADC_OVERSAMPLING"
+#endif
+
+#if ADC_AUTO_GAIN && ADC_SAMPLE_BITS > 15
+   #error "The 1x range of ADC_AUTO_GAIN needs ADC_RESOLUTION of 12 bits at most"
+#endif
+
+#if ADC_RESOLUTION > ADC_CIC_BITS || ADC_RESOLUTION > 16
+   #error "ADC_RESOLUTION is more than the CIC filter gives, or 16 bits"
+#endif
+
+/** Number of bits dropped from the output of the CIC for ADC_RESOLUTION */
+#define ADC_CIC_SHIFT (ADC_CIC_BITS - ADC_RESOLUTION)
+
+/**
+ * Largest magnitude of a value queued, so the sum or the difference of two
+ *  values, as taken by the first pass of the fft in 16 bits, cannot
+ *  overflow. The offset removed, or the 1x range of ADC_AUTO_GAIN, can take
+ *  the output of the filter just beyond ADC_SAMPLE_BITS
+ */
+#define ADC_SAMPLE_MAX ((1L << (ADC_SAMPLE_BITS - 1)) - 1)
+
+/** Number of fractional bits of the gain of the CIC filter */
+#define ADC_CIC_GAIN_BITS 15
+
+/**
+ * Droop of a stage of the CIC filter per Hz^2, with ADC_CIC_GAIN_BITS+16
+ *  fractional bits. The moving sum of D conversions has the gain
+ *  sin(pi.f/fs)/(D.sin(pi.f/(D.fs))), which is 1-(pi.f/fs)^2.(1-1/D^2)/6
+ *  within 0.2% up to 70Hz at 320Hz
+ */
+#define ADC_CIC_DROOP \
+   ((uint32_t)(3.14159265 * 3.14159265 * \
+      (1.0 - 1.0 / ((double)ADC_OVERSAMPLING * ADC_OVERSAMPLING)) / \
+      (6.0 * ADC_SAMPLE_FREQUENCY * ADC_SAMPLE_FREQUENCY) * \
+      (1UL << (ADC_CIC_GAIN_BITS + 16)) + 0.5))
 
 /** Using the clock, workout the level of pre-scaling required */
-#define ADC_RAW_ADC_COMPARE_VALUE (SYS_CLOCK/ADC_SAMPLE_FREQUENCY)
+#define ADC_RAW_ADC_COMPARE_VALUE (SYS_CLOCK/ADC_CONVERSION_FREQUENCY)
 
 /**
  * Work out the optimum prescaler value such that the output
@@ -61,10 +221,153 @@
 #endif
 
 /** Work out the output compare value (Top) */
-static const uint16_t ADC_COMPARE_VALUE = (SYS_CLOCK/(ADC_SAMPLE_FREQUENCY*ADC_PRESCALE_VALUE))-1;
+#define ADC_COMPARE_VALUE ((SYS_CLOCK/(ADC_CONVERSION_FREQUENCY*ADC_PRESCALE_VALUE))-1)
+
+/**
+ * Clock of the timer 1 in 1/100th of Hz, divided by the conversions per
+ *  sample, to work out the compare value for a sampling rate
+ */
+#define ADC_TIMER_CLOCK_CENTI_HZ \
+   (SYS_CLOCK * 100UL / ADC_PRESCALE_VALUE / ADC_OVERSAMPLING / ADC_CHANNELS)
+
+/** ADMUX for a mux code, with the 2.56V reference */
+#define ADC_ADMUX(mux) (_BV(REFS1) | _BV(REFS0) | ((mux) & 0b11111))
+
+#if ADC_AUTO_TRIGGER
+   /** Trigger source of the conversions, the overflow of the timer1 */
+   #define ADC_ADTS (_BV(ADTS2) | _BV(ADTS1))
+#else
+   /** Conversions started by the timer interrupt. ADTS is not used */
+   #define ADC_ADTS 0
+#endif
+
+/**
+ * ADCSRB for a mux code, in bipolar mode with the 2.56V reference. gsel
+ *  selects the larger gain of the pair (8x or 32x)
+ */
+#define ADC_ADCSRB(mux, gsel) \
+   (_BV(BIN) | ((gsel) ? _BV(GSEL) : 0) | _BV(REFS2) | \
+    ((mux) >> 5 ? _BV(MUX5) : 0) | ADC_ADTS)
+
+/** Mux setups of a channel */
+typedef struct
+{
+   /** Mux setup at 1x and 8x */
+   uint8_t mux;
+   /** Mux setup of the same pins at 20x and 32x */
+   uint8_t muxHighGain;
+} adcChannel_t;
+
+/** Channels scanned in turn */
+static const adcChannel_t adcChannels[ADC_CHANNELS] PROGMEM = ADC_MUX_LIST;
+
+/** ADMUX of each channel, at its gain */
+static uint8_t adcAdmux[ADC_CHANNELS];
+
+/** ADCSRB of each channel, at its gain */
+static uint8_t adcAdcsrb[ADC_CHANNELS];
+
+/** Channel of the conversion in progress */
+static uint8_t adcChannel;
+
+#if ADC_AUTO_GAIN
+/** Ratio of a gain to 32x, with ADC_GAIN_SCALE_BITS fractional bits */
+#define ADC_GAIN_SCALE(gain) \
+   ((int16_t)(((32L << ADC_GAIN_SCALE_BITS) + (gain) / 2) / (gain)))
+
+/**
+ * Peak from which a conversion is close to clipping, out of the 512 of
+ *  the full scale
+ */
+#define ADC_GAIN_CLIP_PEAK 480
+
+/** Peak which a larger gain must leave room for, half of the full scale */
+#define ADC_GAIN_HALF_SCALE 256
+
+/** Setup of a gain */
+typedef struct
+{
+   /** Gain factor */
+   uint8_t gain;
+   /** true to use the mux setup at 20x and 32x */
+   bool isHighGain;
+   /** true to select the larger gain of the pair */
+   bool gsel;
+   /** Ratio of the gain to 32x, to scale the conversions with */
+   int16_t scale;
+} adcGain_t;
+
+/** Gains in increasing order */
+static const adcGain_t adcGains[] PROGMEM = {
+   {  1, false, false, ADC_GAIN_SCALE(1) },
+   {  8, false, true,  ADC_GAIN_SCALE(8) },
+   { 20, true,  false, ADC_GAIN_SCALE(20) },
+   { 32, true,  true,  ADC_GAIN_SCALE(32) },
+};
+
+/** Number of gains */
+#define ADC_GAINS (sizeof(adcGains) / sizeof(adcGains[0]))
+
+/** Gain of each channel, as an index of adcGains */
+static uint8_t adcGainIndex[ADC_CHANNELS];
+
+/** Ratio of the gain of each channel to 32x */
+static int16_t adcGainScale[ADC_CHANNELS];
+
+/** Largest conversion of each channel over the window, in absolute value */
+static uint16_t adcGainPeak[ADC_CHANNELS];
+
+/** Size of the window of the fft, less 1. The gain changes between them */
+static uint8_t adcGainWindowMask;
+
+/** Head of the queue at the start of the first window */
+static uint8_t adcGainWindowStart;
+#endif
+
+/**
+ * Number of samples averaged by adcZero, in 2^n. 64 samples at 320Hz are
+ *  10 cycles of 50Hz or 12 cycles of 60Hz
+ */
+#define ADC_ZERO_M 6
+
+/** Number of samples dropped by adcZero while the filter and gain settle */
+#define ADC_ZERO_SETTLING 8
+
+/** Offset of each channel, in the unit of the output of the CIC filter */
+static int32_t adcOffset[ADC_CHANNELS];
+
+#ifdef ADC_ZERO_MUX
+/** true while adcZero measures the inputs shorted by ADC_ZERO_MUX */
+static bool adcIsZeroing;
+#endif
+
+/** Output compare value in use. Trimmed by adcSetSampleFrequency */
+static uint16_t adcCompareValue = ADC_COMPARE_VALUE;
+
+/** Integrators of the CIC filter of each channel, at the rate of the conversions */
+static uint32_t cicIntegrator[ADC_CHANNELS][ADC_CIC_ORDER];
+
+/** Last input of each comb of the CIC filter of each channel, at the decimated rate */
+static uint32_t cicComb[ADC_CHANNELS][ADC_CIC_ORDER];
+
+/** Number of decimated values to drop while the combs fill up */
+static uint8_t cicSettling;
+
+/** Number of conversions of each channel clipped since the last sample */
+static uint8_t adcClips[ADC_CHANNELS];
+
+#if PROF_ENABLED
+/** Number of periods of the timer1, counted by the interrupt lowering TOV1 */
+static uint16_t adcPeriods;
+#endif
 
-/** Stores the decimated value of the ADC result */
-static volatile int16_t decimated;
+#if ADC_JITTER
+/** Earliest end of conversion since adcGetJitter, in ticks of the timer1 */
+static uint16_t adcJitterEarliest;
+
+/** Latest end of conversion since adcGetJitter, in ticks of the timer1 */
+static uint16_t adcJitterLatest;
+#endif
 
 /** Counter for the decimation */
 static volatile uint8_t decimationCounter;
@@ -73,8 +376,20 @@ static volatile uint8_t decimationCounter;
  * To pass values to the main application
  */
 
-/** true to indicates a new value is ready. The application must the clear it */
-volatile bool adcNewValueFlag;
+/** Decimated values of all the channels waiting for the main loop */
+volatile int16_t adcQueue[ADC_QUEUE_SIZE][ADC_CHANNELS];
+
+/** Number of conversions clipped in each value waiting for the main loop */
+volatile uint8_t adcQueueClips[ADC_QUEUE_SIZE][ADC_CHANNELS];
+
+/** Number of samples ever queued, modulo 256. Only moved by the interrupt */
+volatile uint8_t adcQueueHead;
+
+/** Number of samples ever read, modulo 256. Only moved by the main loop */
+volatile uint8_t adcQueueTail;
+
+/** Number of samples lost to a full queue, up to UINT16_MAX */
+volatile uint16_t adcOverruns;
 
 /** 
  * true to indicate a new conversion has started
@@ -82,36 +397,183 @@ volatile bool adcNewValueFlag;
  */
 volatile bool adcNewConversionStartedFlag;
 
-/** Holds the final decimated value - on 12bits now */
-volatile int16_t adcValue;
+
+/**
+ * Work out the setup of the registers for a channel
+ *
+ * @param channel Channel to setup
+ * @param mux     Mux setup of the channel
+ * @param gsel    true to select the larger gain of the pair
+ */
+static void adcSetupChannel(uint8_t channel, uint8_t mux, bool gsel)
+{
+#ifdef ADC_ZERO_MUX
+   // Keep the inputs shorted until adcZero is done
+   if ( adcIsZeroing )
+   {
+      mux = ADC_ZERO_MUX;
+   }
+#endif
+
+   adcAdmux[channel] = ADC_ADMUX(mux);
+   adcAdcsrb[channel] = ADC_ADCSRB(mux, gsel);
+}
+
+
+#if ADC_AUTO_GAIN
+/**
+ * Select the gain of a channel. It applies from the next conversion of
+ *  the channel.
+ *
+ * @param channel Channel to set the gain of
+ * @param index   Index of the gain in adcGains
+ */
+static void adcSelectGain(uint8_t channel, uint8_t index)
+{
+   const adcGain_t *gain = &adcGains[index];
+   const uint8_t *mux = pgm_read_byte( &gain->isHighGain ) ?
+      &adcChannels[channel].muxHighGain : &adcChannels[channel].mux;
+
+   adcGainIndex[channel] = index;
+   adcGainScale[channel] = (int16_t)pgm_read_word( &gain->scale );
+
+   adcSetupChannel( channel, pgm_read_byte( mux ), pgm_read_byte( &gain->gsel ) );
+}
+
+
+/**
+ * Drop to the lowest gain if the window came close to clipping, or select
+ *  the largest gain which leaves half of the full scale for its peak.
+ *  Called for each channel at the end of each window by the end of
+ *  conversion interrupt.
+ *
+ * @param channel Channel to update the gain of
+ */
+static inline void adcUpdateGain(uint8_t channel)
+{
+   uint8_t index = 0;
+   uint8_t current = adcGainIndex[channel];
+
+   // The peak is unknown once clipped, so the lowest gain is the safest
+   if ( adcGainPeak[channel] < ADC_GAIN_CLIP_PEAK )
+   {
+      // Peak of the window in the unit of 32x
+      uint32_t peak = (uint32_t)adcGainPeak[channel] * adcGainScale[channel];
+
+      // The gain is only stepped down by clipping, so it does not hunt
+      for ( index = ADC_GAINS - 1; index > current; --index )
+      {
+         if ( peak < (uint32_t)ADC_GAIN_HALF_SCALE *
+              (int16_t)pgm_read_word( &adcGains[index].scale ) )
+         {
+            break;
+         }
+      }
+   }
+
+   if ( index != current )
+   {
+      adcSelectGain( channel, index );
+   }
+
+   adcGainPeak[channel] = 0;
+}
+
+
+/**
+ * Set the size of the window of the fft, so the gain only changes between
+ *  windows. The windows are counted from the first value queued since
+ *  adcInit, which is the first sample of the fft.
+ *
+ * @param m Size of the window in 2^m points, up to 256 points
+ */
+void adcSetGainWindow(uint8_t m)
+{
+   adcGainWindowMask = (uint8_t)((1U << m) - 1);
+}
+
+
+/**
+ * Return the gain of a channel
+ *
+ * @param channel Channel to read the gain of
+ * @return The gain factor, 1, 8, 20 or 32
+ */
+uint8_t adcGetGain(uint8_t channel)
+{
+   return pgm_read_byte( &adcGains[adcGainIndex[channel]].gain );
+}
+#endif
 
 
 /**
  * Called to setup the ADC
- * The ADC is triggered by a sleep
+ * The conversions are started by the timer1, from its interrupt or in
+ *  hardware with ADC_AUTO_TRIGGER
  */
 void adcInit()
 {
-   // Init the flags
-   adcNewValueFlag = false;
+   // Init the flags, and drop the values queued before the adc was stopped
+   adcQueueTail = adcQueueHead;
    adcNewConversionStartedFlag = false;
 
    // Setup the interrupt
    decimationCounter=0;
+   adcChannel = 0;
+
+   // Start the filter again, and drop its first values
+   memset( cicIntegrator, 0, sizeof(cicIntegrator) );
+   memset( cicComb, 0, sizeof(cicComb) );
+   memset( adcClips, 0, sizeof(adcClips) );
+   cicSettling = ADC_CIC_ORDER;
+
+#if ADC_JITTER
+   adcJitterEarliest = UINT16_MAX;
+   adcJitterLatest = 0;
+#endif
 
    //
    // Set the ADC registers
    //
 
-   // Use internal 2.56V internal reference, decoupled externally
-   // Set the mux as ADC5+ ADC4- (with signal on + and the ref on -)
-   ADMUX = _BV(REFS1) | _BV(REFS0) | (ADC_MUX & 0b11111);
-
-   // Set the A/D with interrupt enable and prescale by 64
+#if ADC_AUTO_TRIGGER
+   // Leave the A/D on, triggered by the overflow of the timer1, with
+   //  interrupt enable and prescale by ADC_CLOCK_PRESCALE
+   ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1);
+#else
+   // Set the A/D with interrupt enable and prescale by ADC_CLOCK_PRESCALE
    ADCSRA = _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1);
+#endif
+
+   {
+      uint8_t channel;
+
+      for ( channel=0; channel<ADC_CHANNELS; ++channel )
+      {
+#if ADC_AUTO_GAIN
+         // Start from the lowest gain, which cannot clip, and step up from
+         //  there
+         adcSelectGain( channel, 0 );
+         adcGainPeak[channel] = 0;
+#else
+         // Set the gain to 8
+         adcSetupChannel( channel,
+            pgm_read_byte( &adcChannels[channel].mux ), true );
+#endif
+      }
+   }
+
+#if ADC_AUTO_GAIN
+   // The windows start with the first value queued
+   adcGainWindowStart = adcQueueHead;
+#endif
 
-   // Set bipolar mode, gain to 8, 2.56V ref (completes setup of ADMUX)
-   ADCSRB = _BV(BIN) | _BV(GSEL) | _BV(REFS2) | _BV(MUX5 * (ADC_MUX>>5));
+   // Use internal 2.56V internal reference, decoupled externally, with the
+   //  mux of the first channel
+   ADMUX = adcAdmux[0];
+
+   // Set bipolar mode and 2.56V ref (completes setup of ADMUX)
+   ADCSRB = adcAdcsrb[0];
 
    // Turn off digital input all all unused digital pins
    DIDR0 = _BV(ADC5D) | _BV(ADC4D) | _BV(AREFD);
@@ -120,13 +582,21 @@ void adcInit()
    // Set timer1 which gives the beat for the ADC conversions
    //
 
+   // TIMSK is shared with the uart, whose interrupts change it meanwhile
+   cli();
+
    // Set the compare value (10-bits mode) for the OCR1C which controls the TOP
    //  value of the timer. When TOP is reached, a TOV interrupt is triggered.
-   TC1H = ADC_COMPARE_VALUE >> 8;
-   OCR1C = ADC_COMPARE_VALUE & 0xff;
+   TC1H = adcCompareValue >> 8;
+   OCR1C = adcCompareValue & 0xff;
 
+#if ADC_AUTO_TRIGGER
+   // The first overflow must raise the flag to trigger a conversion
+   TIFR = _BV(TOV1);
+#else
    // Enable the timer overflow interrupt
    TIMSK |= _BV(TOIE1);
+#endif
 
    // Set the clock source and reset the prescaler
    TCCR1B = _BV(PSR1) | ADC_PRESCALE_MSK;
@@ -161,38 +631,316 @@ void adcShutdown()
 
 
 /**
- * Interrupt handler called periodically, every 320Hz to start a
- * burst of ADC convertions.
- * All this interrupt does is to turn the ADC on again. It does
- * not start a new conversion, as this will automatically happen
- * when we enter sleep mode
+ * Trim the sampling rate. The rate is set by the compare value of the
+ *  timer 1, so it moves by steps of about 1/800th around 320Hz. The
+ *  conversions follow, ADC_OVERSAMPLING times faster for each channel.
+ * The new rate applies from the next period of the timer.
+ *
+ * @param frequency Sampling rate in 1/100th of Hz
+ */
+void adcSetSampleFrequency(uint16_t frequency)
+{
+   uint32_t top = (ADC_TIMER_CLOCK_CENTI_HZ + frequency/2) / frequency - 1;
+
+   // The timer 1 counts on 10 bits
+   adcCompareValue = top > 0x3FF ? 0x3FF : (uint16_t)top;
+
+   // TC1H is shared by all 10-bit accesses to the timer 1
+   cli();
+   TC1H = adcCompareValue >> 8;
+   OCR1C = adcCompareValue & 0xff;
+   sei();
+}
+
+
+/**
+ * Move the offset of a channel towards the mean of its last samples
+ *
+ * @param channel Channel to correct
+ * @param sum     Sum of 2^m samples of the channel, as given by adcGetValues
+ * @param m       Number of samples summed in 2^m
+ * @param shift   Step of the correction in 2^-n of the mean
+ */
+static void adcMoveOffset(uint8_t channel, int32_t sum, uint8_t m, uint8_t shift)
+{
+   // Bring the mean in the unit of the output of the CIC, which has
+   //  ADC_CIC_SHIFT more bits, without overflowing
+   int32_t mean = sum >> m;
+   int32_t residual = mean * (1L << ADC_CIC_SHIFT) +
+      (((sum - mean * (1L << m)) << ADC_CIC_SHIFT) >> m);
+
+   // The offset is read by the interrupt
+   cli();
+   adcOffset[channel] += residual >> shift;
+   sei();
+}
+
+
+/**
+ * Measure the offset of all the channels, once the adc is initialised,
+ *  and start the conversions again so the next value is the first one
+ *  measured with it. Waits for 2^ADC_ZERO_M samples, about 250ms in all.
+ */
+void adcZero(void)
+{
+   int32_t sums[ADC_CHANNELS];
+   int16_t values[ADC_CHANNELS];
+   uint8_t clips[ADC_CHANNELS];
+   uint8_t channel;
+   uint8_t n = 0;
+
+   memset( sums, 0, sizeof(sums) );
+
+#ifdef ADC_ZERO_MUX
+   // Short the inputs of all the channels, from their next conversion
+   cli();
+   adcIsZeroing = true;
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
+   {
+      adcSetupChannel( channel, ADC_ZERO_MUX, (adcAdcsrb[channel] & _BV(GSEL)) != 0 );
+   }
+
+   ADMUX = adcAdmux[adcChannel];
+   ADCSRB = adcAdcsrb[adcChannel];
+   sei();
+#endif
+
+   // Let the filter and the gain settle, then sum whole cycles of the mains
+   while ( n < ADC_ZERO_SETTLING + (1 << ADC_ZERO_M) )
+   {
+      sleep_mode();
+
+      while ( adcHasNewValue() && n < ADC_ZERO_SETTLING + (1 << ADC_ZERO_M) )
+      {
+         adcGetValues( values, clips );
+
+         if ( n++ >= ADC_ZERO_SETTLING )
+         {
+            for ( channel=0; channel<ADC_CHANNELS; ++channel )
+            {
+               sums[channel] += values[channel];
+            }
+         }
+      }
+   }
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
+   {
+      adcMoveOffset( channel, sums[channel], ADC_ZERO_M, 0 );
+   }
+
+#ifdef ADC_ZERO_MUX
+   adcIsZeroing = false;
+#endif
+
+   // Start again, with the mux setup of each channel
+   cli();
+   adcShutdown();
+   adcInit();
+}
+
+
+/**
+ * Follow the drift of the offset of a channel with a first order low pass,
+ *  given the mean of a window of samples. Only call while the circuit is
+ *  idle, so the window holds nothing but the residual offset.
+ *
+ * @param channel Channel to correct
+ * @param sum     Sum of the 2^m samples of the window
+ * @param m       Size of the window in 2^m points
+ */
+void adcTrackOffset(uint8_t channel, int32_t sum, uint8_t m)
+{
+   adcMoveOffset( channel, sum, m, ADC_OFFSET_FILTER_SHIFT );
+}
+
+
+/**
+ * Return the offset of a channel removed from the values
+ *
+ * @param channel Channel to read the offset of
+ * @return The offset, in the unit of the values
+ */
+int16_t adcGetOffset(uint8_t channel)
+{
+   int32_t offset;
+
+   cli();
+   offset = adcOffset[channel];
+   sei();
+
+   return (int16_t)((offset + (1L << ADC_CIC_SHIFT) / 2) >> ADC_CIC_SHIFT);
+}
+
+
+/**
+ * Divide a value by the gain of the CIC filter at a frequency, to
+ *  compensate its droop. The frequency is relative to ADC_SAMPLE_FREQUENCY,
+ *  which the tracking of the mains keeps it at.
  *
- * This interrupt is also used to scan the keppad, and update
- * the state machine accordingly. Although this could introduce
- * some jitter in the conversion process, it should have a
- * negligable effect.
+ * @param value     Value to scale, such as a ratio to the unit of the values
+ * @param frequency Frequency of the signal measured in Hz, up to 100Hz
+ * @return The value divided by the gain, saturated to 16 bits
  */
+uint16_t adcCompensateDroop(uint16_t value, uint8_t frequency)
+{
+   uint32_t stageGain = (1UL << ADC_CIC_GAIN_BITS) -
+      (((uint32_t)frequency * frequency * ADC_CIC_DROOP) >> 16);
+   uint32_t gain = 1UL << ADC_CIC_GAIN_BITS;
+   uint32_t retval;
+   uint8_t stage;
+
+   for ( stage=0; stage<ADC_CIC_ORDER; ++stage )
+   {
+      gain = (gain * stageGain) >> ADC_CIC_GAIN_BITS;
+   }
+
+   retval = (((uint32_t)value << ADC_CIC_GAIN_BITS) + gain/2) / gain;
+
+   return retval > UINT16_MAX ? UINT16_MAX : (uint16_t)retval;
+}
+
+
+#if ADC_JITTER
+/**
+ * Return the earliest and latest delays from the overflow of the timer1 to
+ *  the end of conversion interrupt, since the last call, and start over.
+ *  The jitter is the spread between both.
+ *
+ * @param earliest Where to store the earliest delay, in CPU cycles
+ * @param latest   Where to store the latest delay, in CPU cycles
+ */
+void adcGetJitter(uint16_t *earliest, uint16_t *latest)
+{
+   cli();
+   *earliest = adcJitterEarliest * ADC_PRESCALE_VALUE;
+   *latest = adcJitterLatest * ADC_PRESCALE_VALUE;
+   adcJitterEarliest = UINT16_MAX;
+   adcJitterLatest = 0;
+   sei();
+}
+#endif
+
+
+#if PROF_ENABLED
+/**
+ * Return the time given by the timer1 and the count of its periods. Only
+ *  the difference between two times is meaningful, up to 65535 cycles,
+ *  while the sampling rate is not trimmed. Call with the interrupts
+ *  disabled, or from the main loop.
+ * An overflow is not counted yet while TOV1 is up. The count of the timer
+ *  is read first, so an overflow coming after it, with TOV1 up and a
+ *  count near the top, is not counted twice. TOV1 goes down by the end of
+ *  the conversion at the latest, within half a period.
+ * The interrupt of the overflow lowers TOV1 on entry, so it counts the
+ *  period before reading the time.
+ *
+ * @return The time in CPU cycles, modulo 65536
+ */
+uint16_t adcGetTime(void)
+{
+   uint8_t sreg = SREG;
+   uint16_t count;
+   uint16_t periods;
+   uint8_t low;
+
+   cli();
+
+   low = TCNT1;
+   count = (uint16_t)TC1H << 8 | low;
+   periods = adcPeriods;
+
+   if ( (TIFR & _BV(TOV1)) && count < adcCompareValue / 2 )
+   {
+      ++periods;
+   }
+
+   SREG = sreg;
+
+   return (periods * (adcCompareValue + 1) + count) * ADC_PRESCALE_VALUE;
+}
+#endif
+
+
+/**
+ * Return the actual sampling rate, given the compare value in use
+ *
+ * @return The sampling rate in 1/100th of Hz
+ */
+uint16_t adcGetSampleFrequency(void)
+{
+   return (uint16_t)(ADC_TIMER_CLOCK_CENTI_HZ / (adcCompareValue + 1UL));
+}
+
+
+/**
+ * Interrupt handler called periodically, ADC_OVERSAMPLING times per
+ *  sample and channel, to start a conversion.
+ * The ADC is turned on and the conversion started straight away, so the
+ *  conversions are evenly spread whatever the main loop is doing.
+ * The first conversion of each sample is flagged for adcTick.
+ */
+#if ! ADC_AUTO_TRIGGER
 ISR( TIMER1_OVF_vect )
 {
+#if PROF_ENABLED
+   // The hardware lowered TOV1 on entering the interrupt. Count the period
+   //  before reading the time
+   ++adcPeriods;
+#endif
+
+   profStart(profAdcTimer_e);
    dbgToggle(DBG_ADC);
 
-   // Turn-on the A/D converter, which will automatically start once we enter sleep mode
-   ADCSRA |=_BV(ADEN);
+   // Turn-on the A/D converter and start a conversion
+   ADCSRA |= _BV(ADEN) | _BV(ADSC);
 
-   // Flag a new conversion was started
-   adcNewConversionStartedFlag = true;
+   // Flag a new sample was started
+   if ( decimationCounter == 0 && adcChannel == 0 )
+   {
+      adcNewConversionStartedFlag = true;
+   }
+
+   profStop(profAdcTimer_e);
 }
+#endif
 
 
 /**
  * Interrupt called upon a conversion finished. 
- * The ADC value is read, decimated and the adcNewValueFlag set 
- *  if necessary.
+ * The ADC value is read, integrated by the CIC filter of its channel, and
+ *  the channels are decimated and queued for the main loop after the last
+ *  conversion of the last channel. The next channel is then selected.
  */
 ISR(ADC_vect)
 {
    int8_t adcl;
    int8_t adch;
+   int16_t conversion;
+   uint32_t value;
+   uint8_t channel = adcChannel;
+   uint8_t stage;
+
+   profStart(profAdc_e);
+
+#if ADC_JITTER
+   // Time the interrupt from the overflow, reading TCNT1 first latches TC1H
+   {
+      uint8_t low = TCNT1;
+      uint16_t delay = (uint16_t)TC1H << 8 | low;
+
+      if ( delay < adcJitterEarliest )
+      {
+         adcJitterEarliest = delay;
+      }
+
+      if ( delay > adcJitterLatest )
+      {
+         adcJitterLatest = delay;
+      }
+   }
+#endif
 
    // Toggle the debug led (this will show a blip in the sequence)
    dbgToggle(DBG_ADC);
@@ -201,6 +949,12 @@ ISR(ADC_vect)
    adcl = ADCL;  // read out ADCL register and lock ADCH
    adch = ADCH;  // read out ADCH register
 
+#if ! ADC_AUTO_TRIGGER
+   // Turn off the ADC, so that no new conversion will be started upon entering
+   // sleep
+   ADCSRA &= ~_BV(ADEN);
+#endif
+
    // Since the ADC is configured in biploar mode, the result needs to be adjusted
    // If the MSB is 1, the number is negative and needs adjusting
    if ( adch & 0b10 )
@@ -209,34 +963,147 @@ ISR(ADC_vect)
       adch |= 0xFE;
    }
 
-   // Accumulate over the decimated value
-   decimated += (adch<<8 | adcl);
+   conversion = (int16_t)(adch<<8 | (uint8_t)adcl);
+
+   // Count the conversion if clipped, without a branch. The bits 9:1 of
+   //  conversion+513 are only all clear for -512 and 511, so less 1 only
+   //  borrows into the bit 15 for these
+   adcClips[channel] +=
+      (uint16_t)(((uint16_t)(conversion + 513) & 0x3FE) - 1) >> 15;
 
-   // Increment the decimation counter
-   ++decimationCounter;
+#if ADC_AUTO_GAIN
+   // Keep the peak of the window, and bring the conversion to the unit of 32x
+   {
+      uint16_t magnitude = conversion < 0 ? -conversion : conversion;
+
+      if ( magnitude > adcGainPeak[channel] )
+      {
+         adcGainPeak[channel] = magnitude;
+      }
+   }
 
-   // Fast modulo 16
-   decimationCounter &= 0x0F;
+   value = (uint32_t)((int32_t)conversion * adcGainScale[channel]);
+#else
+   value = (uint32_t)(int32_t)conversion;
+#endif
 
-   // Have we collected enough values to decimate?
-   if ( decimationCounter == 0 )
+   // Integrate the conversion through all the stages of its channel
+   for ( stage=0; stage<ADC_CIC_ORDER; ++stage )
    {
-      // Adjust the value to remove the noise
-      adcValue = decimated >> 2;
+      value = cicIntegrator[channel][stage] += value;
+   }
+
+   // Move on to the next channel. The sample moves on after the last one
+   if ( ++channel == ADC_CHANNELS )
+   {
+      channel = 0;
+
+      // Increment the decimation counter, modulo ADC_OVERSAMPLING
+      decimationCounter = (decimationCounter + 1) & (ADC_OVERSAMPLING - 1);
+   }
 
-      // Set the flag to be read by the main loop
-      adcNewValueFlag = true;
+   adcChannel = channel;
 
-      // Reset the decimation
-      decimated = 0;
+   // Setup the mux and gain of the next conversion while the ADC is off,
+   //  or before the next trigger
+   ADMUX = adcAdmux[channel];
+   ADCSRB = adcAdcsrb[channel];
 
-      // Turn off the ADC, so that no new conversion will be started upon entering
-      // sleep
-      ADCSRA &= ~_BV(ADEN);
+#if ADC_AUTO_TRIGGER
+   // Flag the next conversion starts a new sample, as the timer interrupt would
+   if ( channel == 0 && decimationCounter == 0 )
+   {
+      adcNewConversionStartedFlag = true;
    }
+#endif
+
+   // Have we collected enough values of the last channel to decimate?
+   if ( channel == 0 && decimationCounter == 0 )
+   {
+      uint8_t head = adcQueueHead;
+      bool isQueued =
+         cicSettling == 0 && (uint8_t)(head - adcQueueTail) < ADC_QUEUE_SIZE;
+
+      for ( channel=0; channel<ADC_CHANNELS; ++channel )
+      {
+         // Differentiate the last integral through all the combs
+         value = cicIntegrator[channel][ADC_CIC_ORDER - 1];
+
+         for ( stage=0; stage<ADC_CIC_ORDER; ++stage )
+         {
+            uint32_t previous = cicComb[channel][stage];
+
+            cicComb[channel][stage] = value;
+            value -= previous;
+         }
+
+         // Remove the offset, scale the value to ADC_RESOLUTION, clamp it,
+         //  and queue it for the main loop
+         if ( isQueued )
+         {
+            int32_t sample = ((int32_t)value - adcOffset[channel]) >> ADC_CIC_SHIFT;
+
+            if ( sample > ADC_SAMPLE_MAX )
+            {
+               sample = ADC_SAMPLE_MAX;
+            }
+            else if ( sample < -ADC_SAMPLE_MAX )
+            {
+               sample = -ADC_SAMPLE_MAX;
+            }
+
+            adcQueue[head & (ADC_QUEUE_SIZE - 1)][channel] = (int16_t)sample;
+            adcQueueClips[head & (ADC_QUEUE_SIZE - 1)][channel] = adcClips[channel];
+         }
+
+         adcClips[channel] = 0;
+      }
+
+      if ( cicSettling != 0 )
+      {
+         // The combs do not hold a whole sample yet
+         --cicSettling;
+      }
+      else if ( isQueued )
+      {
+         adcQueueHead = ++head;
+
+#if ADC_AUTO_GAIN
+         // The next sample starts a window of the fft
+         if ( ((uint8_t)(head - adcGainWindowStart) & adcGainWindowMask) == 0 )
+         {
+            for ( channel=0; channel<ADC_CHANNELS; ++channel )
+            {
+               adcUpdateGain( channel );
+            }
+
+            // The first channel is converted next
+            ADMUX = adcAdmux[0];
+            ADCSRB = adcAdcsrb[0];
+         }
+#endif
+      }
+      else if ( adcOverruns != UINT16_MAX )
+      {
+         // The main loop is too late. Make the loss visible
+         ++adcOverruns;
+      }
+   }
+
+#if ADC_AUTO_TRIGGER
+   // Lower the overflow flag, once the mux is setup, so the next overflow
+   //  triggers the next conversion
+   TIFR = _BV(TOV1);
+
+#if PROF_ENABLED
+   ++adcPeriods;
+#endif
+#endif
 
    // Toggle the debug LED back
    dbgToggle(DBG_ADC);
+
+   profStop(profAdc_e);
 }
 
 
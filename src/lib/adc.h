@@ -14,52 +14,233 @@
  *  by interrupts. It is important that the main code enters sleep has soon and often as possible
  *  possibly only doing that, and check if new decimated values are ready by calling
  *  adcHasNewValue. 
- * Once the value (obtained with adcGetValue) has been processed, it must
- *  be reset to prepare for the next incomming value using adcValueProcessed.
+ * The values are queued, so each of them must be read with adcGetValue,
+ *  until adcHasNewValue returns false. Values lost to a full queue are
+ *  counted by adcGetOverruns.
+ * With ADC_CHANNELS, the values of all the channels of a sample are read
+ *  at once with adcGetValues, along with the number of conversions of
+ *  each which hit the limits of the adc, and were clipped.
+ * The DC offset of each channel is measured by adcZero once the adc is
+ *  initialised, and removed from the values. adcTrackOffset follows its
+ *  drift while the circuit is idle.
+ * With ADC_JITTER, adcGetJitter tells how much the conversions move
+ *  from one sample to the next.
+ * With ADC_AUTO_GAIN, the gain of the differential input follows the
+ *  signal. It only changes between the windows of the fft, whose size is
+ *  given by adcSetGainWindow, and the values keep the same unit whatever
+ *  the gain.
  *
  * @author software@arreckx.com
  *****************************************************************************
  */
 
 #include "wgx.h"
+#include "prof.h"
+
+#ifndef ADC_OVERSAMPLING
+   /**
+    * Number of conversions decimated into each sample, a power of 2. The
+    *  first conversion after turning the ADC on takes 25 ADC clocks, 195us,
+    *  which limits it to 8 at 320Hz
+    */
+   #define ADC_OVERSAMPLING 8
+#endif
+
+#ifndef ADC_CIC_ORDER
+   /** Number of stages of the CIC decimation filter. 1 is a moving sum */
+   #define ADC_CIC_ORDER 1
+#endif
+
+#ifndef ADC_RESOLUTION
+   /** Number of bits of the decimated values */
+   #define ADC_RESOLUTION 12
+#endif
+
+#ifndef ADC_AUTO_TRIGGER
+   /**
+    * Start the conversions in hardware on the overflow of the timer1, with
+    *  the ADC left on (1), rather than from its interrupt (0). The sample
+    *  instants then do not jitter with the latency of the interrupt
+    */
+   #define ADC_AUTO_TRIGGER 0
+#endif
+
+#ifndef ADC_JITTER
+   /** Time the end of conversion interrupts for adcGetJitter (1) */
+   #define ADC_JITTER 0
+#endif
+
+#ifndef ADC_AUTO_GAIN
+   /**
+    * Switch the gain of the differential input between 1x, 8x, 20x and 32x
+    *  to follow the signal (1), rather than staying at 8x (0)
+    */
+   #define ADC_AUTO_GAIN 0
+#endif
+
+#ifndef ADC_MUX_HIGH_GAIN
+   /**
+    * Mux setup of the 20x and 32x gains of the pins of ADC_MUX. The
+    *  datasheet gives each pair of pins the even code for 20x/32x, followed
+    *  by the odd code for 1x/8x
+    */
+   #define ADC_MUX_HIGH_GAIN (ADC_MUX & ~1)
+#endif
+
+#ifndef ADC_CHANNELS
+   /** Number of channels scanned in turn, set by ADC_MUX_LIST */
+   #define ADC_CHANNELS 1
+#endif
+
+#ifndef ADC_MUX_LIST
+   /**
+    * Mux setups of each channel, at 1x/8x then 20x/32x, scanned in turn.
+    *  Holds ADC_CHANNELS entries
+    */
+   #define ADC_MUX_LIST { { ADC_MUX, ADC_MUX_HIGH_GAIN } }
+#endif
+
+#if ADC_CHANNELS < 1
+   #error "ADC_CHANNELS must be 1 at least"
+#endif
+
+#ifndef ADC_OFFSET_FILTER_SHIFT
+   /**
+    * Time constant of the tracking of the offset, in 2^n windows. 6 follows
+    *  the drift of the bias of a sensor within 13s of idle time
+    */
+   #define ADC_OFFSET_FILTER_SHIFT 6
+#endif
+
+/**
+ * Number of bits of the values. They are in the unit of ADC_RESOLUTION at
+ *  8x, so the 1x range of ADC_AUTO_GAIN needs 3 more bits
+ */
+#define ADC_SAMPLE_BITS (ADC_RESOLUTION + 3 * ADC_AUTO_GAIN)
+
+#ifndef ADC_QUEUE_SIZE
+   /** Number of decimated values queued for the main loop */
+   #define ADC_QUEUE_SIZE 4
+#endif
+
+#if ADC_QUEUE_SIZE > 128 || (ADC_QUEUE_SIZE & (ADC_QUEUE_SIZE - 1)) != 0
+   #error "ADC_QUEUE_SIZE must be a power of 2, up to 128"
+#endif
 
-extern volatile bool adcNewValueFlag;
 extern volatile bool adcNewConversionStartedFlag;
-extern volatile int16_t adcValue;
+extern volatile int16_t adcQueue[ADC_QUEUE_SIZE][ADC_CHANNELS];
+extern volatile uint8_t adcQueueClips[ADC_QUEUE_SIZE][ADC_CHANNELS];
+extern volatile uint8_t adcQueueHead;
+extern volatile uint8_t adcQueueTail;
+extern volatile uint16_t adcOverruns;
+
+void     adcInit(void);
+void     adcShutdown(void);
+void     adcSetSampleFrequency(uint16_t frequency);
+uint16_t adcGetSampleFrequency(void);
+void     adcZero(void);
+void     adcTrackOffset(uint8_t channel, int32_t sum, uint8_t m);
+int16_t  adcGetOffset(uint8_t channel);
+uint16_t adcCompensateDroop(uint16_t value, uint8_t frequency);
+
+#if ADC_JITTER
+void     adcGetJitter(uint16_t *earliest, uint16_t *latest);
+#endif
 
-void adcInit(void);
-void adcShutdown(void);
+#if PROF_ENABLED
+uint16_t adcGetTime(void);
+#endif
+
+#if ADC_AUTO_GAIN
+void     adcSetGainWindow(uint8_t m);
+uint8_t  adcGetGain(uint8_t channel);
+#else
+/** The gain is fixed, so any window will do */
+static inline void adcSetGainWindow(uint8_t m)
+   { (void)m; }
+
+/** @return The fixed gain of 8x */
+static inline uint8_t adcGetGain(uint8_t channel)
+   { (void)channel; return 8; }
+#endif
 
 /**
  * Reports wether a new results is ready.
- * Calling this method resets the internal flag.
+ * The head is a single byte, so it is read atomically without a lock.
  *
  * @return true is a new result is ready
  */
 static inline bool adcHasNewValue(void)
-{
-   bool retval;
-
-   // Force atomic read and reset
-   cli();
-   retval = adcNewValueFlag;
-   adcNewValueFlag = false;
-   sei();
-
-   return retval;
-}
+   { return adcQueueHead != adcQueueTail; }
 
 /**
- * Return the sampled, decimated and signed adjusted value.
+ * Return the oldest sampled, decimated and signed adjusted value, and
+ *  remove it from the queue. Must only be called once adcHasNewValue has
+ *  returned true.
  * The value has been adjusted to reflect the over-sampling and decimation
  *  and is provided as a regular 16 bits signed number.
  * No other adjusted is made, so the result is the raw value has measured
- *  by the adc converter.
+ *  by the adc converter, in the unit of ADC_RESOLUTION at 8x whatever the
+ *  gain, clamped within +/-(2^(ADC_SAMPLE_BITS-1)-1).
+ * The interrupt does not write the slot until the tail has moved past it.
+ *
+ * With ADC_CHANNELS, only the value of the first channel is returned.
  *
  * @return The sampled value in a signed 16 bits number.
  */
 static inline int16_t adcGetValue(void)
-   { return adcValue; }
+{
+   uint8_t tail = adcQueueTail;
+   int16_t retval = adcQueue[tail & (ADC_QUEUE_SIZE - 1)][0];
+
+   adcQueueTail = tail + 1;
+
+   return retval;
+}
+
+/**
+ * Copy the oldest values of all the channels, and remove them from the
+ *  queue. Must only be called once adcHasNewValue has returned true.
+ * A clipped conversion reads the largest or smallest value of the adc,
+ *  whatever the input beyond, so a value with clipped conversions is
+ *  short of the signal.
+ *
+ * @param values Where to copy the ADC_CHANNELS values, as given by
+ *               adcGetValue
+ * @param clips  Where to copy the number of conversions of each channel
+ *               clipped in the values, out of ADC_OVERSAMPLING
+ */
+static inline void adcGetValues(int16_t *values, uint8_t *clips)
+{
+   uint8_t tail = adcQueueTail;
+   uint8_t channel;
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
+   {
+      values[channel] = adcQueue[tail & (ADC_QUEUE_SIZE - 1)][channel];
+      clips[channel] = adcQueueClips[tail & (ADC_QUEUE_SIZE - 1)][channel];
+   }
+
+   adcQueueTail = tail + 1;
+}
+
+/**
+ * Return the number of values lost because the main loop was too late
+ *  to read them, since power up. Saturates at UINT16_MAX.
+ *
+ * @return The number of values lost
+ */
+static inline uint16_t adcGetOverruns(void)
+{
+   uint16_t retval;
+
+   // Force atomic read
+   cli();
+   retval = adcOverruns;
+   sei();
+
+   return retval;
+}
 
 /**
  * Check whether a new conversion is in progress.
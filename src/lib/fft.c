@@ -11,312 +11,888 @@
  *  has a predictable worse case duration, making this algorithm highly
  *  suitable for being called within a real time system.
  * The result will lag in time by 2x the FFT window size.
+ * Up to FFT_MAX_BINS bins can be computed in the same pass, typically the
+ *  fundamental and some odd harmonics. The bins which follow the same path
+ *  through the passes share their butterflies. Where two paths split, both
+ *  outputs of the butterflies are kept in place in the complex buffer, the
+ *  sum in the lower half of the region and the difference in the upper half,
+ *  so no more memory is required. This only holds if all bins take the same
+ *  branch in the first pass which reads the samples, that is if all bins
+ *  have the same parity - which is always the case of odd harmonics.
+ *  Each call computes one butterfly for each path at most.
+ * Setting FFT_OVERLAP to 1 runs a second fft staggered by half a window,
+ *  so a result is ready every FFT_H samples, and the worst case lag drops
+ *  to 1.5x the window size. Both ffts share the sample and complex buffers:
+ *  the fft in its first pass only ever writes the complex values that the
+ *  other fft has just finished with. Each call then computes at most two
+ *  butterflies, or one butterfly and a result, so the worst case duration
+ *  of fftNext doubles.
  * The twiddle factors are stored in flash memory to save RAM.
+ *  Only the factors along the paths of the bins are ever read. Setting
+ *  FFT_TWIDDLE_CACHE to a number of entries makes fftInit copy those into
+ *  the context in the order of use, so the butterflies read them in sequence
+ *  from RAM rather than copying them from flash. The cache holds Q15 factors
+ *  with FFT_FIXED_POINT. If the paths need more entries than the cache has,
+ *  the full table in flash is used instead. The saving per sample is given
+ *  by comparing the timings reported by testFFT and testFFTCache.
+ *  Setting FFT_TWIDDLE_PATH to 1 rather reads the factors in sequence from
+ *  the per-bin tables created in twiddlePath.c by wgen.py, for a single bin.
+ *  testFFTPath times it. Neither saving has been recorded on the ATtiny861
+ *  yet (see docs/TODO.txt), so lungmate reads the full table.
  * The incomming samples are stored in a separate buffer again to save RAM.
+ *  Setting FFT_COMPACT to 1 goes further: the first pass stores the sum or
+ *  the difference of each pair of samples, which is real, in the slot of
+ *  the second sample, since the slot is not read again before the next
+ *  window overwrites it. The twiddle factor of the first pass is applied
+ *  as the second pass reads the slots back: given the raw outputs d
+ *  and e, W^(j+N/4) = i.W^j, so the butterfly outputs are (d + ie).W^j
+ *  and (d - ie).W^3j, a single complex product each. The complex buffer
+ *  then only holds the outputs of the second pass, that is FFT_H/2 values
+ *  for a single bin. This cannot be used with FFT_OVERLAP since the other
+ *  fft still needs the samples, nor with FFT_TWIDDLE_PATH whose tables
+ *  are in the standard order. The results match the standard layout
+ *  within the rounding of the factors, which testFFTLayout checks for all
+ *  fft sizes (see fftLayoutTest.sh).
+ * With FFT_MIN_M, the size of the window is given to fftInit. The passes,
+ *  masks and offsets follow the size of the window held in the context,
+ *  and the twiddle factors are read from the table of FFT_N points with
+ *  the stride worked out by fftInit, that is W(n)^k = W(FFT_N)^(k.FFT_N/n).
+ *  The per-bin tables of FFT_TWIDDLE_PATH only exist for FFT_N points, so
+ *  smaller windows read the full table.
+ *
+ * The butterflies are computed in floating point by default. Setting
+ *  FFT_FIXED_POINT to 1 in the config file computes them in fixed point
+ *  instead, with Q15 twiddle factors and 32-bit accumulators, which avoids
+ *  the soft-float library altogether.
+ * Each sample is given FFT_GUARD_BITS fractional bits as it enters the
+ *  butterflies, so the rounding of the products is negligible, and the error
+ *  is dominated by the Q15 quantization of the twiddle factors.
+ *  Compared with the floating point build on the host with random 12-bit
+ *  samples, the magnitude differs by less than 0.12 for all sizes from 8 to
+ *  256 points (0.05 for 64 points), that is under 0.006% of the full scale,
+ *  before it is rounded to 1/8th of a sample unit.
+ * The result is the square of the magnitude, so no square root is taken.
+ *  Both parts of the bin are rounded to 16 bits with
+ *  FFT_RESULT_FRACTION_BITS fractional bits and kept in the context. They
+ *  are squared with two 16x16 bits multiplications as the result is read,
+ *  or given to the magnitude estimator selected by FFT_MAGNITUDE, which is
+ *  computed with shifts and adds only.
+ * The worst case duration of fftNext for either arithmetic is reported by
+ *  the fft unit test (testFFT) which times each call with the timer 1,
+ *  along with its average per sample. Neither has been recorded on the
+ *  ATtiny861 yet (see docs/TODO.txt), so lungmate keeps the floating
+ *  point the fft was first deployed with.
  *
  * @author software@arreckx.com
  *****************************************************************************
  -*/
 
-#include <math.h>
 #include <string.h>
 
 #include "wgx.h"
 #include "fft.h"
 
-// Check all constants required. These should be defined in the config.h file
-#ifndef FFT_M
-   #error "FFT_M must be defined in config.h"
+// The sliding DFT replaces this implementation altogether
+#if ! FFT_SLIDING_DFT
+
+// The overlapped ffts leave no room in the complex buffer to split the paths
+#if FFT_OVERLAP && (FFT_MAX_BINS > 1)
+   #error "FFT_OVERLAP can only be used with a single bin (FFT_MAX_BINS 1)"
 #endif
 
-#ifndef ADC_SAMPLE_FREQUENCY
-   #error "ADC_SAMPLE_FREQUENCY must be defined in config.h"
+#if FFT_TWIDDLE_CACHE && FFT_TWIDDLE_PATH
+   #error "Use either FFT_TWIDDLE_CACHE or FFT_TWIDDLE_PATH"
 #endif
 
+// The compact layout overwrites the samples the overlapped fft still reads
+#if FFT_COMPACT && FFT_OVERLAP
+   #error "FFT_COMPACT cannot be used with FFT_OVERLAP"
+#endif
 
-/** Size of the FFT window in points */
-#define FFT_N (1 << FFT_M)
+#if FFT_COMPACT && FFT_TWIDDLE_PATH
+   #error "FFT_COMPACT cannot be used with FFT_TWIDDLE_PATH"
+#endif
 
-/** Half the size of the FFT window */
-#define FFT_H (FFT_N/2)
+/** Name of the twiddle factor type expected by twiddle.c */
+typedef fftTwiddle_t twiddle_t;
 
-/** Compute the bin to compute */
-#define FFT_BIN_SIZE (ADC_SAMPLE_FREQUENCY / FFT_N)
+#if FFT_FIXED_POINT
+/**
+ * Number of fractional bits given to the samples as they enter the
+ *  butterflies. Each pass can at most double the values, so this leaves
+ *  enough headroom after FFT_M passes for the sum of two samples to use
+ *  all of its 16 bits.
+ */
+#define FFT_GUARD_BITS (15 - FFT_M)
 
 /**
- * Define a fast index type, enough for the size of fft we
- *  are dealing with, but lean on memory
+ * Number of bits to drop from a bin to get the magnitude with
+ *  FFT_RESULT_FRACTION_BITS fractional bits. The bin holds half the size
+ *  of the window times the amplitude, with the guard bits.
  */
-#if (FFT_N > 256)
-typedef uint16_t index_t;
+#define FFT_RESULT_SHIFT(ctx) \
+   (FFT_GUARD_BITS + FFT_CTX_M(ctx) - 1 - FFT_RESULT_FRACTION_BITS)
+#else
+/** Scale of a bin to get the magnitude with the fractional bits */
+#define FFT_RESULT_SCALE(ctx) \
+   ((float)(1 << FFT_RESULT_FRACTION_BITS) / FFT_CTX_H(ctx))
+#endif
+
+#if FFT_MIN_M < FFT_M
+   /** Step between the factors of the window in the table of FFT_N points */
+   #define FFT_CTX_STRIDE(ctx) ((ctx)->stride)
 #else
-typedef uint8_t index_t;
+   /** The window reads the table of FFT_N points in sequence */
+   #define FFT_CTX_STRIDE(ctx) 1
 #endif
 
-/** Define the type of raw data comming in */
-typedef int16_t sample_t;
+/** Keep the sum of the butterflies of a region */
+#define FFT_SUM   1
 
-/** Define the complex type */
+/** Keep the 'twiddled' difference of the butterflies of a region */
+#define FFT_DIFF  2
+
+// Include the twiddle coeffs locally.
+// This will make the data local and the code much more compact
+#include "twiddle.c"
+
+#if FFT_TWIDDLE_PATH
+/** Entry of the index of the per-bin tables of twiddlePath.c */
 typedef struct
 {
-   /** Real part of the number */
-   float real;
-   /** Imaginary part of the number */
-   float imag;
-} complex_t;
+   /** Bin number */
+   fftIndex_t bin;
+   /** Twiddle factors read along the path of the bin, in order of use */
+   const twiddle_t *table;
+} fftTwiddlePath_t;
+
+// Include the per-bin tables created by wgen.py
+#include "twiddlePath.c"
+#endif
 
-/** Holds data and statefull fft information */
-typedef struct
+#if FFT_FIXED_POINT
+/**
+ * Convert a sample (or sum of samples) into the accumulator format
+ *
+ * @param s Sample to convert
+ * @return The sample with the guard bits added
+ */
+static inline fftReal_t fftFromSample( int16_t s )
+   { return (fftReal_t)s << FFT_GUARD_BITS; }
+
+/**
+ * Multiply an accumulator by a Q15 twiddle factor part.
+ * The multiplication is split into two 16x16 bits multiplications
+ *  to avoid a 64 bits product, and the result is rounded.
+ *
+ * @param a Accumulator value
+ * @param w Twiddle factor part in Q15
+ * @return a*w in the accumulator format
+ */
+static inline fftReal_t fftMul( fftReal_t a, int16_t w )
 {
-   /**
-    *  Store the incomming data and computed data in a separate
-    *  buffer, since the raw data is 2 bytes long and requires N
-    *  data, and the computed data is complex with 8 bytes and
-    *  requires N/2, we save 8*N/2 - 2*N = 2N bytes. This is more
-    *  efficient than declaring a N long complex buffer, but less
-    *  efficient than overlapping both buffers somehow, which
-    *  becomes very tricky to manage.
-    *  A 64 point fft requires a 8*32 + 2*64 + 6 = 390 bytes buffer.
-    */
-   sample_t  s[FFT_N];
-
-   /** Complex buffer for computed results */
-   complex_t x[FFT_H];
-
-   /**
-    * Holds which butterfly computation to make for each pass
-    * Each bit tells whether to compute a simple butterfly (0) or
-    *  a 'twiddled' butterfly '1'.
-    */
-   index_t   bin;
-
-   /** Overall index. Increments with each new sample */
-   index_t   i;
-
-   /** Holds the size of the group. Halves every pass */
-   index_t   gSize;
-
-   /** Holds the increment step to get the correct twiddle factor */
-   index_t   wInc;
-
-   /** Holds the current twiddle factor index */
-   index_t   wIndex;
-
-   /** Group count. Defines the space between samples */
-   index_t   gCount;
-
-   /**
-    * Stores the final result of the fft for use by the application.
-    * This result is normalised to the PSD of the measurement
-    */
-   float  result;
-} fft_t;
+   int32_t hi = (int32_t)(int16_t)(a >> 16) * w;
+   int32_t lo = (int32_t)(uint16_t)a * w;
+
+   return hi * 2 + ((lo + 0x4000) >> 15);
+}
+#else
+/** Convert a sample (or sum of samples) into a float */
+static inline fftReal_t fftFromSample( int16_t s )
+   { return (fftReal_t)s; }
 
+/** Multiply by a twiddle factor part */
+static inline fftReal_t fftMul( fftReal_t a, float w )
+   { return a * w; }
+#endif
 
-// Include the twiddle coeffs locally.
-// This will make the data local and the code much more compact
-#include "twiddle.c"
+/**
+ * Round a part of a bin to the magnitude in sample units, with
+ *  FFT_RESULT_FRACTION_BITS fractional bits
+ *
+ * @param ctx Context of the fft
+ * @param v   Part of a bin
+ * @return The scaled part, on 16 bits
+ */
+static inline int16_t fftToResult( const fft_t *ctx, fftReal_t v )
+{
+#if FFT_FIXED_POINT
+   uint8_t shift = FFT_RESULT_SHIFT(ctx);
+
+   return (int16_t)((v + (1L << (shift - 1))) >> shift);
+#else
+   v *= FFT_RESULT_SCALE(ctx);
+
+   return (int16_t)(v < 0 ? v - 0.5 : v + 0.5);
+#endif
+}
 
-/** The one static fft structure */
-static fft_t fft;
 
 /**
  * Forward declaration of internal methods
  */
-static void fftNewCycle(void);
+static void fftNewCycle(fft_t *ctx, fftProgress_t *p);
 
 /**
- * Prepares the fft.
- * This method computes which butterflies to compute during each pass to ready
- *  the desired bin.
+ * Copy a twiddle factor from the full table in flash.
+ * The table holds the first half of the turn. The compact layout also
+ *  reads factors from the second half, which are the opposite.
+ *
+ * @param k Index of the factor over a whole turn
+ * @param w Where to copy the twiddle factor
+ */
+static inline void fftCopyTwiddle(fftIndex_t k, twiddle_t *w)
+{
+   memcpy_P( w, &fftTwiddle[k & (FFT_H - 1)], sizeof(twiddle_t) );
+
+#if FFT_COMPACT
+   if ( k & FFT_H )
+   {
+      w->real = -w->real;
+      w->imag = -w->imag;
+   }
+#endif
+}
+
+#if FFT_TWIDDLE_CACHE
+/**
+ * Copy the twiddle factors read along the paths of the bins into the
+ *  cache, in the order of use, so the butterflies read them in sequence
+ *  from RAM. The full table in flash is used if the cache is too small.
+ *
+ * @param ctx Context of the fft
+ */
+static void fftCacheTwiddles(fft_t *ctx)
+{
+   fftIndex_t paths = 0;
+   fftIndex_t gSize, j, n = 0;
+   fftIndex_t h = FFT_CTX_H(ctx);
+   fftIndex_t stride = FFT_CTX_STRIDE(ctx);
+   uint8_t shift = 0;
+   uint8_t b;
+#if FFT_COMPACT
+   fftIndex_t common = FFT_CTX_N(ctx) - 1;
+#endif
+
+   ctx->wPath = NULL;
+
+   // A pass reads the factors if any bin takes the 'twiddled' branch
+   for ( b=0; b<ctx->bins; ++b )
+   {
+      paths |= ctx->bin[b];
+#if FFT_COMPACT
+      common &= ctx->bin[b];
+#endif
+   }
+
+#if FFT_COMPACT
+   {
+      // Each butterfly of the second pass reads the factor of the sum if
+      //  the first pass is 'twiddled', then the factor of the difference
+      bool sum = (paths & h) && (common & (h/2)) == 0;
+      bool diff = (paths & (h/2)) != 0;
+      fftIndex_t step = (paths & h) ? 3 : 2;
+
+      if ( (sum + diff) * (h/2) > FFT_TWIDDLE_CACHE )
+      {
+         return;
+      }
+
+      for ( j=0; j<h/2; ++j )
+      {
+         if ( sum )
+         {
+            fftCopyTwiddle( j * stride, &ctx->w[n++] );
+         }
+
+         if ( diff )
+         {
+            fftCopyTwiddle( step * j * stride, &ctx->w[n++] );
+         }
+      }
+
+      // The standard order resumes with the third pass
+      gSize = h/4;
+      shift = 2;
+   }
+#else
+   gSize = h;
+#endif
+
+   for ( ; gSize != 0; gSize >>= 1, ++shift )
+   {
+      if ( paths & gSize )
+      {
+         if ( n + gSize > FFT_TWIDDLE_CACHE )
+         {
+            return;
+         }
+
+         for ( j=0; j<gSize; ++j )
+         {
+            fftCopyTwiddle( (j << shift) * stride, &ctx->w[n++] );
+         }
+      }
+   }
+
+   ctx->wPath = ctx->w;
+}
+#elif FFT_TWIDDLE_PATH
+/**
+ * Look for the table of the twiddle factors read along the path of the bin
+ *  in twiddlePath.c. The tables only exist for a single bin, and for a
+ *  window of FFT_N points. The full table is used for the bins without a
+ *  table.
+ *
+ * @param ctx Context of the fft
+ */
+static void fftFindTwiddlePath(fft_t *ctx)
+{
+   fftTwiddlePath_t path;
+   fftIndex_t binNumber = 0;
+   uint8_t i;
+
+   ctx->wPath = NULL;
+
+   if ( ctx->bins != 1 || FFT_CTX_M(ctx) != FFT_M )
+   {
+      return;
+   }
+
+   // The bin number is the path in reverse order
+   for ( i=0; i<FFT_M; ++i )
+   {
+      binNumber <<= 1;
+      binNumber |= (ctx->bin[0] >> i) & 1;
+   }
+
+   for ( i=0; i<sizeof(fftTwiddlePaths)/sizeof(fftTwiddlePaths[0]); ++i )
+   {
+      memcpy_P( &path, &fftTwiddlePaths[i], sizeof(path) );
+
+      if ( path.bin == binNumber )
+      {
+         ctx->wPath = path.table;
+         break;
+      }
+   }
+}
+#endif
+
+/**
+ * Read the next twiddle factor of a fft. The factors of the path are read
+ *  in sequence if available, otherwise from the full table in flash.
+ *
+ * @param ctx Context of the fft
+ * @param p   Progress of the fft
+ * @param k   Index of the factor in the full table
+ * @param w   Where to copy the twiddle factor
  */
-void fftInit(uint16_t centerFrequency)
+static inline void fftReadTwiddle(
+   fft_t *ctx, fftProgress_t *p, fftIndex_t k, twiddle_t *w)
 {
-   uint8_t binNumber;
-   index_t i;
+#if FFT_TWIDDLE_CACHE || FFT_TWIDDLE_PATH
+   if ( ctx->wPath != NULL )
+   {
+#  if FFT_TWIDDLE_CACHE
+      *w = ctx->wPath[p->wNext++];
+#  else
+      memcpy_P( w, &ctx->wPath[p->wNext++], sizeof(twiddle_t) );
+#  endif
+      return;
+   }
+#endif
 
-   // Center frequency to measure. Given in Hz
-   binNumber = centerFrequency;
+   fftCopyTwiddle( k, w );
+}
 
-   binNumber /= FFT_BIN_SIZE;
+/**
+ * Prepares an fft context.
+ * This method computes which butterflies to compute during each pass to ready
+ *  the desired bins.
+ * All bins must have the same parity as the first one to be computed in
+ *  the same pass. The ones which do not, and the ones beyond FFT_MAX_BINS,
+ *  are ignored. The results of the bins kept keep the order of the list.
+ * A size of window out of the range FFT_MIN_M to FFT_M is brought back
+ *  within the range.
+ *
+ * @param ctx               Context of the fft
+ * @param m                 Size of the window in 2^m points
+ * @param centerFrequencies List of the frequencies to measure in Hz
+ * @param count             Number of frequencies in the list
+ * @return true if the window has the size given, and all frequencies
+ *          are measured
+ */
+bool fftInit(fft_t *ctx, uint8_t m,
+             const uint16_t *centerFrequencies, uint8_t count)
+{
+   uint16_t binNumber;
+   fftIndex_t path;
+   uint8_t n;
+   fftIndex_t i;
+   bool retval = (m >= FFT_MIN_M && m <= FFT_M);
+
+#if FFT_MIN_M < FFT_M
+   // Work out the size of the window and the stride in the twiddle table
+   ctx->m = m < FFT_MIN_M ? FFT_MIN_M : m > FFT_M ? FFT_M : m;
+   ctx->n = (fftIndex_t)1 << ctx->m;
+   ctx->stride = FFT_N >> ctx->m;
+#endif
 
-   // Compute path the bin
-   fft.bin = 0;
-   for (i=0; i<FFT_M; ++i)
+   ctx->bins = 0;
+
+   for ( n=0; n<count && ctx->bins<FFT_MAX_BINS; ++n )
    {
-      fft.bin <<= 1;
-      fft.bin |= (binNumber&1);
-      binNumber >>= 1;
+      // Center frequency to measure. Given in Hz. Computed from the size
+      //  of the window, since the width of a bin is not always a whole Hz
+      binNumber = ((uint32_t)centerFrequencies[n] << FFT_CTX_M(ctx))
+         / ADC_SAMPLE_FREQUENCY;
+
+      // Compute path the bin
+      path = 0;
+      for (i=0; i<FFT_CTX_M(ctx); ++i)
+      {
+         path <<= 1;
+         path |= (binNumber&1);
+         binNumber >>= 1;
+      }
+
+      // The first pass has the same branch for all bins
+      if ( ctx->bins == 0 || ((path ^ ctx->bin[0]) & FFT_CTX_H(ctx)) == 0 )
+      {
+         ctx->bin[ctx->bins++] = path;
+      }
    }
 
-   fftReset();
+#if FFT_TWIDDLE_CACHE
+   fftCacheTwiddles(ctx);
+#elif FFT_TWIDDLE_PATH
+   fftFindTwiddlePath(ctx);
+#endif
+
+   fftReset(ctx);
+
+   return retval && ctx->bins == count;
 }
 
 
 /**
  * Restart the FFT measurement discaring any previous measurements.
  * Requires that fftInit has been called. Called by fftInit.
+ *
+ * @param ctx Context of the fft
  */
-void fftReset(void)
+void fftReset(fft_t *ctx)
 {
+   fftIndex_t n;
+
    // Set wInc to zero to indicate that no real samples are stored yet
-   fft.wInc = 0;
+   for ( n=0; n<FFT_PIPELINES; ++n )
+   {
+      ctx->p[n].wInc = 0;
+   }
 
    // Use the index to store a whole buffer full of actual values
-   fft.i = 0;
+   ctx->i = 0;
 }
 
 
 /**
  * Starts a new FFT cycle.
  * Internal method which zeros all counters
+ *
+ * @param ctx Context of the fft
+ * @param p   Progress of the fft to restart
  */
-void fftNewCycle(void)
+void fftNewCycle(fft_t *ctx, fftProgress_t *p)
 {
-   fft.i      = 0;
-   fft.wIndex = 0;
-   fft.gCount = 0;
-   fft.wInc   = 1;
-   fft.gSize  = FFT_H;
+   uint8_t b;
+
+   p->i      = 0;
+   p->wIndex = 0;
+   p->gCount = 0;
+   p->wInc   = FFT_CTX_STRIDE(ctx);
+   p->gSize  = FFT_CTX_H(ctx);
+
+   // The first pass fills the whole complex buffer from the samples
+   for ( b=0; b<ctx->bins; ++b )
+   {
+      p->base[b] = 0;
+   }
+
+   p->jobs = 1;
+   p->job[0].base = 0;
+   p->job[0].outputs = (ctx->bin[0] & FFT_CTX_H(ctx)) ? FFT_DIFF : FFT_SUM;
+   p->outputs = p->job[0].outputs;
+
+#if FFT_TWIDDLE_CACHE || FFT_TWIDDLE_PATH
+   p->wNext = 0;
+#endif
 }
 
 
 /**
- * Return the last computed result
+ * Works out the regions of the complex buffer to compute during the
+ *  current pass, that is one per path taken by the bins so far, and where
+ *  each bin will lie once the pass is done.
+ * Internal method called as a pass starts, except for the first one.
  *
- * @return The last computed result
+ * @param ctx Context of the fft
+ * @param p   Progress of the fft
  */
-float fftGetResult(void)
+static void fftPlanPass(fft_t *ctx, fftProgress_t *p)
 {
-   return fft.result;
+   uint8_t jobOf[FFT_MAX_BINS];
+   uint8_t b, j;
+
+   p->jobs = 0;
+   p->outputs = 0;
+
+   // Bins which have followed the same path so far share their region
+   for ( b=0; b<ctx->bins; ++b )
+   {
+      for ( j=0; j<p->jobs && p->job[j].base != p->base[b]; ++j )
+         ;
+
+      if ( j == p->jobs )
+      {
+         p->job[j].base = p->base[b];
+         p->job[j].outputs = 0;
+         ++p->jobs;
+      }
+
+      p->job[j].outputs |= (ctx->bin[b] & p->gSize) ? FFT_DIFF : FFT_SUM;
+      p->outputs |= p->job[j].outputs;
+      jobOf[b] = j;
+   }
+
+   // A lone output and the difference go in the upper half of the region.
+   // The sum stays in the lower half when both are kept
+   for ( b=0; b<ctx->bins; ++b )
+   {
+#if FFT_COMPACT
+      // The second pass writes a lone output from the start of the buffer
+      if ( p->gSize == FFT_CTX_H(ctx)/2 &&
+           p->job[jobOf[b]].outputs != (FFT_SUM | FFT_DIFF) )
+      {
+         continue;
+      }
+#endif
+
+      if ( (ctx->bin[b] & p->gSize) ||
+           p->job[jobOf[b]].outputs != (FFT_SUM | FFT_DIFF) )
+      {
+         p->base[b] += p->gSize;
+      }
+   }
 }
 
+
 /**
- * Pass in the next sample value to progress with computing the FFT
+ * Return the last computed result of a bin
  *
- * @param sample A signed 16-bit sample value - already decimated and
- *                normalized.
- * @return true if the computation has produced a result, 1 if a result
- *         is ready to collect
+ * @param ctx   Context of the fft
+ * @param index Position of the bin in the list given to fftInit
+ * @return The last computed result, that is the square of the magnitude
+ *          with 2*FFT_RESULT_FRACTION_BITS fractional bits, or the
+ *          magnitude estimate with FFT_MAGNITUDE
  */
-bool fftNext( int16_t sample )
+uint32_t fftGetResult(const fft_t *ctx, uint8_t index)
 {
-   bool retval=false;
+   return fftResultOf( ctx->result[index].real, ctx->result[index].imag );
+}
+
+
+/**
+ * Return the last computed value of a bin
+ *
+ * @param ctx   Context of the fft
+ * @param index Position of the bin in the list given to fftInit
+ * @return The bin, with its phase relative to the first sample of the window
+ */
+fftResult_t fftGetComplexResult(const fft_t *ctx, uint8_t index)
+{
+   return ctx->result[index];
+}
+
 
-   if ( fft.wInc > 0 )
+#if FFT_COMPACT
+/**
+ * Compute the next butterfly of the second pass of the compact layout,
+ *  which reads the raw output of the first pass from the sample slots.
+ * The 'twiddled' first pass gives d.W^j and e.W^(j+N/4) = ie.W^j, so the
+ *  sum is (d + ie).W^j and the 'twiddled' difference (d - ie).W^3j.
+ *  The index of the second pass is 2j, so those are found from it.
+ * A lone output is written from the start of the complex buffer. The
+ *  difference goes in the upper half when both outputs are kept.
+ *
+ * @param ctx Context of the fft
+ * @param p   Progress of the fft
+ */
+static void fftCompactStep( fft_t *ctx, fftProgress_t *p )
+{
+   fftIndex_t h = FFT_CTX_H(ctx);
+   fftReal_t d = fftFromSample( ctx->s[h + p->gCount] );
+   fftReal_t e = fftFromSample( ctx->s[h + h/2 + p->gCount] );
+   fftComplex_t *lo = &ctx->x[p->gCount];
+   fftComplex_t *hi = lo;
+   twiddle_t w;
+
+   if ( p->outputs == (FFT_SUM | FFT_DIFF) )
    {
-      // Compute next value in-place
-      if ( fft.i != (FFT_N - 1) )
+      hi += h/2;
+   }
+
+   if ( ctx->bin[0] & h )
+   {
+      if ( p->outputs & FFT_SUM )
       {
-         // Compute next butterfly and storage location
-         index_t ii = fft.i + fft.gSize;
-         index_t jj = ii - FFT_H;
+         fftReadTwiddle( ctx, p, p->wIndex >> 1, &w );
+         lo->real = fftMul( d, w.real ) - fftMul( e, w.imag );
+         lo->imag = fftMul( d, w.imag ) + fftMul( e, w.real );
+      }
 
+      if ( p->outputs & FFT_DIFF )
+      {
+         fftReadTwiddle( ctx, p, p->wIndex + (p->wIndex >> 1), &w );
+         hi->real = fftMul( d, w.real ) + fftMul( e, w.imag );
+         hi->imag = fftMul( d, w.imag ) - fftMul( e, w.real );
+      }
+   }
+   else // The first pass is real
+   {
+      if ( p->outputs & FFT_DIFF )
+      {
+         fftReadTwiddle( ctx, p, p->wIndex, &w );
+         hi->real = fftMul( d - e, w.real );
+         hi->imag = fftMul( d - e, w.imag );
+      }
 
-         if ( fft.bin & fft.gSize ) // Binary AND here
-         {
-            complex_t w;
+      if ( p->outputs & FFT_SUM )
+      {
+         lo->real = d + e;
+         lo->imag = 0;
+      }
+   }
+}
+#endif
 
-            // Copy the correct twiddle factor in w
-            memcpy_P( &w, &fftTwiddle[fft.wIndex], sizeof(complex_t) );
 
-            if ( fft.i < FFT_H ) // Reading values from the real buffer
-            {
-               fft.x[jj].real =
-                  ((float)fft.s[fft.i]) * w.real -
-                  ((float)fft.s[ii]) * w.imag;
+/**
+ * Compute the next butterfly of a fft, or its result once all butterflies
+ *  are done.
+ * The samples of the window are read from the sample store starting at
+ *  the given offset. The complex buffer is used the same way by all ffts.
+ *
+ * @param ctx    Context of the fft
+ * @param p      Progress of the fft
+ * @param offset Index in the sample store of the first sample of the window
+ * @return true if the fft has produced a result
+ */
+static bool fftStep( fft_t *ctx, fftProgress_t *p, fftIndex_t offset )
+{
+   bool retval=false;
+   fftIndex_t h = FFT_CTX_H(ctx);
 
-               fft.x[jj].imag = 0.0;
-            }
-            else  // Reading from the complex in place buffer
-            {
-               index_t k = fft.i-FFT_H;
-               float temp=fft.x[jj].real;
+   // Compute next value in-place
+   if ( p->i != (FFT_CTX_N(ctx) - 1) )
+   {
+      twiddle_t w;
+      uint8_t j;
 
-               fft.x[jj].real =
-                  w.real * ( fft.x[k].real - fft.x[jj].real ) -
-                  w.imag * ( fft.x[k].imag - fft.x[jj].imag );
+      if ( p->i < h ) // Reading values from the real buffer
+      {
+         // A single region in the first pass, filled from the lower half
+         fftSample_t a = ctx->s[(p->i + offset) & (FFT_CTX_N(ctx) - 1)];
+         fftSample_t b = ctx->s[(p->i + h + offset) & (FFT_CTX_N(ctx) - 1)];
+#if FFT_COMPACT
+         // Keep the raw result in the slot of b, which is not read again.
+         //  The factor is applied by the second pass
+         ctx->s[p->i + h] = (p->outputs & FFT_DIFF) ? a - b : a + b;
+#else
+         fftComplex_t *y = &ctx->x[p->i];
 
-               fft.x[jj].imag =
-                  w.real * ( fft.x[k].imag - fft.x[jj].imag ) +
-                  w.imag * ( fft.x[k].real - temp );
-            }
+         if ( p->outputs & FFT_DIFF )
+         {
+            // The difference is real, so the result is simply scaled
+            fftReal_t d = fftFromSample( a - b );
+
+            fftReadTwiddle( ctx, p, p->wIndex, &w );
+            y->real = fftMul( d, w.real );
+            y->imag = fftMul( d, w.imag );
          }
          else // Simple butterfly
          {
-            if ( fft.i < FFT_H ) // Reading values from the real buffer
-            {
-               // Since the sample are 12bits long, sum as int, then convert
-               fft.x[jj].real = (float)( fft.s[fft.i] + fft.s[ii] );
+            // Since the sample are 12bits long, sum as int, then convert
+            y->real = fftFromSample( a + b );
+            y->imag = 0;
+         }
+#endif
+      }
+#if FFT_COMPACT
+      else if ( p->gSize == h/2 ) // Reading the first pass from the samples
+      {
+         fftCompactStep( ctx, p );
+      }
+#endif
+      else  // Reading from the complex in place buffer
+      {
+         // All 'twiddled' butterflies of a step use the same twiddle factor
+         if ( p->outputs & FFT_DIFF )
+         {
+            fftReadTwiddle( ctx, p, p->wIndex, &w );
+         }
+
+         for ( j=0; j<p->jobs; ++j )
+         {
+            fftComplex_t *lo = &ctx->x[p->job[j].base + p->gCount];
+            fftComplex_t *hi = lo + p->gSize;
 
-               fft.x[jj].imag = 0.0;
+            if ( p->job[j].outputs & FFT_DIFF )
+            {
+               fftReal_t dr = lo->real - hi->real;
+               fftReal_t di = lo->imag - hi->imag;
+
+               // Both outputs are kept where the paths split
+               if ( p->job[j].outputs & FFT_SUM )
+               {
+                  lo->real += hi->real;
+                  lo->imag += hi->imag;
+               }
+
+               hi->real = fftMul( dr, w.real ) - fftMul( di, w.imag );
+               hi->imag = fftMul( di, w.real ) + fftMul( dr, w.imag );
             }
-            else
+            else // Simple butterfly
             {
-               index_t k = fft.i-FFT_H;
-               fft.x[jj].real += fft.x[k].real;
-               fft.x[jj].imag += fft.x[k].imag;
+               hi->real += lo->real;
+               hi->imag += lo->imag;
             }
          }
+      }
+
+      // Move on
+      ++p->i;
+      ++p->gCount;
+      p->wIndex += p->wInc;
 
-         // Store the new incomming value
-         fft.s[fft.i] = sample;
+      // Are we still computing within the same group
+      if ( p->gCount == p->gSize )
+      {
+         // Double-up the group size
+         p->gSize >>= 1;
+         p->gCount = 0;
 
-         // Move on
-         ++fft.i;
-         ++fft.gCount;
-         fft.wIndex += fft.wInc;
+         // Next pass
+         p->wIndex = 0;
+         p->wInc <<= 1;
 
-         // Are we still computing within the same group
-         if ( fft.gCount == fft.gSize )
+         if ( p->gSize != 0 )
          {
-            // Double-up the group size
-            fft.gSize >>= 1;
-            fft.gCount = 0;
-
-            // Next pass
-            fft.wIndex = 0;
-            fft.wInc <<= 1;
+            fftPlanPass( ctx, p );
          }
       }
-      else // Last sample is different. No butterfly, but PSD calculation
+   }
+   else // Last sample is different. No butterfly, but PSD calculation
+   {
+      uint8_t b;
+
+      // Last pass simply needs to return the result
+      // Scale each bin. The magnitude is worked out as it is read
+      for ( b=0; b<ctx->bins; ++b )
       {
-         // Store the new incomming value
-         fft.s[fft.i] = sample;
+         fftComplex_t *y = &ctx->x[p->base[b]];
+
+         ctx->result[b].real = fftToResult( ctx, y->real );
+         ctx->result[b].imag = fftToResult( ctx, y->imag );
+      }
 
-         // Last pass simply needs to return the result
-         // Compute the power
-         fft.result = sqrt(
-            square(fft.x[FFT_H - 1].real) +
-            square(fft.x[FFT_H - 1].imag) );
+      // Start again
+      fftNewCycle(ctx, p);
+
+      // Tell the caller the result is ready
+      retval = true;
+   }
+
+   return retval;
+}
 
-         fft.result /= FFT_H;
 
-         // Start again
-         fftNewCycle();
+/**
+ * Pass in the next sample value to progress with computing the FFT
+ * With FFT_OVERLAP, both ffts make a step, so a call computes at most
+ *  two butterflies, or one butterfly and a result.
+ *
+ * @param ctx    Context of the fft
+ * @param sample A signed 16-bit sample value - already decimated and
+ *                normalized.
+ * @return true if the computation has produced a result, 1 if a result
+ *         is ready to collect
+ */
+bool fftNext( fft_t *ctx, int16_t sample )
+{
+   bool retval=false;
+
+   if ( ctx->p[0].wInc > 0 )
+   {
+#if FFT_OVERLAP
+      fftIndex_t h = FFT_CTX_H(ctx);
 
-         // Tell the caller the result is ready
-         retval = true;
+      // The fft in its first pass writes the complex buffer where the
+      //  other fft has just read, so the other fft must go first.
+      if ( ctx->p[0].i >= h )
+      {
+         retval = fftStep( ctx, &ctx->p[0], 0 );
+
+         if ( ctx->p[1].wInc > 0 )
+         {
+            retval |= fftStep( ctx, &ctx->p[1], h );
+         }
+      }
+      else
+      {
+         if ( ctx->p[1].wInc > 0 )
+         {
+            retval = fftStep( ctx, &ctx->p[1], h );
+         }
+
+         retval |= fftStep( ctx, &ctx->p[0], 0 );
+      }
+
+      // The second fft starts half a window after the first one
+      if ( ctx->p[1].wInc == 0 && ctx->p[0].i == h )
+      {
+         fftNewCycle( ctx, &ctx->p[1] );
       }
+#else
+      retval = fftStep( ctx, &ctx->p[0], 0 );
+#endif
+
+      // Store the new incomming value once all ffts have read the old one
+      ctx->s[ctx->i] = sample;
+      ctx->i = (ctx->i + 1) & (FFT_CTX_N(ctx) - 1);
    }
    else // wInc == 0
    {
       // When wInc is 0, simply store a first pass of values
-      fft.s[fft.i] = sample;
+      ctx->s[ctx->i] = sample;
 
       // Move on
-      ++fft.i;
+      ++ctx->i;
 
       // If all sample have been stored, turn on continuous mode
-      if ( fft.i == FFT_N )
+      if ( ctx->i == FFT_CTX_N(ctx) )
       {
-         fftNewCycle();
+         ctx->i = 0;
+         fftNewCycle( ctx, &ctx->p[0] );
       }
    }
 
    return retval;
 }
 
+#endif // ! FFT_SLIDING_DFT
+
 
 /* ----------------------------  End of file  ---------------------------- */
 
@@ -5,16 +5,41 @@
  *@{
  *@file
  *****************************************************************************
- * This FFT calculates the PSD of a single frequency in the spectrum.
+ * This FFT calculates the PSD of a few frequencies in the spectrum.
  * Unlike standard algorithm, this FFT is computed progressively, 1 sample
  *  at a time.
- * This API must first be initialised with fftInit providing which
- *  frequency to measure.
+ * The caller owns an fft_t context for each signal to analyse, and passes
+ *  it to every call, so several signals can be analysed at once. The
+ *  context holds the sample and complex buffers, sized at compile time by
+ *  FFT_M and FFT_MAX_BINS; the twiddle factors are shared in flash.
+ * Each context must first be initialised with fftInit providing the size
+ *  of the window and which frequencies to measure, up to FFT_MAX_BINS.
+ *  The window has 2^FFT_M points, unless FFT_MIN_M is set lower in the
+ *  config file, in which case any size from 2^FFT_MIN_M to 2^FFT_M points
+ *  can be selected at run time. The buffers are always sized for FFT_M,
+ *  and the twiddle factors of a smaller window are read from the table of
+ *  FFT_N points with a stride. The progressive fft
+ *  requires all the bins to have the same parity, like the odd harmonics
+ *  of the fundamental.
  * Each new sample should be evaluated with fftNext which returns true
  *  as soon as an actual fft measurement is ready. The results can then be
- *  retreived by calling fftGetResult.
- * The result is presented as a raw float of the computed PSD and must be
- *  adjusted accoringly.
+ *  retreived for each frequency by calling fftGetResult. fftGetComplexResult
+ *  gives the bin itself, with its phase relative to the first sample of the
+ *  window, from which the frequency can be tracked (see freq.c).
+ * The result is presented as the square of the magnitude of the bin, in
+ *  sample units with FFT_RESULT_FRACTION_BITS fractional bits, and must be
+ *  adjusted accoringly. Keeping the square saves a square root per result:
+ *  thresholds can be squared once instead, and harmonics add up directly.
+ *  Setting FFT_MAGNITUDE to an estimator rather reports the magnitude
+ *  itself, estimated without any multiplication (see fftMagnitude).
+ * Setting FFT_SLIDING_DFT to 1 in the config file replaces the progressive
+ *  fft by a sliding DFT (see sdft.c) offering the same API. The sliding DFT
+ *  has a result ready with every new sample.
+ * Setting FFT_OVERLAP to 1 runs two progressive ffts staggered by half a
+ *  window, for a result every FFT_H samples.
+ * Setting FFT_COMPACT to 1 keeps the output of the first pass in the
+ *  sample slots it has consumed, which saves 2*FFT_N bytes of RAM for a
+ *  single bin.
  *
  * @author software@arreckx.com
  *****************************************************************************
@@ -22,10 +47,459 @@
 
 #include "wgx.h"
 
-void  fftInit(uint16_t centerFrequency);
-void  fftReset(void);
-bool  fftNext(int16_t sample);
-float fftGetResult(void);
+// Check all constants required. These should be defined in the config.h file
+#ifndef FFT_M
+   #error "FFT_M must be defined in config.h"
+#endif
+
+#ifndef ADC_SAMPLE_FREQUENCY
+   #error "ADC_SAMPLE_FREQUENCY must be defined in config.h"
+#endif
+
+#ifndef FFT_SLIDING_DFT
+   /** Use the progressive fft unless told otherwise */
+   #define FFT_SLIDING_DFT 0
+#endif
+
+#ifndef FFT_MAX_BINS
+   /** Measure a single frequency unless told otherwise */
+   #define FFT_MAX_BINS 1
+#endif
+
+#ifndef FFT_TWIDDLE_CACHE
+   /** Read the twiddle factors from the full table in flash by default */
+   #define FFT_TWIDDLE_CACHE 0
+#endif
+
+#ifndef FFT_TWIDDLE_PATH
+   /** Do not use the per-bin tables of twiddlePath.c unless told otherwise */
+   #define FFT_TWIDDLE_PATH 0
+#endif
+
+/** The result is the exact square of the magnitude */
+#define FFT_MAGNITUDE_SQUARED 0
+
+/** The result is the magnitude, estimated as alpha max plus beta min */
+#define FFT_MAGNITUDE_ALPHA_MAX_BETA_MIN 1
+
+/** The result is the magnitude, estimated by a few CORDIC iterations */
+#define FFT_MAGNITUDE_CORDIC 2
+
+#ifndef FFT_MAGNITUDE
+   /** Report the square of the magnitude unless told otherwise */
+   #define FFT_MAGNITUDE FFT_MAGNITUDE_SQUARED
+#endif
+
+#ifndef FFT_OVERLAP
+   /** Run a single progressive fft unless told otherwise */
+   #define FFT_OVERLAP 0
+#endif
+
+#ifndef FFT_COMPACT
+   /** Keep the complex buffer separate from the samples unless told otherwise */
+   #define FFT_COMPACT 0
+#endif
+
+#ifndef FFT_MIN_M
+   /** The window always has 2^FFT_M points unless told otherwise */
+   #define FFT_MIN_M FFT_M
+#endif
+
+// The compact layout and the twiddle tables start with 8 points
+#if (FFT_MIN_M < 3) || (FFT_MIN_M > FFT_M)
+   #error "FFT_MIN_M must be between 3 and FFT_M"
+#endif
+
+/** Size of the largest FFT window in points. The buffers are sized for it */
+#define FFT_N (1 << FFT_M)
+
+/** Half the size of the largest FFT window */
+#define FFT_H (FFT_N/2)
+
+/** Width of a bin in Hz for a window of 2^m points */
+#define FFT_BIN_SIZE_OF(m) (ADC_SAMPLE_FREQUENCY >> (m))
+
+/** Width of a bin of the largest window in Hz */
+#define FFT_BIN_SIZE FFT_BIN_SIZE_OF(FFT_M)
+
+#ifndef FFT_RESULT_FRACTION_BITS
+   /**
+    * Number of fractional bits of the magnitude of the result. The result
+    *  is the square of the magnitude, so it is given in 1/2^(2*3) = 1/64th
+    *  of squared sample units. The square of a full scale 12-bit sample
+    *  magnified that way fits in 30 bits. The estimated magnitudes are
+    *  given in 1/8th of sample units. Each bit of the samples beyond 12
+    *  takes one fractional bit, so the parts of the bins fit in 16 bits.
+    */
+   #define FFT_RESULT_FRACTION_BITS 3
+#endif
+
+/** Number of CORDIC iterations of the magnitude estimate */
+#define FFT_CORDIC_ITERATIONS 5
+
+/** Number of results produced every second with a window of 2^m points */
+#if FFT_SLIDING_DFT
+   #define FFT_RESULT_FREQUENCY_OF(m) ADC_SAMPLE_FREQUENCY
+#elif FFT_OVERLAP
+   #define FFT_RESULT_FREQUENCY_OF(m) (ADC_SAMPLE_FREQUENCY >> ((m) - 1))
+#else
+   #define FFT_RESULT_FREQUENCY_OF(m) (ADC_SAMPLE_FREQUENCY >> (m))
+#endif
+
+/** Number of results produced every second with the largest window */
+#define FFT_RESULT_FREQUENCY FFT_RESULT_FREQUENCY_OF(FFT_M)
+
+#ifndef FFT_FIXED_POINT
+   /** Compute the butterflies in floating point unless told otherwise */
+   #define FFT_FIXED_POINT 0
+#endif
+
+/**
+ * Define a fast index type, enough for the size of fft we
+ *  are dealing with, but lean on memory
+ */
+#if (FFT_N > 128)
+typedef uint16_t fftIndex_t;
+#else
+typedef uint8_t fftIndex_t;
+#endif
+
+/** Define the type of raw data comming in */
+typedef int16_t fftSample_t;
+
+/**
+ * Complex value of a bin, in sample units with FFT_RESULT_FRACTION_BITS
+ *  fractional bits. The phase is relative to the first sample of the window.
+ */
+typedef struct
+{
+   /** Real part of the bin */
+   int16_t real;
+   /** Imaginary part of the bin */
+   int16_t imag;
+} fftResult_t;
+
+#if FFT_SLIDING_DFT
+/** Holds one bin of the sliding DFT */
+typedef struct
+{
+   /** Real part of the bin */
+   int32_t  real;
+
+   /** Imaginary part of the bin */
+   int32_t  imag;
+
+   /**
+    * Step of the twiddle factor index with each sample, that is the bin
+    *  number times the stride of the window in the table of FFT_N points
+    */
+   fftIndex_t k;
+
+   /** Index of the twiddle factor of the current sample over a whole turn */
+   fftIndex_t wIndex;
+} sdftBin_t;
+
+/** Holds data and statefull sliding DFT information */
+typedef struct
+{
+   /** Window of the last samples, used as a circular buffer */
+   fftSample_t s[FFT_N];
+
+   /** Bins to compute */
+   sdftBin_t bin[FFT_MAX_BINS];
+
+   /** Number of bins computed */
+   uint8_t  bins;
+
+   /** Position of the oldest sample in the window */
+   fftIndex_t i;
+
+   /** Number of samples stored since the reset, up to the window size */
+   fftIndex_t count;
+
+#if FFT_MIN_M < FFT_M
+   /** Size of the window in 2^n points, given to fftInit */
+   uint8_t   m;
+
+   /** Size of the window in points */
+   fftIndex_t n;
+#endif
+} fft_t;
+#else
+#if FFT_FIXED_POINT
+/** Define the type used for computations - a 32-bit accumulator */
+typedef int32_t fftReal_t;
+#else
+/** Define the type used for computations */
+typedef float fftReal_t;
+#endif
+
+/** Define the complex type */
+typedef struct
+{
+   /** Real part of the number */
+   fftReal_t real;
+   /** Imaginary part of the number */
+   fftReal_t imag;
+} fftComplex_t;
+
+#if FFT_FIXED_POINT
+/** Define the twiddle factor type. Each part is given in Q15 */
+typedef struct
+{
+   /** Real part of the number */
+   int16_t real;
+   /** Imaginary part of the number */
+   int16_t imag;
+} fftTwiddle_t;
+#else
+/** In floating point, the twiddle factors are plain complex numbers */
+typedef fftComplex_t fftTwiddle_t;
+#endif
+
+#if FFT_OVERLAP
+   /** Two ffts are run, staggered by half a window */
+   #define FFT_PIPELINES 2
+#else
+   /** A single fft is run */
+   #define FFT_PIPELINES 1
+#endif
+
+#if FFT_COMPACT && (FFT_MAX_BINS == 1)
+   /**
+    * The first pass is kept in the sample slots, and a single bin only
+    *  needs half the outputs of the second pass
+    */
+   #define FFT_COMPLEX_SIZE (FFT_H/2)
+#else
+   /** The complex buffer holds all the outputs of a pass */
+   #define FFT_COMPLEX_SIZE FFT_H
+#endif
+
+/** Region of the complex buffer to compute the butterflies of in a pass */
+typedef struct
+{
+   /** Index in the complex buffer of the first value of the region */
+   fftIndex_t base;
+
+   /** Which outputs of the butterflies to keep. FFT_SUM and/or FFT_DIFF */
+   uint8_t   outputs;
+} fftJob_t;
+
+/** Holds the progress of one fft through its passes */
+typedef struct
+{
+   /** Index of the next butterfly. Increments with each new sample */
+   fftIndex_t i;
+
+   /** Holds the size of the group. Halves every pass */
+   fftIndex_t gSize;
+
+   /**
+    * Holds the increment step to get the correct twiddle factor.
+    * Zero while the fft is waiting for its first window.
+    */
+   fftIndex_t wInc;
+
+   /** Holds the current twiddle factor index */
+   fftIndex_t wIndex;
+
+   /** Group count. Defines the space between samples */
+   fftIndex_t gCount;
+
+   /** Number of regions to compute during the current pass */
+   uint8_t   jobs;
+
+   /** Regions to compute during the current pass. One per path */
+   fftJob_t  job[FFT_MAX_BINS];
+
+   /** Where each bin lies in the complex buffer at the end of the pass */
+   fftIndex_t base[FFT_MAX_BINS];
+
+   /** All the outputs to keep during the current pass */
+   uint8_t   outputs;
+
+#if FFT_TWIDDLE_CACHE || FFT_TWIDDLE_PATH
+   /** Index of the next twiddle factor in the table of the path */
+   fftIndex_t wNext;
+#endif
+} fftProgress_t;
+
+/** Holds data and statefull fft information */
+typedef struct
+{
+   /**
+    *  Store the incomming data and computed data in a separate
+    *  buffer, since the raw data is 2 bytes long and requires N
+    *  data, and the computed data is complex with 8 bytes and
+    *  requires N/2, we save 8*N/2 - 2*N = 2N bytes. This is more
+    *  efficient than declaring a N long complex buffer, but less
+    *  efficient than overlapping both buffers somehow, which
+    *  becomes very tricky to manage.
+    *  A 64 point fft of a single bin requires a 8*32 + 2*64 + 16 = 400
+    *  bytes buffer. Each extra bin adds 8 bytes.
+    *  The overlapped ffts share both buffers, adding 9 bytes only.
+    *  With FFT_COMPACT, the first pass writes the sample slots it has just
+    *  read, so the complex buffer only starts with the second pass, and
+    *  the single bin requires 8*16 + 2*64 + 16 = 272 bytes.
+    */
+   fftSample_t s[FFT_N];
+
+   /** Complex buffer for computed results */
+   fftComplex_t x[FFT_COMPLEX_SIZE];
+
+   /**
+    * Holds which butterfly computation to make for each pass and bin.
+    * Each bit tells whether to compute a simple butterfly (0) or
+    *  a 'twiddled' butterfly '1'.
+    */
+   fftIndex_t bin[FFT_MAX_BINS];
+
+   /** Number of bins computed */
+   uint8_t   bins;
+
+   /** Overall index. Where the next sample is stored */
+   fftIndex_t i;
+
+   /** Progress of each fft. The second one, if any, lags by half a window */
+   fftProgress_t p[FFT_PIPELINES];
+
+#if FFT_MIN_M < FFT_M
+   /** Size of the window in 2^n points, given to fftInit */
+   uint8_t   m;
+
+   /** Size of the window in points */
+   fftIndex_t n;
+
+   /** Step between the factors of the window in the table of FFT_N points */
+   fftIndex_t stride;
+#endif
+
+#if FFT_TWIDDLE_CACHE
+   /** Twiddle factors read along the paths of the bins, in order of use */
+   fftTwiddle_t w[FFT_TWIDDLE_CACHE];
+#endif
+
+#if FFT_TWIDDLE_CACHE || FFT_TWIDDLE_PATH
+   /** Twiddle factors in order of use, or NULL to index the full table */
+   const fftTwiddle_t *wPath;
+#endif
+
+   /**
+    * Stores the final value of each bin for use by the application. The
+    *  magnitude is only worked out when the result is read
+    */
+   fftResult_t result[FFT_MAX_BINS];
+} fft_t;
+#endif
+
+#if FFT_MIN_M < FFT_M
+   /** Size of the window of a context in 2^n points */
+   #define FFT_CTX_M(ctx) ((ctx)->m)
+
+   /** Size of the window of a context in points */
+   #define FFT_CTX_N(ctx) ((ctx)->n)
+#else
+   /** The size of the window is a constant */
+   #define FFT_CTX_M(ctx) FFT_M
+
+   /** The size of the window is a constant */
+   #define FFT_CTX_N(ctx) FFT_N
+#endif
+
+/** Half the size of the window of a context */
+#define FFT_CTX_H(ctx) (FFT_CTX_N(ctx)/2)
+
+bool     fftInit(fft_t *ctx, uint8_t m,
+                 const uint16_t *centerFrequencies, uint8_t count);
+void     fftReset(fft_t *ctx);
+bool     fftNext(fft_t *ctx, int16_t sample);
+uint32_t fftGetResult(const fft_t *ctx, uint8_t index);
+fftResult_t fftGetComplexResult(const fft_t *ctx, uint8_t index);
+
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_ALPHA_MAX_BETA_MIN
+/**
+ * Estimate the magnitude of a complex number from its absolute parts as
+ *  max(hi, 7/8.hi + 1/2.lo), hi being the larger part and lo the smaller.
+ * The estimate is within -3.0% and +0.9% of the magnitude, give or take
+ *  the unit truncated by the shifts. It only takes shifts and adds, where
+ *  the exact square takes two 16x16 bits multiplications, which the
+ *  ATtiny861 computes in software.
+ *
+ * @param a Absolute value of one part
+ * @param b Absolute value of the other part
+ * @return The estimated magnitude
+ */
+static inline uint32_t fftMagnitude(uint16_t a, uint16_t b)
+{
+   uint16_t hi = a > b ? a : b;
+   uint16_t lo = a > b ? b : a;
+   uint32_t estimate = (uint32_t)hi - (hi >> 3) + (lo >> 1);
+
+   return estimate > hi ? estimate : hi;
+}
+#elif FFT_MAGNITUDE == FFT_MAGNITUDE_CORDIC
+/**
+ * Estimate the magnitude of a complex number from its absolute parts with
+ *  FFT_CORDIC_ITERATIONS iterations of the CORDIC vectoring mode, which
+ *  rotate the vector towards the real axis by +/-atan(2^-i).
+ * The angle left after 5 iterations is under atan(1/16), so the estimate
+ *  is within -0.25% and +0.05% of the magnitude, give or take a unit. The
+ *  gain of the iterations (1.6465) is compensated by shifts and adds. The
+ *  values carry 8 extra fractional bits so that the shifts lose no
+ *  precision.
+ *
+ * @param a Absolute value of one part
+ * @param b Absolute value of the other part
+ * @return The estimated magnitude
+ */
+static inline uint32_t fftMagnitude(uint16_t a, uint16_t b)
+{
+   int32_t x = (int32_t)a << 8;
+   int32_t y = (int32_t)b << 8;
+   int32_t dx;
+   uint8_t i;
+
+   for ( i=0; i<FFT_CORDIC_ITERATIONS; ++i )
+   {
+      dx = x >> i;
+
+      if ( y >= 0 )
+      {
+         x += y >> i;
+         y -= dx;
+      }
+      else
+      {
+         x -= y >> i;
+         y += dx;
+      }
+   }
+
+   // Multiply by 1/1.6465 = 0.60765 ~ 1/2 + 1/8 - 1/64 - 1/512 + 1/4096
+   x = (x >> 1) + (x >> 3) - (x >> 6) - (x >> 9) + (x >> 12);
+
+   return (uint32_t)(x + 128) >> 8;
+}
+#endif
+
+/**
+ * Compute the result of a bin from its parts, given in sample units with
+ *  FFT_RESULT_FRACTION_BITS fractional bits. Used by the implementations.
+ *
+ * @param re Real part
+ * @param im Imaginary part
+ * @return The squared magnitude, or the estimated magnitude
+ */
+static inline uint32_t fftResultOf(int16_t re, int16_t im)
+{
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   return (uint32_t)((int32_t)re * re) + (uint32_t)((int32_t)im * im);
+#else
+   return fftMagnitude(
+      (uint16_t)(re < 0 ? -re : re), (uint16_t)(im < 0 ? -im : im) );
+#endif
+}
 
 
 #endif   /* ndef __FFT_H_HAS_ALREADY_BEEN_INCLUDED__ */
@@ -0,0 +1,81 @@
+/**
+ *@ingroup lib
+ *@defgroup frame Binary Frame API
+ *@{
+ *@file
+ *****************************************************************************
+ * Frames a payload for the serial link, so the receiver can find the start
+ *  of each frame, and discard those corrupted.
+ * The CRC16 is the CCITT polynomial, reflected, from 0xFFFF and without
+ *  final xor (CRC-16/MCRF4XX), as computed by _crc_ccitt_update of the
+ *  avr-libc. It is appended to the payload, least significant byte first.
+ * The payload and its CRC are then stuffed with COBS, so the frame has no
+ *  0 but its delimiter: each 0 is replaced by the distance to the next 0,
+ *  the first one being given by a leading byte. A payload up to
+ *  FRAME_MAX_PAYLOAD only needs that one byte more.
+ * The frame is encoded in a single pass, the CRC being updated as the
+ *  payload is stuffed.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+#include "frame.h"
+
+
+/**
+ * Encode a payload into a frame
+ *
+ * @param frame   Buffer of FRAME_SIZE_OF(size) bytes receiving the frame
+ * @param payload Bytes to send
+ * @param size    Number of bytes of the payload, up to FRAME_MAX_PAYLOAD
+ * @return The size of the frame, delimiter included
+ */
+uint8_t frameEncode( uint8_t *frame, const uint8_t *payload, uint8_t size )
+{
+   uint16_t crc = 0xFFFF;
+
+   // Index of the byte giving the distance to the next 0
+   uint8_t code = 0;
+   uint8_t index = 1;
+   uint8_t n;
+
+   for ( n=0; n<size + 2; ++n )
+   {
+      uint8_t byte;
+
+      // The CRC follows the payload
+      if ( n < size )
+      {
+         byte = payload[n];
+         crc = _crc_ccitt_update( crc, byte );
+      }
+      else if ( n == size )
+      {
+         byte = (uint8_t)crc;
+      }
+      else
+      {
+         byte = (uint8_t)(crc >> 8);
+      }
+
+      if ( byte == 0 )
+      {
+         frame[code] = index - code;
+         code = index++;
+      }
+      else
+      {
+         frame[index++] = byte;
+      }
+   }
+
+   frame[code] = index - code;
+   frame[index++] = 0;
+
+   return index;
+}
+
+
+/* ----------------------------  End of file  ---------------------------- */
@@ -0,0 +1,41 @@
+#ifndef __FRAME_H__HAS_ALREADY_BEEN_INCLUDED__
+#define __FRAME_H__HAS_ALREADY_BEEN_INCLUDED__
+/**
+ *@ingroup frame
+ *@{
+ *@file
+ *****************************************************************************
+ * Defines the binary frame API.
+ *
+ * frameEncode appends the CRC16 to a payload, stuffs the bytes with COBS
+ *  and terminates the frame with a 0. The frame is then given to the uart
+ *  as is. The buffer of the frame must hold FRAME_SIZE_OF the payload.
+ * FRAME_RESULTS can be set in config.h to send the results in frames.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+
+#ifndef FRAME_RESULTS
+   /** The results are sent as text unless told otherwise */
+   #define FRAME_RESULTS 0
+#endif
+
+/**
+ * Largest payload. The payload and its CRC must fit a single block of
+ *  COBS, that is 254 bytes
+ */
+#define FRAME_MAX_PAYLOAD 252
+
+/**
+ * Size of the frame of a payload: the byte of COBS, the payload, its CRC
+ *  and the delimiter
+ */
+#define FRAME_SIZE_OF(size) ((size) + 4)
+
+uint8_t frameEncode(uint8_t *frame, const uint8_t *payload, uint8_t size);
+
+
+#endif   /* ndef __FRAME_H__HAS_ALREADY_BEEN_INCLUDED__ */
@@ -0,0 +1,300 @@
+/**
+ *@ingroup lib
+ *@defgroup freq Mains Frequency Tracking API
+ *@{
+ *@file
+ *****************************************************************************
+ * Measures the frequency of the mains from the phase of its bin in the fft,
+ *  and trims the sampling rate of the adc so the mains stays at the center
+ *  of the bin.
+ * The bins are 5Hz wide for a 64 point window, so a mains drifting by a
+ *  few Hz, like a site generator, leaks out of the bin and reads low.
+ * The phase of a bin, relative to the first sample of its window, turns by
+ *  f.T for a signal of frequency f, T being the time between the windows.
+ *  At the center of the bin k, f.T is k.count/N turns, count being the
+ *  number of samples between the windows, so the difference gives the
+ *  offset of the frequency from the center of the bin. The difference is
+ *  only known within half a turn, that is +/-fs/(2.count): the phase is
+ *  measured over half a window at least, that is +/-5Hz with the overlapped
+ *  ffts or the sliding DFT of 64 points, or +/-2.5Hz over whole windows.
+ * The angle between both bins is computed by a CORDIC in 1/65536th of a
+ *  turn, without any multiplication. The frequency is filtered by a first
+ *  order low pass, and the sampling rate set so that the bin of the fft
+ *  is centred on it, within FREQ_RANGE_SHIFT of ADC_SAMPLE_FREQUENCY. This
+ *  also moves the rate of all the other timings derived from the samples.
+ * The phase of a bin smaller than FREQ_MIN_AMPLITUDE is not measured, so
+ *  the frequency is held while there is no load.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+#include "freq.h"
+#include "adc.h"
+
+// Only built when the tracking is enabled
+#if FREQ_TRACKING
+
+/** Number of fractional bits of the frequency tracked */
+#define FREQ_FRACTION_BITS 4
+
+/** Sampling rate without any trim, in 1/100th of Hz */
+#define FREQ_NOMINAL_SAMPLE_FREQUENCY (ADC_SAMPLE_FREQUENCY * 100UL)
+
+/** Angles atan(2^-i) of the CORDIC iterations, in 1/65536th of a turn */
+static const uint16_t freqAtan[] PROGMEM = {
+   8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1
+};
+
+/** Bin of the frequency tracked in the window of the fft */
+static fftIndex_t binNumber;
+
+/** Size of the window of the fft in 2^m points */
+static uint8_t windowM;
+
+/** Number of samples between two results of the fft */
+static uint16_t resultStep;
+
+/** Bin the phase is measured from */
+static fftResult_t reference;
+
+/** true once the reference holds a bin large enough */
+static bool hasReference;
+
+/** Number of samples since the reference */
+static uint16_t count;
+
+/** Number of samples still to flush from the window after a change of rate */
+static uint16_t holdOff;
+
+/**
+ * Frequency tracked in 1/100th of Hz, with FREQ_FRACTION_BITS fractional
+ *  bits. 0 until measured
+ */
+static uint32_t tracked;
+
+
+/**
+ * Prepare to track a frequency
+ *
+ * @param frequency Frequency measured by the fft in Hz, given to fftInit
+ * @param m         Size of the window of the fft in 2^m points
+ */
+void freqInit(uint16_t frequency, uint8_t m)
+{
+   windowM = m;
+   binNumber = ((uint32_t)frequency << m) / ADC_SAMPLE_FREQUENCY;
+   resultStep = ADC_SAMPLE_FREQUENCY / FFT_RESULT_FREQUENCY_OF(m);
+   tracked = 0;
+
+   freqReset();
+}
+
+
+/**
+ * Forget the last bin, for when the results of the fft do not follow on
+ *  from each other, like after fftReset. The frequency tracked is kept.
+ */
+void freqReset(void)
+{
+   hasReference = false;
+   holdOff = 0;
+}
+
+
+/**
+ * Tell whether a bin is large enough for its phase to be measured
+ *
+ * @param bin Bin to check
+ * @return true if the magnitude is FREQ_MIN_AMPLITUDE at least
+ */
+static inline bool freqIsLarge(fftResult_t bin)
+{
+   static const uint32_t min =
+      (uint32_t)(FREQ_MIN_AMPLITUDE << FFT_RESULT_FRACTION_BITS) *
+      (FREQ_MIN_AMPLITUDE << FFT_RESULT_FRACTION_BITS);
+
+   return (uint32_t)((int32_t)bin.real * bin.real) +
+      (uint32_t)((int32_t)bin.imag * bin.imag) >= min;
+}
+
+
+/**
+ * Compute the angle of a vector by the CORDIC vectoring mode, which rotates
+ *  the vector towards the real axis by +/-atan(2^-i) and sums the angles.
+ * The vector is first brought in the right half plane where the iterations
+ *  converge, and scaled down to leave room for their gain (1.6468).
+ *
+ * @param x Real part
+ * @param y Imaginary part
+ * @return The angle in 1/65536th of a turn
+ */
+static uint16_t freqAngle(int32_t x, int32_t y)
+{
+   uint16_t angle = 0;
+   int32_t dx;
+   uint8_t i;
+
+   if ( x < 0 )
+   {
+      x = -x;
+      y = -y;
+      angle = 0x8000;
+   }
+
+   while ( x >= (1L << 29) || y >= (1L << 29) || y <= -(1L << 29) )
+   {
+      x >>= 1;
+      y >>= 1;
+   }
+
+   for ( i=0; i<sizeof(freqAtan)/sizeof(freqAtan[0]); ++i )
+   {
+      uint16_t a = pgm_read_word( &freqAtan[i] );
+
+      dx = x >> i;
+
+      if ( y > 0 )
+      {
+         x += y >> i;
+         y -= dx;
+         angle += a;
+      }
+      else
+      {
+         x -= y >> i;
+         y += dx;
+         angle -= a;
+      }
+   }
+
+   return angle;
+}
+
+
+/**
+ * Measure the frequency from a new result of the fft, and trim the
+ *  sampling rate of the adc to keep the frequency at the center of the bin.
+ *
+ * @param bin Bin of the frequency tracked, as given by fftGetComplexResult
+ * @return true if the frequency was measured
+ */
+bool freqNext(fftResult_t bin)
+{
+   uint16_t sampleFrequency;
+   int32_t measured;
+   int16_t offset;
+   int32_t x, y;
+
+   // The phase of a small bin is mostly noise. Start again from the next one
+   if ( binNumber == 0 || ! freqIsLarge(bin) )
+   {
+      hasReference = false;
+
+      return false;
+   }
+
+   // The window still holds samples taken at the previous rate
+   if ( holdOff != 0 )
+   {
+      holdOff = holdOff > resultStep ? holdOff - resultStep : 0;
+
+      if ( holdOff != 0 )
+      {
+         return false;
+      }
+   }
+
+   if ( ! hasReference )
+   {
+      reference = bin;
+      hasReference = true;
+      count = 0;
+
+      return false;
+   }
+
+   count += resultStep;
+
+   // Wait for half a window at least, so the phase turns enough to measure
+   if ( count < (1U << windowM) / 2 )
+   {
+      return false;
+   }
+
+   // The angle of reference.conj(bin) is how much the phase has turned.
+   //  The products are halved so the sums cannot overflow
+   x = ((int32_t)reference.real * bin.real >> 1) +
+       ((int32_t)reference.imag * bin.imag >> 1);
+   y = ((int32_t)reference.imag * bin.real >> 1) -
+       ((int32_t)reference.real * bin.imag >> 1);
+
+   // Offset from the turn at the center of the bin, k.count/N
+   offset = (int16_t)(freqAngle( x, y ) -
+      (uint16_t)(((uint32_t)binNumber * count) << (16 - windowM)));
+
+   // f = fs.(k/N + offset/(65536.count))
+   sampleFrequency = adcGetSampleFrequency();
+   measured = (((uint32_t)sampleFrequency * binNumber)
+         << FREQ_FRACTION_BITS >> windowM) +
+      ((int32_t)sampleFrequency * offset) /
+         ((int32_t)count << (16 - FREQ_FRACTION_BITS));
+
+   if ( tracked == 0 )
+   {
+      tracked = measured;
+   }
+   else
+   {
+      tracked += (measured - (int32_t)tracked) >> FREQ_FILTER_SHIFT;
+   }
+
+   // Centre the bin on the frequency tracked, that is fs = f.N/k
+   {
+      uint32_t centred = ((tracked << windowM) / binNumber) >> FREQ_FRACTION_BITS;
+      uint32_t range = FREQ_NOMINAL_SAMPLE_FREQUENCY >> FREQ_RANGE_SHIFT;
+
+      if ( centred > FREQ_NOMINAL_SAMPLE_FREQUENCY + range )
+      {
+         centred = FREQ_NOMINAL_SAMPLE_FREQUENCY + range;
+      }
+      else if ( centred < FREQ_NOMINAL_SAMPLE_FREQUENCY - range )
+      {
+         centred = FREQ_NOMINAL_SAMPLE_FREQUENCY - range;
+      }
+
+      adcSetSampleFrequency( (uint16_t)centred );
+
+      // Measure the next turn from the first window taken at the new rate
+      if ( adcGetSampleFrequency() != sampleFrequency )
+      {
+         hasReference = false;
+         holdOff = 1U << windowM;
+
+         return true;
+      }
+   }
+
+   // Measure the next turn from this bin
+   reference = bin;
+   count = 0;
+
+   return true;
+}
+
+
+/**
+ * Return the frequency tracked
+ *
+ * @return The frequency in 1/100th of Hz, or 0 if not measured yet
+ */
+uint16_t freqGet(void)
+{
+   return (uint16_t)((tracked + (1 << (FREQ_FRACTION_BITS - 1))) >> FREQ_FRACTION_BITS);
+}
+
+
+#endif // FREQ_TRACKING
+
+/* ----------------------------  End of file  ---------------------------- */
@@ -0,0 +1,53 @@
+#ifndef __FREQ_H__HAS_ALREADY_BEEN_INCLUDED__
+#define __FREQ_H__HAS_ALREADY_BEEN_INCLUDED__
+/**
+ *@ingroup freq
+ *@{
+ *@file
+ *****************************************************************************
+ * Defines the mains frequency tracking API.
+ *
+ * The API must be initialised by calling freqInit with the frequency
+ *  measured by the fft and the size of its window. Each new result of the
+ *  fft is then given to freqNext, which measures the frequency and trims
+ *  the sampling rate of the adc so the mains stays at the center of the bin.
+ * FREQ_MIN_AMPLITUDE and FREQ_FILTER_SHIFT can be adjusted in config.h.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+#include "fft.h"
+
+#ifndef FREQ_TRACKING
+   /** The application does not track the frequency unless told otherwise */
+   #define FREQ_TRACKING 0
+#endif
+
+#ifndef FREQ_MIN_AMPLITUDE
+   /**
+    * Smallest amplitude of the bin, in sample units, for its phase to be
+    *  measured. The phase of a smaller bin is mostly noise
+    */
+   #define FREQ_MIN_AMPLITUDE 16
+#endif
+
+#ifndef FREQ_FILTER_SHIFT
+   /** Each measurement moves the frequency tracked by 1/2^n of the error */
+   #define FREQ_FILTER_SHIFT 3
+#endif
+
+/**
+ * The sampling rate is trimmed by 1/2^n of ADC_SAMPLE_FREQUENCY at most,
+ *  so a 50Hz mains is followed from 46.9Hz to 53.1Hz
+ */
+#define FREQ_RANGE_SHIFT 4
+
+void     freqInit(uint16_t frequency, uint8_t m);
+void     freqReset(void);
+bool     freqNext(fftResult_t bin);
+uint16_t freqGet(void);
+
+
+#endif   /* ndef __FREQ_H__HAS_ALREADY_BEEN_INCLUDED__ */
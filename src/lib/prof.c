@@ -0,0 +1,165 @@
+/**
+ *@ingroup lib
+ *@defgroup prof Timing Instrumentation API
+ *@{
+ *@file
+ *****************************************************************************
+ * Times the interrupt handlers and the main loop, so the budget of a
+ *  sample can be checked over the serial port, without a scope on the dbg
+ *  pins.
+ * The time is read from the timer 1, which beats the conversions of the
+ *  adc, extended by the count of its periods (see adcGetTime), in CPU
+ *  cycles modulo 65536. A time is then up to 8ms at 8.192MHz, which is
+ *  longer than the period of a sample.
+ * Each time is compared to the shortest and longest of its probe, and
+ *  counted in a histogram of PROF_BINS bins of doubling width. The counts
+ *  stop at 255.
+ * The interrupts do not nest, so a probe only needs one start time.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include <string.h>
+#include "wgx.h"
+#include "adc.h"
+#include "uart.h"
+#include "prof.h"
+
+#if PROF_ENABLED
+
+/** Times of a probe */
+typedef struct
+{
+   /** Time of the last profStart */
+   uint16_t start;
+   /** Shortest time, in CPU cycles */
+   uint16_t least;
+   /** Longest time, in CPU cycles */
+   uint16_t most;
+   /** Number of times in each bin */
+   uint8_t histogram[PROF_BINS];
+} profTimes_t;
+
+/** Times of each probe */
+static profTimes_t profTimes[profEndOfProbes_e];
+
+/** Name of each probe, to report them */
+static const char profNames[profEndOfProbes_e][6] PROGMEM = {
+   "main",
+   "adc",
+   "timer",
+   "uart",
+   "pin",
+};
+
+
+/**
+ * Forget the times of all the probes
+ */
+static void profReset(void)
+{
+   cli();
+   memset( profTimes, 0, sizeof(profTimes) );
+   sei();
+}
+
+
+/**
+ * Start timing a probe. Call with the interrupts disabled, as they are in
+ *  a handler, or from the main loop.
+ *
+ * @param probe Code timed
+ */
+void profStart(profProbe_t probe)
+{
+   profTimes[probe].start = adcGetTime();
+}
+
+
+/**
+ * Stop timing a probe, and account for its time
+ *
+ * @param probe Code timed, started by profStart
+ */
+void profStop(profProbe_t probe)
+{
+   profTimes_t *times = &profTimes[probe];
+   uint16_t time = adcGetTime() - times->start;
+   uint8_t bin = 0;
+
+   // A probe not timed yet has no longest time
+   if ( time < times->least || times->most == 0 )
+   {
+      times->least = time;
+   }
+
+   if ( time > times->most )
+   {
+      times->most = time;
+   }
+
+   // Bin 0 is under 128 cycles, and each next one twice as long
+   for ( time >>= 7; time != 0 && bin < PROF_BINS - 1; time >>= 1 )
+   {
+      ++bin;
+   }
+
+   if ( times->histogram[bin] != UINT8_MAX )
+   {
+      ++times->histogram[bin];
+   }
+}
+
+
+/**
+ * Print the times of each probe since the last report, one line each with
+ *  its name, its shortest and longest times in CPU cycles, and the counts
+ *  of its histogram. The times are then forgotten.
+ * Times of 32767 cycles or more, past the period of a sample, are
+ *  printed as 32767.
+ */
+void profReport(void)
+{
+   profTimes_t times;
+   uint8_t probe;
+   uint8_t bin;
+
+   for ( probe=0; probe<profEndOfProbes_e; ++probe )
+   {
+      // Copy atomically, as the interrupts go on updating them
+      cli();
+      times = profTimes[probe];
+      sei();
+
+      uartPrint( PSTR("# Time ") );
+      uartPrint( profNames[probe] );
+
+      if ( times.most == 0 )
+      {
+         // Not timed since the last report
+         uartSendChar('\n');
+         continue;
+      }
+
+      uartSendChar(' ');
+      uartPrintNumber( (int)(times.least > INT16_MAX ? INT16_MAX : times.least), 0 );
+      uartSendChar(' ');
+      uartPrintNumber( (int)(times.most > INT16_MAX ? INT16_MAX : times.most), 0 );
+
+      for ( bin=0; bin<PROF_BINS; ++bin )
+      {
+         uartSendChar(' ');
+         uartPrintNumber( times.histogram[bin], 0 );
+      }
+
+      uartSendChar('\n');
+   }
+
+   profReset();
+}
+
+#endif
+
+
+/* ----------------------------  End of file  ---------------------------- */
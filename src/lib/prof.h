@@ -0,0 +1,66 @@
+#ifndef __PROF_H__HAS_ALREADY_BEEN_INCLUDED__
+#define __PROF_H__HAS_ALREADY_BEEN_INCLUDED__
+/**
+ *@ingroup prof
+ *@{
+ *@file
+ *****************************************************************************
+ * Defines the timing instrumentation API.
+ *
+ * With PROF_ENABLED, each interrupt handler and the main loop is timed
+ *  between profStart and profStop, with the time given by the timer 1 (see
+ *  adcGetTime). The shortest and longest times, and a histogram of them,
+ *  are kept in RAM and printed to the serial port by profReport.
+ * Without it, profStart and profStop compile to nothing, so they can be
+ *  left in place, like the dbg pins.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+
+#ifndef PROF_ENABLED
+   /** Time the interrupts and the main loop (1), at the cost of 80 bytes */
+   #define PROF_ENABLED 0
+#endif
+
+/**
+ * Number of bins of the histogram. Bin 0 counts the times under 128
+ *  cycles, and each next bin the times up to twice as long, so the last
+ *  bin counts those of 32768 cycles or more, past the period of a sample
+ */
+#define PROF_BINS 10
+
+/** Code timed */
+typedef enum
+{
+   /** Main loop, from waking up to entering sleep again */
+   profMainLoop_e,
+   /** End of conversion interrupt of the adc */
+   profAdc_e,
+   /** Timer 1 interrupt starting the conversions */
+   profAdcTimer_e,
+   /** Timer 0 interrupts sending and sampling the bits of the uart */
+   profUartTimer_e,
+   /** Pin change interrupt of the start bit of the uart */
+   profUartPin_e,
+   profEndOfProbes_e
+} profProbe_t;
+
+#if PROF_ENABLED
+void profStart(profProbe_t probe);
+void profStop(profProbe_t probe);
+void profReport(void);
+#else
+/** Nothing is timed */
+static inline void profStart(profProbe_t probe)
+   { (void)probe; }
+
+/** Nothing is timed */
+static inline void profStop(profProbe_t probe)
+   { (void)probe; }
+#endif
+
+
+#endif   /* ndef __PROF_H__HAS_ALREADY_BEEN_INCLUDED__ */
@@ -0,0 +1,224 @@
+/**
+ *@ingroup lib
+ *@defgroup rms True RMS API
+ *@{
+ *@file
+ *****************************************************************************
+ * Measures the true RMS of the samples over the window of the fft, so the
+ *  harmonics drawn by non-linear loads, which the bin of the fundamental
+ *  misses, are accounted for.
+ * Each sample is added to a sum and to a sum of squares, which costs one
+ *  16-bit multiplication per sample. At the end of the window, the square
+ *  of the mean is removed from the mean of the squares, so the offset of
+ *  the sensor and of the adc is not counted as power:
+ *  var = (sum(x^2) - sum(x).mean) / N
+ * The sums fit in 32 bits for 12-bit samples up to 256 points. Wider
+ *  samples, like those of ADC_AUTO_GAIN, have their squares shifted down
+ *  by RMS_SQUARE_SHIFT bits so the sums still fit.
+ * The result is the amplitude of the sine of the same RMS, that is
+ *  sqrt(2.var), in the unit of fftGetResult, so both can be compared to
+ *  the same thresholds.
+ * With FFT_OVERLAP, two windows are accumulated, staggered by half a
+ *  window, so a result is ready with every result of the fft. The
+ *  progressive fft gives the result of a window once its second pass is
+ *  done, a window later, when the true RMS of the next window is ready.
+ *  The sliding DFT keeps no sums of its window, so a result is only ready
+ *  every window.
+ * With RMS_TRUE set to 0, only the sums of the samples are kept, for the
+ *  offset of the signal.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include <string.h>
+#include "wgx.h"
+#include "rms.h"
+#include "adc.h"
+
+/**
+ * Number of bits dropped from each square, so the sum of the squares of
+ *  FFT_N samples of ADC_SAMPLE_BITS fits in 31 bits
+ */
+#if 2 * (ADC_SAMPLE_BITS - 1) + FFT_M > 31
+   #define RMS_SQUARE_SHIFT (2 * (ADC_SAMPLE_BITS - 1) + FFT_M - 31)
+#else
+   #define RMS_SQUARE_SHIFT 0
+#endif
+
+/**
+ * Prepare to measure a signal over the window of the fft
+ *
+ * @param ctx Context of the signal
+ * @param m   Size of the window in 2^m points, as given to fftInit
+ */
+void rmsInit(rms_t *ctx, uint8_t m)
+{
+   // Follow the window of the fft, clamped the same way
+   if ( m < FFT_MIN_M )
+   {
+      m = FFT_MIN_M;
+   }
+   else if ( m > FFT_M )
+   {
+      m = FFT_M;
+   }
+
+   ctx->m = m;
+   ctx->lastSum = 0;
+#if RMS_TRUE
+   ctx->result = 0;
+#endif
+
+   rmsReset(ctx);
+}
+
+
+/**
+ * Start the windows again, for when the samples do not follow on from each
+ *  other, like after fftReset. The last result is kept.
+ *
+ * @param ctx Context of the signal
+ */
+void rmsReset(rms_t *ctx)
+{
+   memset( ctx->sum, 0, sizeof(ctx->sum) );
+#if RMS_TRUE
+   memset( ctx->sumOfSquares, 0, sizeof(ctx->sumOfSquares) );
+#endif
+   ctx->count = 0;
+
+   // The first window staggered by half a window only holds half a window
+   ctx->window = RMS_WINDOWS - 1;
+   ctx->isFull = (RMS_WINDOWS == 1);
+}
+
+
+/**
+ * Compute the integer square root, rounded down, one bit at a time
+ *
+ * @param value Value to compute the root of
+ * @return The square root of value
+ */
+uint16_t rmsSquareRoot(uint32_t value)
+{
+   uint32_t root = 0;
+   uint32_t bit = 1UL << 30;
+
+   while ( bit > value )
+   {
+      bit >>= 2;
+   }
+
+   while ( bit != 0 )
+   {
+      if ( value >= root + bit )
+      {
+         value -= root + bit;
+         root = (root >> 1) + bit;
+      }
+      else
+      {
+         root >>= 1;
+      }
+
+      bit >>= 2;
+   }
+
+   return (uint16_t)root;
+}
+
+
+/**
+ * Work out the result of a complete window
+ *
+ * @param ctx    Context of the signal
+ * @param window Window completed
+ */
+static void rmsComplete(rms_t *ctx, uint8_t window)
+{
+   int32_t sum = ctx->sum[window];
+#if RMS_TRUE
+   int32_t mean;
+   uint32_t correction;
+   uint32_t variance;
+#endif
+
+   ctx->lastSum = sum;
+
+#if RMS_TRUE
+
+   // Round the mean towards 0, so the remainder of sum/N has its sign
+   mean = sum < 0 ? -(-sum >> ctx->m) : sum >> ctx->m;
+
+   // sum.mean/N = mean^2 + remainder.mean/N, which both fit in 32 bits
+   correction = (uint32_t)(mean * mean) +
+      (uint32_t)(((sum - (mean << ctx->m)) * mean) >> ctx->m);
+   correction >>= RMS_SQUARE_SHIFT;
+
+   // The truncated squares may fall just short of the correction
+   variance = ctx->sumOfSquares[window] >> ctx->m;
+   variance = variance > correction ? variance - correction : 0;
+
+   // 2.var with FFT_RESULT_FRACTION_BITS on the amplitude, in 30 bits
+   variance <<= RMS_SQUARE_SHIFT + 2 * FFT_RESULT_FRACTION_BITS + 1;
+
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   ctx->result = variance;
+#else
+   ctx->result = rmsSquareRoot( variance );
+#endif
+#endif // RMS_TRUE
+}
+
+
+/**
+ * Add a sample to the windows
+ *
+ * @param ctx    Context of the signal
+ * @param sample New sample, as given to fftNext
+ * @return true if a window was completed, and a new result is ready
+ */
+bool rmsNext(rms_t *ctx, int16_t sample)
+{
+#if RMS_TRUE
+   uint32_t square = (uint32_t)((int32_t)sample * sample) >> RMS_SQUARE_SHIFT;
+#endif
+   bool retval = false;
+   uint8_t w;
+
+   for ( w=0; w<RMS_WINDOWS; ++w )
+   {
+      ctx->sum[w] += sample;
+#if RMS_TRUE
+      ctx->sumOfSquares[w] += square;
+#endif
+   }
+
+   // The windows are completed in turn every N/RMS_WINDOWS samples
+   if ( ++ctx->count == ((fftIndex_t)1 << ctx->m) / RMS_WINDOWS )
+   {
+      w = ctx->window;
+
+      if ( ctx->isFull )
+      {
+         rmsComplete( ctx, w );
+         retval = true;
+      }
+
+      // The window starts again
+      ctx->sum[w] = 0;
+#if RMS_TRUE
+      ctx->sumOfSquares[w] = 0;
+#endif
+
+      ctx->count = 0;
+      ctx->window = (w + 1) % RMS_WINDOWS;
+      ctx->isFull = true;
+   }
+
+   return retval;
+}
+
+
+/* ----------------------------  End of file  ---------------------------- */
@@ -0,0 +1,104 @@
+#ifndef __RMS_H__HAS_ALREADY_BEEN_INCLUDED__
+#define __RMS_H__HAS_ALREADY_BEEN_INCLUDED__
+/**
+ *@ingroup rms
+ *@{
+ *@file
+ *****************************************************************************
+ * Defines the true RMS API.
+ *
+ * The caller owns an rms_t context for each signal, like the fft, which must
+ *  be initialised by calling rmsInit with the size of the window of the fft.
+ *  Each sample given to the fft is also given to rmsNext, which returns true
+ *  when a window is complete. The result is then read with rmsGetResult, in
+ *  the unit of fftGetResult.
+ * With RMS_TRUE set to 0, only the sum of each window is kept, for the
+ *  offset given by rmsGetSum, and rmsGetResult is not available.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+#include "fft.h"
+
+/**
+ * Measure the true RMS of the samples (1), or only the sum of each window
+ *  (0), which saves the squares, their multiplication and 8 bytes of RAM
+ *  per signal
+ */
+#ifndef RMS_TRUE
+   #define RMS_TRUE 0
+#endif
+
+/**
+ * Number of windows accumulated at once. The overlapped ffts have a result
+ *  every half window, so two windows are staggered by half a window
+ */
+#if FFT_OVERLAP && ! FFT_SLIDING_DFT
+   #define RMS_WINDOWS 2
+#else
+   #define RMS_WINDOWS 1
+#endif
+
+/** Context of the true RMS of a signal */
+typedef struct
+{
+   /** Sum of the samples of each window */
+   int32_t sum[RMS_WINDOWS];
+
+#if RMS_TRUE
+   /** Sum of the squares of the samples of each window */
+   uint32_t sumOfSquares[RMS_WINDOWS];
+#endif
+
+   /** Number of samples since the last window was completed */
+   fftIndex_t count;
+
+   /** Window completed next */
+   uint8_t window;
+
+   /** true once the window completed next holds a whole window */
+   bool isFull;
+
+   /** Size of the window in 2^m points */
+   uint8_t m;
+
+#if RMS_TRUE
+   /** Result of the last window completed */
+   uint32_t result;
+#endif
+
+   /** Sum of the samples of the last window completed, its offset */
+   int32_t lastSum;
+} rms_t;
+
+void     rmsInit(rms_t *ctx, uint8_t m);
+void     rmsReset(rms_t *ctx);
+bool     rmsNext(rms_t *ctx, int16_t sample);
+uint16_t rmsSquareRoot(uint32_t value);
+
+#if RMS_TRUE
+/**
+ * Return the true RMS of the last window, as the amplitude of the sine of
+ *  the same RMS. A pure sine then gives the result of its bin in the fft.
+ *
+ * @param ctx Context of the signal
+ * @return The squared amplitude, or the amplitude, as given by fftGetResult
+ */
+static inline uint32_t rmsGetResult(const rms_t *ctx)
+   { return ctx->result; }
+#endif
+
+/**
+ * Return the sum of the samples of the last window, which is the offset
+ *  of the signal once divided by the size of the window
+ *
+ * @param ctx Context of the signal
+ * @return The sum of the 2^m samples of the window
+ */
+static inline int32_t rmsGetSum(const rms_t *ctx)
+   { return ctx->lastSum; }
+
+
+#endif   /* ndef __RMS_H__HAS_ALREADY_BEEN_INCLUDED__ */
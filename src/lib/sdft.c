@@ -0,0 +1,288 @@
+/**
+ *@ingroup fft
+ *@{
+ *@file
+ *****************************************************************************
+ * Sliding DFT implementation of the FFT API.
+ * Like the progressive fft, only the bins of the center frequencies are
+ *  computed, but the bins are updated with every new sample over a window
+ *  of the last FFT_N samples, so a new result is ready each time.
+ * Up to FFT_MAX_BINS bins are computed. Unlike the progressive fft, any
+ *  set of bins can be measured together, since the bins share nothing but
+ *  the window of samples.
+ * Each new sample adds its contribution x(n).W^(kn) to the bin, and the
+ *  sample leaving the window removes its own, which is the same since
+ *  W^(k(n-N)) = W^(kn). This costs 4 multiplications per sample and
+ *  per bin.
+ * The contributions are computed in integer with the Q15 twiddle factors,
+ *  so the one removed is always exactly the one which was added, and the
+ *  bin does not drift as it would with the recursive form of the sliding
+ *  DFT. The phase of the bin rotates with n, which leaves the magnitude
+ *  unchanged.
+ * Each contribution is truncated by FFT_M bits from its Q15 product, which
+ *  keeps the bin within 32 bits for 16-bit samples. The truncation moves
+ *  the result by less than 2^(FFT_M+1.5)/32768 in sample units (0.006 for
+ *  64 points), to add to the Q15 quantization of the twiddle factors.
+ * Only the window of samples and the bins are kept, that is 2*FFT_N + 13
+ *  bytes for one bin (141 bytes for 64 points) against 400 for the
+ *  progressive fft. Each extra bin adds 10 bytes.
+ * With FFT_MIN_M, a smaller window can be given to fftInit. The bin
+ *  then steps through the table of FFT_N points by its number times the
+ *  stride of the window, so the cost per sample is unchanged.
+ *
+ * This implementation is selected by setting FFT_SLIDING_DFT to 1 in the
+ *  config file.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ -*/
+
+#include <string.h>
+
+#include "wgx.h"
+#include "fft.h"
+
+// The progressive fft is used otherwise
+#if FFT_SLIDING_DFT
+
+/**
+ * Number of bits each contribution is shifted right by so that the sum of
+ *  FFT_N products of 16-bit samples by Q15 factors fits in 32 bits
+ */
+#define SDFT_SHIFT FFT_M
+
+/**
+ * Number of bits to drop from a bin to get the magnitude with
+ *  FFT_RESULT_FRACTION_BITS fractional bits, given the Q15 factors, the
+ *  shift, and the bin holding half the size of the window times the
+ *  amplitude
+ */
+#define SDFT_RESULT_SHIFT(ctx) \
+   (15 - SDFT_SHIFT + FFT_CTX_M(ctx) - 1 - FFT_RESULT_FRACTION_BITS)
+
+/** Define the twiddle factor type. Each part is given in Q15 */
+typedef struct
+{
+   /** Real part of the number */
+   int16_t real;
+   /** Imaginary part of the number */
+   int16_t imag;
+} twiddle_t;
+
+// The sliding DFT always uses the Q15 twiddle factors
+#undef FFT_FIXED_POINT
+#define FFT_FIXED_POINT 1
+
+// Include the twiddle coeffs locally.
+#include "twiddle.c"
+
+
+/**
+ * Contribution of a sample to one part of the bin
+ *
+ * @param s Sample value
+ * @param w Twiddle factor part in Q15
+ * @return The truncated product
+ */
+static inline int32_t sdftProduct( fftSample_t s, int16_t w )
+   { return ((int32_t)s * w) >> SDFT_SHIFT; }
+
+
+/**
+ * Prepares the sliding DFT for the bins containing the given frequencies.
+ * The frequencies beyond FFT_MAX_BINS are ignored. A size of window out of
+ *  the range FFT_MIN_M to FFT_M is brought back within the range.
+ *
+ * @param ctx               Context of the sliding DFT
+ * @param m                 Size of the window in 2^m points
+ * @param centerFrequencies List of the frequencies to measure in Hz
+ * @param count             Number of frequencies in the list
+ * @return true if the window has the size given, and all frequencies
+ *          are measured
+ */
+bool fftInit(fft_t *ctx, uint8_t m,
+             const uint16_t *centerFrequencies, uint8_t count)
+{
+   uint8_t n;
+   bool retval = (m >= FFT_MIN_M && m <= FFT_M);
+
+#if FFT_MIN_M < FFT_M
+   ctx->m = m < FFT_MIN_M ? FFT_MIN_M : m > FFT_M ? FFT_M : m;
+   ctx->n = (fftIndex_t)1 << ctx->m;
+#endif
+
+   for ( n=0; n<count && n<FFT_MAX_BINS; ++n )
+   {
+      fftIndex_t k = ((uint32_t)centerFrequencies[n] << FFT_CTX_M(ctx))
+         / ADC_SAMPLE_FREQUENCY;
+
+      // Step through the table of FFT_N points with the stride of the window
+      ctx->bin[n].k = (k & (FFT_CTX_N(ctx) - 1)) * (FFT_N / FFT_CTX_N(ctx));
+   }
+
+   ctx->bins = n;
+
+   fftReset(ctx);
+
+   return retval && ctx->bins == count;
+}
+
+
+/**
+ * Restart the measurement discaring any previous samples.
+ * Requires that fftInit has been called. Called by fftInit.
+ *
+ * @param ctx Context of the sliding DFT
+ */
+void fftReset(fft_t *ctx)
+{
+   uint8_t b;
+
+   // The samples of the window are removed as they leave, so start empty
+   memset( ctx->s, 0, sizeof(ctx->s) );
+
+   for ( b=0; b<ctx->bins; ++b )
+   {
+      ctx->bin[b].real   = 0;
+      ctx->bin[b].imag   = 0;
+      ctx->bin[b].wIndex = 0;
+   }
+
+   ctx->i      = 0;
+   ctx->count  = 0;
+}
+
+
+/**
+ * Round a part of a bin to the magnitude in sample units, with
+ *  FFT_RESULT_FRACTION_BITS fractional bits
+ *
+ * @param ctx Context of the sliding DFT
+ * @param v   Part of a bin
+ * @return The scaled part, on 16 bits
+ */
+static inline int16_t sdftToResult( const fft_t *ctx, int32_t v )
+{
+   uint8_t shift = SDFT_RESULT_SHIFT(ctx);
+
+   return (int16_t)((v + (1L << (shift - 1))) >> shift);
+}
+
+
+/**
+ * Return the squared magnitude of a bin over the last window of samples.
+ * The result has the same scale as the progressive fft.
+ *
+ * @param ctx   Context of the sliding DFT
+ * @param index Position of the bin in the list given to fftInit
+ * @return The last computed result, that is the square of the magnitude
+ *          with 2*FFT_RESULT_FRACTION_BITS fractional bits, or the
+ *          magnitude estimate with FFT_MAGNITUDE
+ */
+uint32_t fftGetResult(const fft_t *ctx, uint8_t index)
+{
+   const sdftBin_t *bin = &ctx->bin[index];
+
+   return fftResultOf(
+      sdftToResult( ctx, bin->real ), sdftToResult( ctx, bin->imag ) );
+}
+
+
+/**
+ * Return the value of a bin over the last window of samples.
+ * The bin holds the sum of x(n).W^(kn) from the reset, which is the bin
+ *  of the window rotated by W^(k.n0), n0 being the first sample of the
+ *  window. The factor of n0 is the factor of the next sample, since they
+ *  are a whole window apart, so the bin is rotated back by its conjugate.
+ *
+ * @param ctx   Context of the sliding DFT
+ * @param index Position of the bin in the list given to fftInit
+ * @return The bin, with its phase relative to the first sample of the window
+ */
+fftResult_t fftGetComplexResult(const fft_t *ctx, uint8_t index)
+{
+   const sdftBin_t *bin = &ctx->bin[index];
+   int16_t real = sdftToResult( ctx, bin->real );
+   int16_t imag = sdftToResult( ctx, bin->imag );
+   fftResult_t result;
+   twiddle_t w;
+
+   memcpy_P( &w, &fftTwiddle[bin->wIndex & (FFT_H - 1)], sizeof(twiddle_t) );
+
+   if ( bin->wIndex & FFT_H )
+   {
+      w.real = -w.real;
+      w.imag = -w.imag;
+   }
+
+   result.real = (int16_t)(((int32_t)real * w.real +
+      (int32_t)imag * w.imag + 0x4000) >> 15);
+   result.imag = (int16_t)(((int32_t)imag * w.real -
+      (int32_t)real * w.imag + 0x4000) >> 15);
+
+   return result;
+}
+
+
+/**
+ * Slide the window by one sample
+ *
+ * @param ctx    Context of the sliding DFT
+ * @param sample A signed 16-bit sample value - already decimated and
+ *                normalized.
+ * @return true once the window has been filled, that is for every sample
+ *          but the first ones following a reset
+ */
+bool fftNext( fft_t *ctx, int16_t sample )
+{
+   twiddle_t w;
+   int32_t dr, di;
+   uint8_t b;
+   fftSample_t old = ctx->s[ctx->i];
+
+   // The new sample replaces the oldest one
+   ctx->s[ctx->i] = sample;
+   ctx->i = (ctx->i + 1) & (FFT_CTX_N(ctx) - 1);
+
+   for ( b=0; b<ctx->bins; ++b )
+   {
+      sdftBin_t *bin = &ctx->bin[b];
+
+      // The table only holds half a turn. The other half is the opposite
+      memcpy_P(
+         &w, &fftTwiddle[bin->wIndex & (FFT_H - 1)], sizeof(twiddle_t) );
+
+      // Add the new contribution, and remove the one of the oldest sample
+      dr = sdftProduct( sample, w.real ) - sdftProduct( old, w.real );
+      di = sdftProduct( sample, w.imag ) - sdftProduct( old, w.imag );
+
+      if ( bin->wIndex & FFT_H )
+      {
+         bin->real -= dr;
+         bin->imag -= di;
+      }
+      else
+      {
+         bin->real += dr;
+         bin->imag += di;
+      }
+
+      // Next sample rotates by the bin number
+      bin->wIndex = (bin->wIndex + bin->k) & (FFT_N - 1);
+   }
+
+   // Wait for a full window to be stored
+   if ( ctx->count < FFT_CTX_N(ctx) - 1 )
+   {
+      ++ctx->count;
+
+      return false;
+   }
+
+   return true;
+}
+
+#endif // FFT_SLIDING_DFT
+
+
+/* ----------------------------  End of file  ---------------------------- */
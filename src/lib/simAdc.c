@@ -12,9 +12,15 @@
  */
 #include "adc.h"
 
-volatile bool adcNewValueFlag;
 volatile bool adcNewConversionStartedFlag;
-volatile int16_t adcValue;
+volatile int16_t adcQueue[ADC_QUEUE_SIZE][ADC_CHANNELS];
+volatile uint8_t adcQueueClips[ADC_QUEUE_SIZE][ADC_CHANNELS];
+volatile uint8_t adcQueueHead;
+volatile uint8_t adcQueueTail;
+volatile uint16_t adcOverruns;
+
+/** Sampling rate in 1/100th of Hz. Set exactly, unlike the timer */
+static uint16_t sampleFrequency = ADC_SAMPLE_FREQUENCY * 100U;
 
 /** Empty stub. Does nothing */
 void adcInit()
@@ -26,6 +32,80 @@ void adcShutdown()
 {
 }
 
+/** Keep the sampling rate for adcGetSampleFrequency */
+void adcSetSampleFrequency(uint16_t frequency)
+{
+   sampleFrequency = frequency;
+}
+
+/** @return The sampling rate last set, in 1/100th of Hz */
+uint16_t adcGetSampleFrequency(void)
+{
+   return sampleFrequency;
+}
+
+/** Empty stub. The samples simulated have no offset */
+void adcZero(void)
+{
+}
+
+/** Empty stub. Does nothing */
+void adcTrackOffset(uint8_t channel, int32_t sum, uint8_t m)
+{
+   (void)channel;
+   (void)sum;
+   (void)m;
+}
+
+/** @return No offset */
+int16_t adcGetOffset(uint8_t channel)
+{
+   (void)channel;
+
+   return 0;
+}
+
+/** @return The value unchanged, the samples simulated are not filtered */
+uint16_t adcCompensateDroop(uint16_t value, uint8_t frequency)
+{
+   (void)frequency;
+
+   return value;
+}
+
+#if PROF_ENABLED
+/** @return No time passes in the simulation */
+uint16_t adcGetTime(void)
+{
+   return 0;
+}
+#endif
+
+#if ADC_JITTER
+/** The samples simulated do not jitter */
+void adcGetJitter(uint16_t *earliest, uint16_t *latest)
+{
+   *earliest = 0;
+   *latest = 0;
+}
+#endif
+
+#if ADC_AUTO_GAIN
+/** Empty stub. Does nothing */
+void adcSetGainWindow(uint8_t m)
+{
+   (void)m;
+}
+
+/** @return The gain of the samples simulated, 32x */
+uint8_t adcGetGain(uint8_t channel)
+{
+   (void)channel;
+
+   return 32;
+}
+#endif
+
 
 /* -----------------------------  End of file  ---------------------------- */
 
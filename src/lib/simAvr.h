@@ -18,6 +18,7 @@
 #define strlen_P strlen
 #define strcmp_P strcmp
 #define pgm_read_byte(a) (*a)
+#define pgm_read_word(a) (*a)
 #define pgm_read_dword(a) (*a)
 #define PROGMEM
 
@@ -85,6 +86,14 @@ int printf_P( PGM_P format, ... );
 char *itoa (int val, char *s, int radix);
 #define square(a) (((float)a)*((float)a))
 
+/** Same as the optimised version of util/crc16.h */
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+   data ^= (uint8_t)crc;
+   data ^= data << 4;
+   return (((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^
+      ((uint16_t)data << 3);
+}
+
 /*
  *  Eeprom emulation
  */
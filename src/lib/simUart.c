@@ -29,6 +29,14 @@ void uartTransmit( const uint8_t c )
     fflush(stdout);
 }
 
+uint8_t uartWrite( const uint8_t *buf, uint8_t len )
+{
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+
+    return len;
+}
+
 #ifdef __CYGWIN__
 #include <termios.h>
 #include <unistd.h>
@@ -0,0 +1,53 @@
+/**
+ *@ingroup fft
+ *@defgroup fft_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Builds the fft with the compact layout under other names, so
+ *  testFFTLayout can run it alongside the standard layout built from fft.c.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+
+// Override the config for this build only
+#undef FFT_COMPACT
+#define FFT_COMPACT 1
+
+// Rename the api and the context
+#define fft_t        fftCompact_t
+#define fftInit      fftCompactInit
+#define fftReset     fftCompactReset
+#define fftNext      fftCompactNext
+#define fftGetResult fftCompactGetResult
+#define fftGetComplexResult fftCompactGetComplexResult
+
+#include "fft.c"
+
+/** Context of the fft with the compact layout */
+static fft_t compact;
+
+/** @see fftInit */
+bool compactInit(uint8_t m, const uint16_t *centerFrequencies, uint8_t count)
+   { return fftInit( &compact, m, centerFrequencies, count ); }
+
+/** @see fftReset */
+void compactReset(void)
+   { fftReset( &compact ); }
+
+/** @see fftNext */
+bool compactNext(int16_t sample)
+   { return fftNext( &compact, sample ); }
+
+/** @see fftGetResult */
+uint32_t compactGetResult(uint8_t index)
+   { return fftGetResult( &compact, index ); }
+
+/** Size of the context with the compact layout */
+const size_t compactSize = sizeof(compact);
+
+
+/* ----------------------------  End of file  ---------------------------- */
@@ -17,11 +17,21 @@ $(eval $(call makeTest,testDbg))
 # Uart API unit test build configuration
 #
 testUart.C=testUart
-testUart.PICK=uart
+testUart.PICK=uart uartUsi
 
 $(eval $(call makeTest,testUart))
 
 
+#
+# Uart API unit test build configuration, with the USI backend
+#
+testUartUsi.C=testUart
+testUartUsi.PICK=$(testUart.PICK)
+testUartUsi.CFG=uartUsiTestCfg
+
+$(eval $(call makeTest,testUartUsi))
+
+
 #
 # nvParam API unit test build configuration
 #
@@ -55,11 +65,70 @@ $(eval $(call makeTest,testAdc))
 # FFT API unit test build configuration
 #
 testFFT.C=testFFT
-testFFT.PICK=uart fft
+testFFT.PICK=uart fft sdft
 
 $(eval $(call makeTest,testFFT))
 
 
+#
+# FFT API unit test with the twiddle cache. Compare the timings with testFFT
+#
+testFFTCache.C=testFFT
+testFFTCache.PICK=$(testFFT.PICK)
+testFFTCache.CFG=fftCacheTestCfg
+
+$(eval $(call makeTest,testFFTCache))
+
+
+#
+# FFT API unit test with the per-bin twiddle tables. Compare the timings with testFFT
+#
+testFFTPath.C=testFFT
+testFFTPath.PICK=$(testFFT.PICK)
+testFFTPath.CFG=fftPathTestCfg
+
+$(eval $(call makeTest,testFFTPath))
+
+
+#
+# FFT API unit test with a magnitude estimator. Compare the timings with testFFT
+#
+testFFTMagnitude.C=testFFT
+testFFTMagnitude.PICK=$(testFFT.PICK)
+testFFTMagnitude.CFG=fftMagnitudeTestCfg
+
+$(eval $(call makeTest,testFFTMagnitude))
+
+
+#
+# Frequency tracking API unit test build configuration
+#
+testFreq.C=testFreq
+testFreq.PICK=uart fft sdft freq adc
+testFreq.CFG=freqTestCfg
+
+$(eval $(call makeTest,testFreq))
+
+
+#
+# True RMS API unit test build configuration
+#
+testRms.C=testRms
+testRms.PICK=uart fft sdft rms
+testRms.CFG=rmsTestCfg
+
+$(eval $(call makeTest,testRms))
+
+
+#
+# Binary frame API unit test build configuration
+#
+testFrame.C=testFrame
+testFrame.PICK=uart frame
+
+$(eval $(call makeTest,testFrame))
+
+
 #
 # Validate the nvParam in simulation
 #
@@ -93,10 +162,50 @@ $(eval $(call makeSim,simConsole))
 # Validate the FFT in simulation
 #
 simFFT.C=testFFT
-simFFT.PICK=fft nvParam simUart simEeprom simAvr
+simFFT.PICK=fft sdft nvParam simUart simEeprom simAvr
 
 $(eval $(call makeSim,simFFT))
 
 
+#
+# Validate the frequency tracking in simulation
+#
+simFreq.C=testFreq
+simFreq.PICK=fft sdft freq simAdc nvParam simUart simEeprom simAvr
+simFreq.CFG=$(testFreq.CFG)
+
+$(eval $(call makeSim,simFreq))
+
+
+#
+# Validate the true RMS in simulation
+#
+simRms.C=testRms
+simRms.PICK=fft sdft rms nvParam simUart simEeprom simAvr
+simRms.CFG=$(testRms.CFG)
+
+$(eval $(call makeSim,simRms))
+
+
+#
+# Validate the binary frames in simulation
+#
+simFrame.C=testFrame
+simFrame.PICK=frame simUart simAvr
+
+$(eval $(call makeSim,simFrame))
+
+
+#
+# Compare the compact layout of the FFT with the standard layout.
+# Run src/scripts/fftLayoutTest.sh to check all the sizes of fft
+#
+simFFTLayout.C=testFFTLayout fftCompact
+simFFTLayout.PICK=fft
+simFFTLayout.CFG=fftLayoutTestCfg
+
+$(eval $(call makeSim,simFFTLayout))
+
+
 #-------------------------------  End of File  -------------------------------
 
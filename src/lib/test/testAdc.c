@@ -42,17 +42,21 @@ int main(void)
       }
       else if ( adcHasNewValue() )
       {
-         rawValue += adcGetValue();
-
-         if ( ++count == 256 )
+         // Read all the values queued
+         do
          {
-            count=0;
-            adcShutdown();
-            uartPrintNumber( rawValue >> 8, 0 );
-            uartSendChar('\n');
-            adcInit();
-            rawValue=0;
-         }
+            rawValue += adcGetValue();
+
+            if ( ++count == 256 )
+            {
+               count=0;
+               adcShutdown();
+               uartPrintNumber( rawValue >> 8, 0 );
+               uartSendChar('\n');
+               adcInit();
+               rawValue=0;
+            }
+         } while ( adcHasNewValue() );
       }
 
    }
@@ -18,6 +18,24 @@
 #include "fft.h"
 #include "uart.h"
 
+/** Context of the fft under test */
+static fft_t fft;
+
+/**
+ * Convert a result of the fft into a magnitude in sample units
+ *
+ * @param result Squared magnitude, or magnitude, given by fftGetResult
+ * @return The magnitude
+ */
+static float magnitude( uint32_t result )
+{
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   return sqrt( (float)result ) / (1 << FFT_RESULT_FRACTION_BITS);
+#else
+   return (float)result / (1 << FFT_RESULT_FRACTION_BITS);
+#endif
+}
+
 #if defined __CYGWIN__ || __MINGW__
 #define printResult(r) printf(".+ Result: %f\n", r)
 #else
@@ -34,18 +52,126 @@ static void halt(void)
    }
 }
 
+#ifdef AVR
+/** Prescaler of the timer 1 used to time the fft */
+#define TIMING_PRESCALE 32
+
+/** Read the 10-bit timer 1 counter. TC1H is latched by reading TCNT1 */
+static inline uint16_t timerRead(void)
+{
+   uint8_t low = TCNT1;
+
+   return ((uint16_t)TC1H << 8) | low;
+}
+
+/**
+ * Time each call to fftNext over 4 full windows of a sine and return
+ *  the worst case, and the average which tells the cost per sample.
+ * Comparing the average of testFFT with testFFTCache and testFFTPath
+ *  gives the cycles saved per sample by the twiddle cache and by the per-bin
+ *  tables. The timer 1 runs over 10 bits at SYS_CLOCK/32, so
+ *  durations up to 32736 cycles can be measured, which is over the
+ *  sample period.
+ *
+ * @param average Where to store the average duration in CPU cycles
+ * @return The worst case duration of fftNext in CPU cycles
+ */
+static uint16_t timeWorstCase( long centerFreq, uint16_t *average )
+{
+   uint16_t worst = 0;
+   uint32_t total = 0;
+   size_t i;
+
+   // 10-bit top for the timer 1 and start at SYS_CLOCK/32
+   TC1H = 0x03;
+   OCR1C = 0xFF;
+   TCCR1B = _BV(PSR1) | _BV(CS12) | _BV(CS11);
+
+   for ( i=0; i < (4 << FFT_M); ++i )
+   {
+      uint16_t start, duration;
+      int16_t data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ));
+
+      cli();
+      start = timerRead();
+      fftNext( &fft, data );
+      duration = ( timerRead() - start ) & 0x3FF;
+      sei();
+
+      total += duration;
+
+      if ( duration > worst )
+      {
+         worst = duration;
+      }
+   }
+
+   // Stop the timer
+   TCCR1B = _BV(PSR1);
+
+   *average = ( total * TIMING_PRESCALE ) >> ( FFT_M + 2 );
+
+   return worst * TIMING_PRESCALE;
+}
+#endif
+
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_ALPHA_MAX_BETA_MIN
+/** Bounds of the relative error of the magnitude estimate */
+#define ESTIMATE_MIN_ERROR (-0.031)
+#define ESTIMATE_MAX_ERROR 0.01
+#elif FFT_MAGNITUDE == FFT_MAGNITUDE_CORDIC
+#define ESTIMATE_MIN_ERROR (-0.003)
+#define ESTIMATE_MAX_ERROR 0.001
+#else
+#define ESTIMATE_MIN_ERROR 0.0
+#define ESTIMATE_MAX_ERROR 0.0
+#endif
+
+/**
+ * Check a result is within 1 sample unit of the expected magnitude, and
+ *  the error of the magnitude estimate
+ *
+ * @param res      Magnitude measured
+ * @param expected Magnitude expected
+ * @return true if the result is close enough
+ */
+static bool isNear( float res, float expected )
+{
+   return res >= expected * (1.0 + ESTIMATE_MIN_ERROR) - 1.0 &&
+      res <= expected * (1.0 + ESTIMATE_MAX_ERROR) + 1.0;
+}
+
 int main(void)
 {
    int16_t data;
    size_t i;
-   static const long centerFreq = 50;
+   static const uint16_t centerFreq = 50;
 
    uartInit(NULL);
 
+#if FFT_MAGNITUDE != FFT_MAGNITUDE_SQUARED
+   uartLogInfo("TEST : magnitude estimate");
+
+   // Estimate a magnitude of 1000 at all angles of the first quadrant
+   for ( i=0; i<=90; ++i )
+   {
+      float angle = M_PI * (float)i / 180.0;
+      float estimate = fftMagnitude(
+         (uint16_t)( 1000.0 * cos(angle) + 0.5 ),
+         (uint16_t)( 1000.0 * sin(angle) + 0.5 ) ) / 1000.0 - 1.0;
+
+      if ( estimate < ESTIMATE_MIN_ERROR || estimate > ESTIMATE_MAX_ERROR )
+      {
+         uartLogError("FAILED : estimate out of bounds");
+         halt();
+      }
+   }
+#endif
+
    uartLogInfo("TEST : fftInit");
 
    // Put the data through the fft
-   fftInit( centerFreq );
+   fftInit( &fft, FFT_M, &centerFreq, 1 );
 
    uartLogInfo("TEST : no signal");
 
@@ -60,12 +186,12 @@ int main(void)
          halt();
       }
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
       {
-         float res = fftGetResult();
+         float res = magnitude( fftGetResult( &fft, 0 ) );
          printResult( res );
 
-         if ( res < -1.0 || res > 1.0 )
+         if ( ! isNear( res, 0.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -77,7 +203,7 @@ int main(void)
 
    uartLogInfo("TEST : fftReset");
 
-   fftReset();
+   fftReset( &fft );
 
    uartLogInfo("TEST : simple sine");
 
@@ -85,12 +211,12 @@ int main(void)
    {
       data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ));
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
       {
-         float res = fftGetResult();
+         float res = magnitude( fftGetResult( &fft, 0 ) );
          printResult( res );
 
-         if ( res < 99.0 || res > 101.0 )
+         if ( ! isNear( res, 100.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -100,7 +226,7 @@ int main(void)
       }
    }
 
-   fftReset();
+   fftReset( &fft );
 
    uartLogInfo("TEST : DC Offset");
 
@@ -109,12 +235,12 @@ int main(void)
    {
       data = 20 + (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ));
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
       {
-         float res = fftGetResult();
+         float res = magnitude( fftGetResult( &fft, 0 ) );
          printResult( res );
 
-         if ( res < 99.0 || res > 101.0 )
+         if ( ! isNear( res, 100.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -124,7 +250,7 @@ int main(void)
       }
    }
 
-   fftReset();
+   fftReset( &fft );
 
    uartLogInfo("TEST : phase offset");
 
@@ -133,12 +259,12 @@ int main(void)
    {
       data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)((i+10)*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ));
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
       {
-         float res = fftGetResult();
+         float res = magnitude( fftGetResult( &fft, 0 ) );
          printResult( res );
 
-         if ( res < 99.0 || res > 101.0 )
+         if ( ! isNear( res, 100.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -148,7 +274,7 @@ int main(void)
       }
    }
 
-   fftReset();
+   fftReset( &fft );
 
    uartLogInfo("TEST : different frequency over");
 
@@ -157,12 +283,12 @@ int main(void)
    {
       data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*(centerFreq+10)) / (float)ADC_SAMPLE_FREQUENCY ));
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
       {
-         float res = fftGetResult();
+         float res = magnitude( fftGetResult( &fft, 0 ) );
          printResult( res );
 
-         if ( res < -1.0 || res > 1.0 )
+         if ( ! isNear( res, 0.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -172,7 +298,7 @@ int main(void)
       }
    }
 
-   fftReset();
+   fftReset( &fft );
 
    uartLogInfo("TEST : different frequency under");
 
@@ -181,12 +307,12 @@ int main(void)
    {
       data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*(centerFreq-10)) / (float)ADC_SAMPLE_FREQUENCY ));
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
       {
-         float res = fftGetResult();
+         float res = magnitude( fftGetResult( &fft, 0 ) );
          printResult( res );
 
-         if ( res < -1.0 || res > 1.0 )
+         if ( ! isNear( res, 0.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -196,7 +322,7 @@ int main(void)
       }
    }
 
-   fftReset();
+   fftReset( &fft );
 
    uartLogInfo("TEST : Combined frequencies with DC offset and phase shift");
 
@@ -206,12 +332,64 @@ int main(void)
       data = (int16_t)( 14 + 100.0 * sin( 2.0 * M_PI * (float)((i+4)*(centerFreq)) / (float)ADC_SAMPLE_FREQUENCY ));
       data += (int16_t)( 47 - 100.0 * sin( 2.0 * M_PI * (float)(i*(centerFreq+20)) / (float)ADC_SAMPLE_FREQUENCY ));
 
-      if ( fftNext( data ) )
+      if ( fftNext( &fft, data ) )
+      {
+         float res = magnitude( fftGetResult( &fft, 0 ) );
+         printResult( res );
+
+         if ( ! isNear( res, 100.0 ) )
+         {
+            uartLogError("FAILED : result out of range");
+            halt();
+         }
+
+         break;
+      }
+   }
+
+#if ! FFT_SLIDING_DFT
+   uartLogInfo("TEST : fftInit mixed parity");
+
+   // Neighbouring bins take different branches in the first pass
+   {
+      static const uint16_t mixed[] = { centerFreq, centerFreq + FFT_BIN_SIZE };
+
+      if ( fftInit( &fft, FFT_M, mixed, 2 ) )
+      {
+         uartLogError("FAILED : bins of different parity accepted");
+         halt();
+      }
+   }
+#endif
+
+#if FFT_MAX_BINS > 1
+   uartLogInfo("TEST : harmonics");
+
+   // Fundamental and 3rd harmonic at half the amplitude, in the same pass
+   {
+      static const uint16_t harmonics[] = { centerFreq, 3 * centerFreq };
+
+      if ( ! fftInit( &fft, FFT_M, harmonics, 2 ) )
       {
-         float res = fftGetResult();
+         uartLogError("FAILED : odd harmonic rejected");
+         halt();
+      }
+   }
+
+   for ( i=0; ; ++i )
+   {
+      data = (int16_t)(
+         100.0 * sin( 2.0 * M_PI * (float)(i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ) +
+         50.0 * sin( 2.0 * M_PI * (float)(3*i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ));
+
+      if ( fftNext( &fft, data ) )
+      {
+         float res = magnitude( fftGetResult( &fft, 0 ) );
+         float res3 = magnitude( fftGetResult( &fft, 1 ) );
          printResult( res );
+         printResult( res3 );
 
-         if ( res < 99.0 || res > 101.0 )
+         if ( ! isNear( res, 100.0 ) || ! isNear( res3, 50.0 ) )
          {
             uartLogError("FAILED : result out of range");
             halt();
@@ -220,6 +398,165 @@ int main(void)
          break;
       }
    }
+#endif
+
+   uartLogInfo("TEST : two instances");
+
+   // A second context measures the 2nd harmonic of the same signal
+   {
+      static fft_t fft2;
+      static const uint16_t harmonicFreq = 2 * centerFreq;
+      bool done = false, done2 = false;
+
+      fftInit( &fft, FFT_M, &centerFreq, 1 );
+      fftInit( &fft2, FFT_M, &harmonicFreq, 1 );
+
+      for ( i=0; !done || !done2; ++i )
+      {
+         data = (int16_t)(
+            100.0 * sin( 2.0 * M_PI * (float)(i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ) +
+            30.0 * sin( 2.0 * M_PI * (float)(i*harmonicFreq) / (float)ADC_SAMPLE_FREQUENCY ));
+
+         if ( fftNext( &fft, data ) && !done )
+         {
+            float res = magnitude( fftGetResult( &fft, 0 ) );
+            printResult( res );
+
+            if ( ! isNear( res, 100.0 ) )
+            {
+               uartLogError("FAILED : result out of range");
+               halt();
+            }
+
+            done = true;
+         }
+
+         if ( fftNext( &fft2, data ) && !done2 )
+         {
+            float res = magnitude( fftGetResult( &fft2, 0 ) );
+            printResult( res );
+
+            if ( ! isNear( res, 30.0 ) )
+            {
+               uartLogError("FAILED : result out of range");
+               halt();
+            }
+
+            done2 = true;
+         }
+      }
+   }
+
+   fftReset( &fft );
+
+   uartLogInfo("TEST : result rate");
+
+   // Once running, the results must come at FFT_RESULT_FREQUENCY
+   {
+      size_t last = 0;
+      uint8_t count = 0;
+
+      for ( i=0; count < 4; ++i )
+      {
+         data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*centerFreq) / (float)ADC_SAMPLE_FREQUENCY ));
+
+         if ( fftNext( &fft, data ) )
+         {
+            if ( count > 0 && i - last != ADC_SAMPLE_FREQUENCY / FFT_RESULT_FREQUENCY )
+            {
+               uartLogError("FAILED : results not evenly spaced");
+               halt();
+            }
+
+            last = i;
+            ++count;
+         }
+      }
+   }
+
+#if FFT_MIN_M < FFT_M
+   uartLogInfo("TEST : window size");
+
+   // Every window down to 2^FFT_MIN_M points measures the same amplitude
+   //  of a sine on a bin, at the rate of the window. 40Hz is on a bin of
+   //  all the windows from 8 points.
+   {
+      static const uint16_t windowFreq = 40;
+      uint8_t m;
+
+      if ( fftInit( &fft, FFT_M + 1, &windowFreq, 1 ) )
+      {
+         uartLogError("FAILED : window larger than the buffers accepted");
+         halt();
+      }
+
+      for ( m=FFT_MIN_M; m<=FFT_M; ++m )
+      {
+         size_t last = 0;
+         uint8_t count = 0;
+
+         if ( ! fftInit( &fft, m, &windowFreq, 1 ) )
+         {
+            uartLogError("FAILED : window size rejected");
+            halt();
+         }
+
+         for ( i=0; count < 4; ++i )
+         {
+            data = (int16_t)( 100.0 * sin( 2.0 * M_PI * (float)(i*windowFreq) / (float)ADC_SAMPLE_FREQUENCY ));
+
+            if ( fftNext( &fft, data ) )
+            {
+               float res = magnitude( fftGetResult( &fft, 0 ) );
+               printResult( res );
+
+               if ( ! isNear( res, 100.0 ) )
+               {
+                  uartLogError("FAILED : result out of range");
+                  halt();
+               }
+
+               if ( count > 0 &&
+                    i - last != ADC_SAMPLE_FREQUENCY / FFT_RESULT_FREQUENCY_OF(m) )
+               {
+                  uartLogError("FAILED : results not evenly spaced");
+                  halt();
+               }
+
+               last = i;
+               ++count;
+            }
+         }
+      }
+
+      fftInit( &fft, FFT_M, &centerFreq, 1 );
+   }
+#endif
+
+#ifdef AVR
+   fftReset( &fft );
+
+   uartLogInfo("TEST : timing");
+
+   {
+      uint16_t average;
+      uint16_t worst = timeWorstCase( centerFreq, &average );
+
+      uartPrint( PSTR(".+ fftNext worst case (cycles): ") );
+      uartPrintNumber( worst, 0 );
+      uartSendChar('\n');
+
+      uartPrint( PSTR(".+ fftNext average per sample (cycles): ") );
+      uartPrintNumber( average, 0 );
+      uartSendChar('\n');
+
+      if ( worst > SYS_CLOCK / ADC_SAMPLE_FREQUENCY )
+      {
+         uartLogError("FAILED : fftNext takes longer than a sample period");
+         halt();
+      }
+   }
+#endif
 
    uartLogInfo("PASS");
 
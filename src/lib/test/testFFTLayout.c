@@ -0,0 +1,224 @@
+/**
+ *@ingroup fft
+ *@defgroup fft_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Host test of the compact layout of the fft (FFT_COMPACT) against the
+ *  standard layout.
+ * Both layouts are fed the same 12-bit random samples for every bin of the
+ *  fft, or every pair of bins of the same parity with FFT_MAX_BINS, and
+ *  must yield the same results at the same time within the rounding of
+ *  the twiddle factors.
+ * This test only checks the size of fft it is built for, and all the
+ *  smaller windows from 2^FFT_MIN_M points. fftLayoutTest.sh builds and
+ *  runs it for all the sizes from 8 to 256 points, in floating and fixed
+ *  point.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#ifdef AVR
+#  error "PC simulator only"
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include "wgx.h"
+#include "fft.h"
+
+/** Number of windows compared for each set of bins */
+#define WINDOWS 4
+
+/**
+ * Largest difference allowed between the magnitudes of both layouts.
+ * The compact layout applies the factor of the first pass as a product
+ *  of factors in the second pass, which only changes the rounding. The
+ *  parts of the bins may then round differently to the result unit.
+ */
+#define TOLERANCE (2.0 / (1 << FFT_RESULT_FRACTION_BITS))
+
+// Compact layout built by fftCompact.c
+bool  compactInit(uint8_t m, const uint16_t *centerFrequencies, uint8_t count);
+void  compactReset(void);
+bool  compactNext(int16_t sample);
+uint32_t compactGetResult(uint8_t index);
+extern const size_t compactSize;
+
+/** Context of the fft with the standard layout */
+static fft_t fft;
+
+/** Largest difference seen between both layouts */
+static float worst;
+
+/** Size of the window under test in 2^m points */
+static uint8_t m;
+
+/**
+ * Convert a result of the fft into a magnitude in sample units
+ *
+ * @param result Squared magnitude, or magnitude, given by fftGetResult
+ * @return The magnitude
+ */
+static float magnitude( uint32_t result )
+{
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   return sqrt( (float)result ) / (1 << FFT_RESULT_FRACTION_BITS);
+#else
+   return (float)result / (1 << FFT_RESULT_FRACTION_BITS);
+#endif
+}
+
+/**
+ * Lowest whole frequency falling in a bin of the window under test
+ *
+ * @param k Bin number
+ * @return The frequency in Hz
+ */
+static uint16_t frequencyOf( uint16_t k )
+   { return ((uint32_t)k * ADC_SAMPLE_FREQUENCY + (1 << m) - 1) >> m; }
+
+/**
+ * Bin of the window under test a frequency falls in, like fftInit
+ *
+ * @param frequency Frequency in Hz
+ * @return The bin number
+ */
+static unsigned binOf( uint16_t frequency )
+   { return ((uint32_t)frequency << m) / ADC_SAMPLE_FREQUENCY; }
+
+/** Seed of the random samples */
+static uint32_t seed = 1;
+
+/** @return A random 12-bit sample */
+static int16_t randomSample(void)
+{
+   seed = seed * 1103515245 + 12345;
+
+   return (int16_t)((seed >> 16) & 0xFFF) - 2048;
+}
+
+/**
+ * Run both layouts side by side over a few windows of random samples, with
+ *  the window under test.
+ *
+ * @param frequencies Frequencies of the bins to compute
+ * @param count       Number of bins
+ * @return true if both layouts give the same results
+ */
+static bool compare(const uint16_t *frequencies, uint8_t count)
+{
+   size_t i;
+   uint8_t b;
+
+   fftInit( &fft, m, frequencies, count );
+   compactInit( m, frequencies, count );
+
+   for ( i=0; i<(WINDOWS << m); ++i )
+   {
+      int16_t sample = randomSample();
+      bool ready = fftNext( &fft, sample );
+
+      if ( compactNext( sample ) != ready )
+      {
+         printf(".# FAILED : results at different times for bin %u\n",
+            binOf(frequencies[0]));
+         return false;
+      }
+
+      for ( b=0; ready && b<count; ++b )
+      {
+         float expected = magnitude( fftGetResult(&fft, b) );
+         float result = magnitude( compactGetResult(b) );
+         float diff = fabs( expected - result );
+
+         if ( diff > worst )
+         {
+            worst = diff;
+         }
+
+         if ( diff > TOLERANCE )
+         {
+            printf(".# FAILED : bin %u gives %f instead of %f\n",
+               binOf(frequencies[b]), result, expected);
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+/**
+ * Compare both layouts for all the bins of the window under test
+ *
+ * @return true if both layouts give the same results
+ */
+static bool compareWindow(void)
+{
+   uint16_t frequencies[FFT_MAX_BINS];
+   uint16_t n = 1 << m;
+   uint16_t k;
+
+   printf(".+ TEST : %d point fft, %s point, %d bin(s)\n", n,
+      FFT_FIXED_POINT ? "fixed" : "floating", FFT_MAX_BINS);
+
+   // Every bin on its own
+   for ( k=0; k<n; ++k )
+   {
+      frequencies[0] = frequencyOf( k );
+
+      if ( ! compare( frequencies, 1 ) )
+      {
+         return false;
+      }
+   }
+
+#if FFT_MAX_BINS > 1
+   // Every pair of bins of the same parity, followed by odd harmonics
+   {
+      uint16_t l;
+      uint8_t b;
+
+      for ( k=0; k<n; ++k )
+      {
+         for ( l=k%2; l<n; l+=2 )
+         {
+            frequencies[0] = frequencyOf( k );
+            frequencies[1] = frequencyOf( l );
+
+            for ( b=2; b<FFT_MAX_BINS; ++b )
+            {
+               frequencies[b] = frequencyOf( ((2*b - 1) * k) % n );
+            }
+
+            if ( ! compare( frequencies, FFT_MAX_BINS ) )
+            {
+               return false;
+            }
+         }
+      }
+   }
+#endif
+
+   return true;
+}
+
+int main(void)
+{
+   for ( m=FFT_MIN_M; m<=FFT_M; ++m )
+   {
+      if ( ! compareWindow() )
+      {
+         return 1;
+      }
+   }
+
+   printf(".+ Largest difference: %f\n", worst);
+   printf(".+ Context: %u bytes, compact: %u bytes\n",
+      (unsigned)sizeof(fft), (unsigned)compactSize);
+   printf(".+ PASS\n");
+
+   return 0;
+}
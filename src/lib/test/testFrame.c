@@ -0,0 +1,122 @@
+/**
+ *@ingroup frame
+ *@defgroup frame_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Unit test for the binary frame library.
+ * Payloads are framed and compared with the frames encoded by hand, one
+ *  with zeros in the payload, one with a zero in its CRC. A long payload
+ *  is checked to have no zero but its delimiter.
+ * This unit test is self testing.
+ * The uart is used to displat the tests results.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+#include <string.h>
+#include "wgx.h"
+#include "frame.h"
+#include "uart.h"
+
+/** Size of the long payload */
+#define LONG_PAYLOAD_SIZE 200
+
+/** Payload with zeros, the last two in a row */
+static const uint8_t payloadWithZeros[] = { 0x12, 0x00, 0x34, 0x00, 0x00, 0x56 };
+
+/** Frame of payloadWithZeros, its CRC being 0x4B3B */
+static const uint8_t frameWithZeros[] =
+   { 0x02, 0x12, 0x02, 0x34, 0x01, 0x04, 0x56, 0x3B, 0x4B, 0x00 };
+
+/** Payload whose CRC is 0x6000 */
+static const uint8_t payloadWithZeroCrc[] = { 0x01, 0x5D };
+
+/** Frame of payloadWithZeroCrc */
+static const uint8_t frameWithZeroCrc[] = { 0x03, 0x01, 0x5D, 0x02, 0x60, 0x00 };
+
+/** Buffer of the frames */
+static uint8_t frame[FRAME_SIZE_OF(LONG_PAYLOAD_SIZE)];
+
+static void halt(void)
+{
+   set_sleep_mode(0);
+
+   for (;;)
+   {
+      sleep_mode();
+   }
+}
+
+/**
+ * Frame a payload and compare with the expected frame
+ *
+ * @param payload  Payload to frame
+ * @param size     Size of the payload
+ * @param expected Frame expected, of FRAME_SIZE_OF(size)
+ * @return true if the frame is the one expected
+ */
+static bool isFramed( const uint8_t *payload, uint8_t size, const uint8_t *expected )
+{
+   return frameEncode( frame, payload, size ) == FRAME_SIZE_OF(size) &&
+      memcmp( frame, expected, FRAME_SIZE_OF(size) ) == 0;
+}
+
+int main(void)
+{
+   uint8_t payload[LONG_PAYLOAD_SIZE];
+   uint16_t crc = 0xFFFF;
+   uint8_t n;
+
+   uartInit(NULL);
+
+   uartLogInfo("TEST : crc");
+
+   // The check value of CRC-16/MCRF4XX
+   for ( n=0; n<9; ++n )
+   {
+      crc = _crc_ccitt_update( crc, '1' + n );
+   }
+
+   if ( crc != 0x6F91 )
+   {
+      uartLogError("FAILED : wrong crc");
+      halt();
+   }
+
+   uartLogInfo("TEST : zeros");
+
+   if ( ! isFramed( payloadWithZeros, sizeof(payloadWithZeros), frameWithZeros ) )
+   {
+      uartLogError("FAILED : zeros of the payload not stuffed");
+      halt();
+   }
+
+   if ( ! isFramed( payloadWithZeroCrc, sizeof(payloadWithZeroCrc), frameWithZeroCrc ) )
+   {
+      uartLogError("FAILED : zero of the crc not stuffed");
+      halt();
+   }
+
+   uartLogInfo("TEST : long payload");
+
+   // A zero every 64 bytes
+   for ( n=0; n<LONG_PAYLOAD_SIZE; ++n )
+   {
+      payload[n] = (n % 64) * 3;
+   }
+
+   if ( frameEncode( frame, payload, LONG_PAYLOAD_SIZE ) != sizeof(frame) ||
+        frame[sizeof(frame) - 1] != 0 ||
+        memchr( frame, 0, sizeof(frame) - 1 ) != NULL )
+   {
+      uartLogError("FAILED : long payload not delimited");
+      halt();
+   }
+
+   uartLogInfo("PASS");
+
+   halt();
+
+   return 0;
+}
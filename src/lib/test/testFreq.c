@@ -0,0 +1,146 @@
+/**
+ *@ingroup freq
+ *@defgroup freq_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Unit test for the mains frequency tracking library.
+ * A sine is sampled at the rate set by the tracking and injected into the
+ *  fft. The frequency measured and the centre of the bin must converge to
+ *  the frequency of the sine.
+ * This unit test is self testing.
+ * The uart is used to displat the tests results.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+#include <math.h>
+#include <stdlib.h>
+#include "wgx.h"
+#include "fft.h"
+#include "freq.h"
+#include "adc.h"
+#include "uart.h"
+
+/** Frequency measured by the fft in Hz */
+#define CENTER_FREQUENCY 50
+
+/**
+ * Number of windows of samples to let the tracking settle. The sliding
+ *  DFT gives a result with every sample, so the samples are counted
+ */
+#define WINDOWS 200
+
+/** Largest error allowed on the frequency in 1/100th of Hz */
+#define TOLERANCE 5
+
+/** Context of the fft feeding the tracking */
+static fft_t fft;
+
+static void halt(void)
+{
+   set_sleep_mode(0);
+
+   for (;;)
+   {
+      sleep_mode();
+   }
+}
+
+/**
+ * Sample a sine at the rate set by the tracking for WINDOWS windows,
+ *  giving each result of the fft to the tracking.
+ *
+ * @param frequency Frequency of the sine in 1/100th of Hz
+ * @param amplitude Amplitude of the sine in sample units
+ */
+static void track( uint16_t frequency, float amplitude )
+{
+   static const uint16_t centerFreq = CENTER_FREQUENCY;
+   float phase = 0.0;
+   uint16_t samples;
+
+   adcSetSampleFrequency( ADC_SAMPLE_FREQUENCY * 100U );
+   fftInit( &fft, FFT_M, &centerFreq, 1 );
+   freqInit( centerFreq, FFT_M );
+
+   for ( samples=0; samples<((uint16_t)WINDOWS << FFT_M); ++samples )
+   {
+      int16_t data = (int16_t)( amplitude * sin( 2.0 * M_PI * phase ) );
+
+      phase += (float)frequency / adcGetSampleFrequency();
+      phase -= floor( phase );
+
+      if ( fftNext( &fft, data ) )
+      {
+         freqNext( fftGetComplexResult( &fft, 0 ) );
+      }
+   }
+}
+
+/**
+ * Check the frequency tracked, and that the bin is centred on it
+ *
+ * @param frequency Frequency expected in 1/100th of Hz
+ * @return true if both are within TOLERANCE
+ */
+static bool isTracking( uint16_t frequency )
+{
+   uint16_t k = (CENTER_FREQUENCY << FFT_M) / ADC_SAMPLE_FREQUENCY;
+   uint16_t centre = (uint16_t)(
+      ((uint32_t)adcGetSampleFrequency() * k) >> FFT_M );
+
+   return abs( (int16_t)(freqGet() - frequency) ) <= TOLERANCE &&
+      abs( (int16_t)(centre - frequency) ) <= TOLERANCE;
+}
+
+int main(void)
+{
+   // Within +/-2.5Hz, the range of the phase over whole windows of 64 points
+   static const uint16_t frequencies[] = { 5000, 4780, 4910, 5080, 5220 };
+   uint8_t n;
+
+   uartInit(NULL);
+
+   uartLogInfo("TEST : no signal");
+
+   // No phase is measured without a signal
+   track( 5000, 0.0 );
+
+   if ( freqGet() != 0 || adcGetSampleFrequency() != ADC_SAMPLE_FREQUENCY * 100U )
+   {
+      uartLogError("FAILED : frequency measured without a signal");
+      halt();
+   }
+
+   uartLogInfo("TEST : tracking");
+
+   for ( n=0; n<sizeof(frequencies)/sizeof(frequencies[0]); ++n )
+   {
+      track( frequencies[n], 200.0 );
+
+      if ( ! isTracking( frequencies[n] ) )
+      {
+         uartLogError("FAILED : frequency not tracked");
+         halt();
+      }
+   }
+
+   uartLogInfo("TEST : out of range");
+
+   // The sampling rate is not trimmed beyond FREQ_RANGE_SHIFT
+   track( 5500, 200.0 );
+
+   if ( abs( (int16_t)(adcGetSampleFrequency() - ADC_SAMPLE_FREQUENCY * 100U) ) >
+        (ADC_SAMPLE_FREQUENCY * 100U >> FREQ_RANGE_SHIFT) )
+   {
+      uartLogError("FAILED : sampling rate out of range");
+      halt();
+   }
+
+   uartLogInfo("PASS");
+
+   halt();
+
+   return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ *@ingroup rms
+ *@defgroup rms_test Unit test
+ *@{
+ *@file
+ *****************************************************************************
+ * Unit test for the true RMS library.
+ * Sines with an offset, and with harmonics, are given to the fft and to the
+ *  true RMS side by side. The true RMS must match the bin of a pure sine,
+ *  ignore the offset, and add up the harmonics.
+ * This unit test is self testing.
+ * The uart is used to displat the tests results.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+#include <math.h>
+#include "wgx.h"
+#include "fft.h"
+#include "rms.h"
+#include "adc.h"
+#include "uart.h"
+
+/** Frequency measured by the fft in Hz */
+#define CENTER_FREQUENCY 50
+
+/** Number of windows of samples measured for each signal */
+#define WINDOWS 4
+
+/** Amplitude of a full scale sine, in sample units */
+#define FULL_SCALE ((1 << (ADC_SAMPLE_BITS - 1)) - 1)
+
+/** Largest error allowed on the amplitude, in 1/100th */
+#define TOLERANCE 2
+
+/** Context of the fft */
+static fft_t fft;
+
+/** Context of the true RMS */
+static rms_t rms;
+
+/** Last result of the fft */
+static uint32_t fftResult;
+
+static void halt(void)
+{
+   set_sleep_mode(0);
+
+   for (;;)
+   {
+      sleep_mode();
+   }
+}
+
+/**
+ * Convert a result into an amplitude in sample units
+ *
+ * @param result Squared amplitude, or amplitude, as given by fftGetResult
+ * @return The amplitude
+ */
+static float amplitudeOf( uint32_t result )
+{
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   return sqrt( (float)result ) / (1 << FFT_RESULT_FRACTION_BITS);
+#else
+   return (float)result / (1 << FFT_RESULT_FRACTION_BITS);
+#endif
+}
+
+/**
+ * Give a signal to the fft and the true RMS for WINDOWS windows
+ *
+ * @param offset    Offset of the signal in sample units
+ * @param amplitude Amplitude of the fundamental
+ * @param harmonic  Amplitude of the 3rd harmonic
+ * @return true if the true RMS has a result with each result of the fft
+ */
+static bool measure( float offset, float amplitude, float harmonic )
+{
+   static const uint16_t centerFreq = CENTER_FREQUENCY;
+   uint16_t n;
+
+   fftInit( &fft, FFT_M, &centerFreq, 1 );
+   rmsInit( &rms, FFT_M );
+
+   for ( n=0; n<((uint16_t)WINDOWS << FFT_M); ++n )
+   {
+      float phase = 2.0 * M_PI * CENTER_FREQUENCY * n / ADC_SAMPLE_FREQUENCY;
+      int16_t data = (int16_t)floor( offset + amplitude * sin( phase ) +
+         harmonic * sin( 3.0 * phase ) + 0.5 );
+      bool isReady = rmsNext( &rms, data );
+
+      if ( fftNext( &fft, data ) )
+      {
+         fftResult = fftGetResult( &fft, 0 );
+
+#if ! FFT_SLIDING_DFT
+         // The windows end with those of the ffts. The progressive fft
+         //  gives its result a window later, once its second pass is done
+         if ( ! isReady )
+         {
+            return false;
+         }
+#endif
+      }
+   }
+
+   return true;
+}
+
+/**
+ * Check an amplitude is within TOLERANCE
+ *
+ * @param result   Result to check, as given by fftGetResult
+ * @param expected Amplitude expected
+ * @return true if close enough
+ */
+static bool isClose( uint32_t result, float expected )
+{
+   return fabs( amplitudeOf( result ) - expected ) <=
+      expected * TOLERANCE / 100 + 1.0 / (1 << FFT_RESULT_FRACTION_BITS);
+}
+
+int main(void)
+{
+   uartInit(NULL);
+
+   uartLogInfo("TEST : pure sine");
+
+   // The true RMS of a sine gives the amplitude of its bin
+   if ( ! measure( 0.0, 500.0, 0.0 ) )
+   {
+      uartLogError("FAILED : windows not aligned with the fft");
+      halt();
+   }
+
+   if ( ! isClose( rmsGetResult(&rms), amplitudeOf( fftResult ) ) )
+   {
+      uartLogError("FAILED : true RMS differs from the fft");
+      halt();
+   }
+
+   uartLogInfo("TEST : offset");
+
+   // The offset is removed
+   measure( 700.0, 500.0, 0.0 );
+
+   if ( ! isClose( rmsGetResult(&rms), 500.0 ) )
+   {
+      uartLogError("FAILED : offset not removed");
+      halt();
+   }
+
+   measure( -700.0, 0.0, 0.0 );
+
+   if ( amplitudeOf( rmsGetResult(&rms) ) > 1.0 )
+   {
+      uartLogError("FAILED : offset measured");
+      halt();
+   }
+
+   uartLogInfo("TEST : harmonics");
+
+   // The harmonics, missed by the bin, add up as the root of the squares
+   measure( 100.0, 500.0, 300.0 );
+
+   if ( ! isClose( rmsGetResult(&rms), sqrt( 500.0 * 500.0 + 300.0 * 300.0 ) ) ||
+        ! isClose( fftResult, 500.0 ) )
+   {
+      uartLogError("FAILED : harmonics not measured");
+      halt();
+   }
+
+   uartLogInfo("TEST : full scale");
+
+   // The sums do not overflow at full scale
+   measure( 0.0, FULL_SCALE, 0.0 );
+
+   if ( ! isClose( rmsGetResult(&rms), FULL_SCALE ) )
+   {
+      uartLogError("FAILED : full scale overflows");
+      halt();
+   }
+
+   uartLogInfo("PASS");
+
+   halt();
+
+   return 0;
+}
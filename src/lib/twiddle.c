@@ -10,8 +10,11 @@
  *  stored in flash memory.
  *  The table selected depends on the size of the FFT which must be defined
  *   in the pre-processor variable FFT_N. If not specified, the FFT is 64pt.
- * The complex type must be defined as follow:
- * typedef struct { float real; float imag; } complex_t;
+ *  If FFT_FIXED_POINT is set to 1, the coefficients are given in Q15.
+ * The twiddle type must be defined as follow:
+ * typedef struct { float real; float imag; } twiddle_t;
+ *  or in fixed point:
+ * typedef struct { int16_t real; int16_t imag; } twiddle_t;
  *****************************************************************************
  */
 
@@ -20,7 +23,275 @@
 #  define FFT_N 64
 #endif
 
-static complex_t fftTwiddle[] PROGMEM = {
+#if FFT_FIXED_POINT
+static const twiddle_t fftTwiddle[] PROGMEM = {
+#  if ( FFT_N == 8 )
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+#  endif /* FFT_N == 8 */
+#  if ( FFT_N == 16 )
+   {  32767,      0 },
+   {  30274,  12540 },
+   {  23170,  23170 },
+   {  12540,  30274 },
+   {      0,  32767 },
+   { -12540,  30274 },
+   { -23170,  23170 },
+   { -30274,  12540 }
+#  endif /* FFT_N == 16 */
+#  if ( FFT_N == 32 )
+   {  32767,      0 },
+   {  32138,   6393 },
+   {  30274,  12540 },
+   {  27246,  18205 },
+   {  23170,  23170 },
+   {  18205,  27246 },
+   {  12540,  30274 },
+   {   6393,  32138 },
+   {      0,  32767 },
+   {  -6393,  32138 },
+   { -12540,  30274 },
+   { -18205,  27246 },
+   { -23170,  23170 },
+   { -27246,  18205 },
+   { -30274,  12540 },
+   { -32138,   6393 }
+#  endif /* FFT_N == 32 */
+#  if ( FFT_N == 64 )
+   {  32767,      0 },
+   {  32610,   3212 },
+   {  32138,   6393 },
+   {  31357,   9512 },
+   {  30274,  12540 },
+   {  28899,  15447 },
+   {  27246,  18205 },
+   {  25330,  20788 },
+   {  23170,  23170 },
+   {  20788,  25330 },
+   {  18205,  27246 },
+   {  15447,  28899 },
+   {  12540,  30274 },
+   {   9512,  31357 },
+   {   6393,  32138 },
+   {   3212,  32610 },
+   {      0,  32767 },
+   {  -3212,  32610 },
+   {  -6393,  32138 },
+   {  -9512,  31357 },
+   { -12540,  30274 },
+   { -15447,  28899 },
+   { -18205,  27246 },
+   { -20788,  25330 },
+   { -23170,  23170 },
+   { -25330,  20788 },
+   { -27246,  18205 },
+   { -28899,  15447 },
+   { -30274,  12540 },
+   { -31357,   9512 },
+   { -32138,   6393 },
+   { -32610,   3212 }
+#  endif /* FFT_N == 64 */
+#  if ( FFT_N == 128 )
+   {  32767,      0 },
+   {  32729,   1608 },
+   {  32610,   3212 },
+   {  32413,   4808 },
+   {  32138,   6393 },
+   {  31786,   7962 },
+   {  31357,   9512 },
+   {  30853,  11039 },
+   {  30274,  12540 },
+   {  29622,  14010 },
+   {  28899,  15447 },
+   {  28106,  16846 },
+   {  27246,  18205 },
+   {  26320,  19520 },
+   {  25330,  20788 },
+   {  24279,  22006 },
+   {  23170,  23170 },
+   {  22006,  24279 },
+   {  20788,  25330 },
+   {  19520,  26320 },
+   {  18205,  27246 },
+   {  16846,  28106 },
+   {  15447,  28899 },
+   {  14010,  29622 },
+   {  12540,  30274 },
+   {  11039,  30853 },
+   {   9512,  31357 },
+   {   7962,  31786 },
+   {   6393,  32138 },
+   {   4808,  32413 },
+   {   3212,  32610 },
+   {   1608,  32729 },
+   {      0,  32767 },
+   {  -1608,  32729 },
+   {  -3212,  32610 },
+   {  -4808,  32413 },
+   {  -6393,  32138 },
+   {  -7962,  31786 },
+   {  -9512,  31357 },
+   { -11039,  30853 },
+   { -12540,  30274 },
+   { -14010,  29622 },
+   { -15447,  28899 },
+   { -16846,  28106 },
+   { -18205,  27246 },
+   { -19520,  26320 },
+   { -20788,  25330 },
+   { -22006,  24279 },
+   { -23170,  23170 },
+   { -24279,  22006 },
+   { -25330,  20788 },
+   { -26320,  19520 },
+   { -27246,  18205 },
+   { -28106,  16846 },
+   { -28899,  15447 },
+   { -29622,  14010 },
+   { -30274,  12540 },
+   { -30853,  11039 },
+   { -31357,   9512 },
+   { -31786,   7962 },
+   { -32138,   6393 },
+   { -32413,   4808 },
+   { -32610,   3212 },
+   { -32729,   1608 }
+#  endif /* FFT_N == 128 */
+#  if ( FFT_N == 256 )
+   {  32767,      0 },
+   {  32758,    804 },
+   {  32729,   1608 },
+   {  32679,   2411 },
+   {  32610,   3212 },
+   {  32522,   4011 },
+   {  32413,   4808 },
+   {  32286,   5602 },
+   {  32138,   6393 },
+   {  31972,   7180 },
+   {  31786,   7962 },
+   {  31581,   8740 },
+   {  31357,   9512 },
+   {  31114,  10279 },
+   {  30853,  11039 },
+   {  30572,  11793 },
+   {  30274,  12540 },
+   {  29957,  13279 },
+   {  29622,  14010 },
+   {  29269,  14733 },
+   {  28899,  15447 },
+   {  28511,  16151 },
+   {  28106,  16846 },
+   {  27684,  17531 },
+   {  27246,  18205 },
+   {  26791,  18868 },
+   {  26320,  19520 },
+   {  25833,  20160 },
+   {  25330,  20788 },
+   {  24812,  21403 },
+   {  24279,  22006 },
+   {  23732,  22595 },
+   {  23170,  23170 },
+   {  22595,  23732 },
+   {  22006,  24279 },
+   {  21403,  24812 },
+   {  20788,  25330 },
+   {  20160,  25833 },
+   {  19520,  26320 },
+   {  18868,  26791 },
+   {  18205,  27246 },
+   {  17531,  27684 },
+   {  16846,  28106 },
+   {  16151,  28511 },
+   {  15447,  28899 },
+   {  14733,  29269 },
+   {  14010,  29622 },
+   {  13279,  29957 },
+   {  12540,  30274 },
+   {  11793,  30572 },
+   {  11039,  30853 },
+   {  10279,  31114 },
+   {   9512,  31357 },
+   {   8740,  31581 },
+   {   7962,  31786 },
+   {   7180,  31972 },
+   {   6393,  32138 },
+   {   5602,  32286 },
+   {   4808,  32413 },
+   {   4011,  32522 },
+   {   3212,  32610 },
+   {   2411,  32679 },
+   {   1608,  32729 },
+   {    804,  32758 },
+   {      0,  32767 },
+   {   -804,  32758 },
+   {  -1608,  32729 },
+   {  -2411,  32679 },
+   {  -3212,  32610 },
+   {  -4011,  32522 },
+   {  -4808,  32413 },
+   {  -5602,  32286 },
+   {  -6393,  32138 },
+   {  -7180,  31972 },
+   {  -7962,  31786 },
+   {  -8740,  31581 },
+   {  -9512,  31357 },
+   { -10279,  31114 },
+   { -11039,  30853 },
+   { -11793,  30572 },
+   { -12540,  30274 },
+   { -13279,  29957 },
+   { -14010,  29622 },
+   { -14733,  29269 },
+   { -15447,  28899 },
+   { -16151,  28511 },
+   { -16846,  28106 },
+   { -17531,  27684 },
+   { -18205,  27246 },
+   { -18868,  26791 },
+   { -19520,  26320 },
+   { -20160,  25833 },
+   { -20788,  25330 },
+   { -21403,  24812 },
+   { -22006,  24279 },
+   { -22595,  23732 },
+   { -23170,  23170 },
+   { -23732,  22595 },
+   { -24279,  22006 },
+   { -24812,  21403 },
+   { -25330,  20788 },
+   { -25833,  20160 },
+   { -26320,  19520 },
+   { -26791,  18868 },
+   { -27246,  18205 },
+   { -27684,  17531 },
+   { -28106,  16846 },
+   { -28511,  16151 },
+   { -28899,  15447 },
+   { -29269,  14733 },
+   { -29622,  14010 },
+   { -29957,  13279 },
+   { -30274,  12540 },
+   { -30572,  11793 },
+   { -30853,  11039 },
+   { -31114,  10279 },
+   { -31357,   9512 },
+   { -31581,   8740 },
+   { -31786,   7962 },
+   { -31972,   7180 },
+   { -32138,   6393 },
+   { -32286,   5602 },
+   { -32413,   4808 },
+   { -32522,   4011 },
+   { -32610,   3212 },
+   { -32679,   2411 },
+   { -32729,   1608 },
+   { -32758,    804 }
+#  endif /* FFT_N == 256 */
+};
+#else
+static const twiddle_t fftTwiddle[] PROGMEM = {
 #  if ( FFT_N == 8 )
    {  1.000000,  0.000000 },
    {  0.707107,  0.707107 },
@@ -286,3 +557,4 @@ static complex_t fftTwiddle[] PROGMEM = {
    { -0.999699,  0.024541 }
 #  endif /* FFT_N == 256 */
 };
+#endif /* FFT_FIXED_POINT */
@@ -0,0 +1,455 @@
+/**
+ *@ingroup fft
+ *@{
+ *@file
+ *****************************************************************************
+ * Specifies the twiddle factors read along the path of some bins.
+ * This file was generated by wgen.py - DO NOT EDIT this file.
+ *
+ * Each table holds the factors read by the progressive fft to compute a
+ *  single bin, in the order of use. They are used in place of the full
+ *  table of twiddle.c when FFT_TWIDDLE_PATH is set.
+ *  If FFT_FIXED_POINT is set to 1, the coefficients are given in Q15.
+ * The index type must be defined as follow:
+ * typedef struct { fftIndex_t bin; const twiddle_t *table; } fftTwiddlePath_t;
+ *****************************************************************************
+ */
+
+#if ( FFT_N == 64 )
+#  if FFT_FIXED_POINT
+static const twiddle_t fftTwiddlePath8[] PROGMEM = {
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+static const twiddle_t fftTwiddlePath9[] PROGMEM = {
+   {  32767,      0 },
+   {  32610,   3212 },
+   {  32138,   6393 },
+   {  31357,   9512 },
+   {  30274,  12540 },
+   {  28899,  15447 },
+   {  27246,  18205 },
+   {  25330,  20788 },
+   {  23170,  23170 },
+   {  20788,  25330 },
+   {  18205,  27246 },
+   {  15447,  28899 },
+   {  12540,  30274 },
+   {   9512,  31357 },
+   {   6393,  32138 },
+   {   3212,  32610 },
+   {      0,  32767 },
+   {  -3212,  32610 },
+   {  -6393,  32138 },
+   {  -9512,  31357 },
+   { -12540,  30274 },
+   { -15447,  28899 },
+   { -18205,  27246 },
+   { -20788,  25330 },
+   { -23170,  23170 },
+   { -25330,  20788 },
+   { -27246,  18205 },
+   { -28899,  15447 },
+   { -30274,  12540 },
+   { -31357,   9512 },
+   { -32138,   6393 },
+   { -32610,   3212 },
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+static const twiddle_t fftTwiddlePath10[] PROGMEM = {
+   {  32767,      0 },
+   {  32138,   6393 },
+   {  30274,  12540 },
+   {  27246,  18205 },
+   {  23170,  23170 },
+   {  18205,  27246 },
+   {  12540,  30274 },
+   {   6393,  32138 },
+   {      0,  32767 },
+   {  -6393,  32138 },
+   { -12540,  30274 },
+   { -18205,  27246 },
+   { -23170,  23170 },
+   { -27246,  18205 },
+   { -30274,  12540 },
+   { -32138,   6393 },
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+static const twiddle_t fftTwiddlePath11[] PROGMEM = {
+   {  32767,      0 },
+   {  32610,   3212 },
+   {  32138,   6393 },
+   {  31357,   9512 },
+   {  30274,  12540 },
+   {  28899,  15447 },
+   {  27246,  18205 },
+   {  25330,  20788 },
+   {  23170,  23170 },
+   {  20788,  25330 },
+   {  18205,  27246 },
+   {  15447,  28899 },
+   {  12540,  30274 },
+   {   9512,  31357 },
+   {   6393,  32138 },
+   {   3212,  32610 },
+   {      0,  32767 },
+   {  -3212,  32610 },
+   {  -6393,  32138 },
+   {  -9512,  31357 },
+   { -12540,  30274 },
+   { -15447,  28899 },
+   { -18205,  27246 },
+   { -20788,  25330 },
+   { -23170,  23170 },
+   { -25330,  20788 },
+   { -27246,  18205 },
+   { -28899,  15447 },
+   { -30274,  12540 },
+   { -31357,   9512 },
+   { -32138,   6393 },
+   { -32610,   3212 },
+   {  32767,      0 },
+   {  32138,   6393 },
+   {  30274,  12540 },
+   {  27246,  18205 },
+   {  23170,  23170 },
+   {  18205,  27246 },
+   {  12540,  30274 },
+   {   6393,  32138 },
+   {      0,  32767 },
+   {  -6393,  32138 },
+   { -12540,  30274 },
+   { -18205,  27246 },
+   { -23170,  23170 },
+   { -27246,  18205 },
+   { -30274,  12540 },
+   { -32138,   6393 },
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+static const twiddle_t fftTwiddlePath12[] PROGMEM = {
+   {  32767,      0 },
+   {  30274,  12540 },
+   {  23170,  23170 },
+   {  12540,  30274 },
+   {      0,  32767 },
+   { -12540,  30274 },
+   { -23170,  23170 },
+   { -30274,  12540 },
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+static const twiddle_t fftTwiddlePath13[] PROGMEM = {
+   {  32767,      0 },
+   {  32610,   3212 },
+   {  32138,   6393 },
+   {  31357,   9512 },
+   {  30274,  12540 },
+   {  28899,  15447 },
+   {  27246,  18205 },
+   {  25330,  20788 },
+   {  23170,  23170 },
+   {  20788,  25330 },
+   {  18205,  27246 },
+   {  15447,  28899 },
+   {  12540,  30274 },
+   {   9512,  31357 },
+   {   6393,  32138 },
+   {   3212,  32610 },
+   {      0,  32767 },
+   {  -3212,  32610 },
+   {  -6393,  32138 },
+   {  -9512,  31357 },
+   { -12540,  30274 },
+   { -15447,  28899 },
+   { -18205,  27246 },
+   { -20788,  25330 },
+   { -23170,  23170 },
+   { -25330,  20788 },
+   { -27246,  18205 },
+   { -28899,  15447 },
+   { -30274,  12540 },
+   { -31357,   9512 },
+   { -32138,   6393 },
+   { -32610,   3212 },
+   {  32767,      0 },
+   {  30274,  12540 },
+   {  23170,  23170 },
+   {  12540,  30274 },
+   {      0,  32767 },
+   { -12540,  30274 },
+   { -23170,  23170 },
+   { -30274,  12540 },
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+static const twiddle_t fftTwiddlePath14[] PROGMEM = {
+   {  32767,      0 },
+   {  32138,   6393 },
+   {  30274,  12540 },
+   {  27246,  18205 },
+   {  23170,  23170 },
+   {  18205,  27246 },
+   {  12540,  30274 },
+   {   6393,  32138 },
+   {      0,  32767 },
+   {  -6393,  32138 },
+   { -12540,  30274 },
+   { -18205,  27246 },
+   { -23170,  23170 },
+   { -27246,  18205 },
+   { -30274,  12540 },
+   { -32138,   6393 },
+   {  32767,      0 },
+   {  30274,  12540 },
+   {  23170,  23170 },
+   {  12540,  30274 },
+   {      0,  32767 },
+   { -12540,  30274 },
+   { -23170,  23170 },
+   { -30274,  12540 },
+   {  32767,      0 },
+   {  23170,  23170 },
+   {      0,  32767 },
+   { -23170,  23170 }
+};
+#  endif /* FFT_FIXED_POINT */
+#  if ! FFT_FIXED_POINT
+static const twiddle_t fftTwiddlePath8[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+static const twiddle_t fftTwiddlePath9[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.995185,  0.098017 },
+   {  0.980785,  0.195090 },
+   {  0.956940,  0.290285 },
+   {  0.923880,  0.382683 },
+   {  0.881921,  0.471397 },
+   {  0.831470,  0.555570 },
+   {  0.773010,  0.634393 },
+   {  0.707107,  0.707107 },
+   {  0.634393,  0.773010 },
+   {  0.555570,  0.831470 },
+   {  0.471397,  0.881921 },
+   {  0.382683,  0.923880 },
+   {  0.290285,  0.956940 },
+   {  0.195090,  0.980785 },
+   {  0.098017,  0.995185 },
+   {  0.000000,  1.000000 },
+   { -0.098017,  0.995185 },
+   { -0.195090,  0.980785 },
+   { -0.290285,  0.956940 },
+   { -0.382683,  0.923880 },
+   { -0.471397,  0.881921 },
+   { -0.555570,  0.831470 },
+   { -0.634393,  0.773010 },
+   { -0.707107,  0.707107 },
+   { -0.773010,  0.634393 },
+   { -0.831470,  0.555570 },
+   { -0.881921,  0.471397 },
+   { -0.923880,  0.382683 },
+   { -0.956940,  0.290285 },
+   { -0.980785,  0.195090 },
+   { -0.995185,  0.098017 },
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+static const twiddle_t fftTwiddlePath10[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.980785,  0.195090 },
+   {  0.923880,  0.382683 },
+   {  0.831470,  0.555570 },
+   {  0.707107,  0.707107 },
+   {  0.555570,  0.831470 },
+   {  0.382683,  0.923880 },
+   {  0.195090,  0.980785 },
+   {  0.000000,  1.000000 },
+   { -0.195090,  0.980785 },
+   { -0.382683,  0.923880 },
+   { -0.555570,  0.831470 },
+   { -0.707107,  0.707107 },
+   { -0.831470,  0.555570 },
+   { -0.923880,  0.382683 },
+   { -0.980785,  0.195090 },
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+static const twiddle_t fftTwiddlePath11[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.995185,  0.098017 },
+   {  0.980785,  0.195090 },
+   {  0.956940,  0.290285 },
+   {  0.923880,  0.382683 },
+   {  0.881921,  0.471397 },
+   {  0.831470,  0.555570 },
+   {  0.773010,  0.634393 },
+   {  0.707107,  0.707107 },
+   {  0.634393,  0.773010 },
+   {  0.555570,  0.831470 },
+   {  0.471397,  0.881921 },
+   {  0.382683,  0.923880 },
+   {  0.290285,  0.956940 },
+   {  0.195090,  0.980785 },
+   {  0.098017,  0.995185 },
+   {  0.000000,  1.000000 },
+   { -0.098017,  0.995185 },
+   { -0.195090,  0.980785 },
+   { -0.290285,  0.956940 },
+   { -0.382683,  0.923880 },
+   { -0.471397,  0.881921 },
+   { -0.555570,  0.831470 },
+   { -0.634393,  0.773010 },
+   { -0.707107,  0.707107 },
+   { -0.773010,  0.634393 },
+   { -0.831470,  0.555570 },
+   { -0.881921,  0.471397 },
+   { -0.923880,  0.382683 },
+   { -0.956940,  0.290285 },
+   { -0.980785,  0.195090 },
+   { -0.995185,  0.098017 },
+   {  1.000000,  0.000000 },
+   {  0.980785,  0.195090 },
+   {  0.923880,  0.382683 },
+   {  0.831470,  0.555570 },
+   {  0.707107,  0.707107 },
+   {  0.555570,  0.831470 },
+   {  0.382683,  0.923880 },
+   {  0.195090,  0.980785 },
+   {  0.000000,  1.000000 },
+   { -0.195090,  0.980785 },
+   { -0.382683,  0.923880 },
+   { -0.555570,  0.831470 },
+   { -0.707107,  0.707107 },
+   { -0.831470,  0.555570 },
+   { -0.923880,  0.382683 },
+   { -0.980785,  0.195090 },
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+static const twiddle_t fftTwiddlePath12[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.923880,  0.382683 },
+   {  0.707107,  0.707107 },
+   {  0.382683,  0.923880 },
+   {  0.000000,  1.000000 },
+   { -0.382683,  0.923880 },
+   { -0.707107,  0.707107 },
+   { -0.923880,  0.382683 },
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+static const twiddle_t fftTwiddlePath13[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.995185,  0.098017 },
+   {  0.980785,  0.195090 },
+   {  0.956940,  0.290285 },
+   {  0.923880,  0.382683 },
+   {  0.881921,  0.471397 },
+   {  0.831470,  0.555570 },
+   {  0.773010,  0.634393 },
+   {  0.707107,  0.707107 },
+   {  0.634393,  0.773010 },
+   {  0.555570,  0.831470 },
+   {  0.471397,  0.881921 },
+   {  0.382683,  0.923880 },
+   {  0.290285,  0.956940 },
+   {  0.195090,  0.980785 },
+   {  0.098017,  0.995185 },
+   {  0.000000,  1.000000 },
+   { -0.098017,  0.995185 },
+   { -0.195090,  0.980785 },
+   { -0.290285,  0.956940 },
+   { -0.382683,  0.923880 },
+   { -0.471397,  0.881921 },
+   { -0.555570,  0.831470 },
+   { -0.634393,  0.773010 },
+   { -0.707107,  0.707107 },
+   { -0.773010,  0.634393 },
+   { -0.831470,  0.555570 },
+   { -0.881921,  0.471397 },
+   { -0.923880,  0.382683 },
+   { -0.956940,  0.290285 },
+   { -0.980785,  0.195090 },
+   { -0.995185,  0.098017 },
+   {  1.000000,  0.000000 },
+   {  0.923880,  0.382683 },
+   {  0.707107,  0.707107 },
+   {  0.382683,  0.923880 },
+   {  0.000000,  1.000000 },
+   { -0.382683,  0.923880 },
+   { -0.707107,  0.707107 },
+   { -0.923880,  0.382683 },
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+static const twiddle_t fftTwiddlePath14[] PROGMEM = {
+   {  1.000000,  0.000000 },
+   {  0.980785,  0.195090 },
+   {  0.923880,  0.382683 },
+   {  0.831470,  0.555570 },
+   {  0.707107,  0.707107 },
+   {  0.555570,  0.831470 },
+   {  0.382683,  0.923880 },
+   {  0.195090,  0.980785 },
+   {  0.000000,  1.000000 },
+   { -0.195090,  0.980785 },
+   { -0.382683,  0.923880 },
+   { -0.555570,  0.831470 },
+   { -0.707107,  0.707107 },
+   { -0.831470,  0.555570 },
+   { -0.923880,  0.382683 },
+   { -0.980785,  0.195090 },
+   {  1.000000,  0.000000 },
+   {  0.923880,  0.382683 },
+   {  0.707107,  0.707107 },
+   {  0.382683,  0.923880 },
+   {  0.000000,  1.000000 },
+   { -0.382683,  0.923880 },
+   { -0.707107,  0.707107 },
+   { -0.923880,  0.382683 },
+   {  1.000000,  0.000000 },
+   {  0.707107,  0.707107 },
+   {  0.000000,  1.000000 },
+   { -0.707107,  0.707107 }
+};
+#  endif /* ! FFT_FIXED_POINT */
+
+static const fftTwiddlePath_t fftTwiddlePaths[] PROGMEM = {
+   { 8, fftTwiddlePath8 },
+   { 9, fftTwiddlePath9 },
+   { 10, fftTwiddlePath10 },
+   { 11, fftTwiddlePath11 },
+   { 12, fftTwiddlePath12 },
+   { 13, fftTwiddlePath13 },
+   { 14, fftTwiddlePath14 }
+};
+#else
+#  error "twiddlePath.c was created for a 64 point fft. Run wgen.py again"
+#endif /* FFT_N == 64 */
@@ -4,13 +4,36 @@
  *@{
  *@file
  *****************************************************************************
- * A software based half-duplex uart API inspired from AVR 304.
- * The Tx pin uses a regular I/O pin and the timer 0.
- * The Rx pin uses a level interrupt and the timer 0.
+ * A software based full-duplex uart API inspired from AVR 304.
+ * The Tx pin uses a regular I/O pin and the compare A of the timer 0.
+ * The Rx pin uses a pin change interrupt and the compare B of the timer 0.
  *
- * The code should cope with bit rate up to 56700 for clocks of 8MHz and up.
+ * The timer 0 counts freely on 8 bits, so both compares are scheduled
+ *  independently, at a count from the start edge of their character, and
+ *  a character can be received while another is transmitted. The longest
+ *  wait, 1.5 bit from the start edge to the first sample, sets the
+ *  prescaler. When both interrupts fall together, one delays the other by
+ *  its run time, which is well within half a bit.
+ *
+ * The characters to transmit are queued in a ring buffer of
+ *  UART_TX_QUEUE_SIZE characters. The compare A interrupt starts the
+ *  next character once the stop bit of the last one is sent, so the main
+ *  loop only waits when the queue is full. The main loop only moves the
+ *  head, and the interrupt the tail.
+ * The characters received are queued in a ring buffer of
+ *  UART_RX_QUEUE_SIZE characters the other way around.
+ *
+ * The code should cope with bit rate up to 38400 for clocks of 8MHz and up.
  * Some #error would warn if the baud rate was not compatible with the 
  *  MPU speed.
+ * The latency of the interrupts is measured by uartInit, rather than taken
+ *  from the machine code, so the edges and the samples are placed right
+ *  whatever the compiler and its options.
+ *
+ * This implementation is replaced by the one of uartUsi.c when UART_USI is
+ *  set to 1 in the config file. The queues, and the functions below, are
+ *  common to both. Each backend only starts the transmitter, in
+ *  uartKickTx, and serves its interrupts.
  * 
  * @requires SYS_CLOCK
  *
@@ -20,9 +43,10 @@
 
 #include "wgx.h"
 #include "dbg.h"
+#include "prof.h"
 #include "uart.h"
 
-#ifdef AVR
+#if defined(AVR) && ! UART_USI
 
 // This part defines low level functions
 
@@ -37,135 +61,156 @@
 #endif
 
 /**
- * Overhead in cycles taken by the interrupt before the timer value is modified
- * This value was obtained from having a look at the machine code generated by
- *  the compiler. It corresponds to the time taken by the first interrupt to
- *  arm the timer and the time taken by the sampling interrupt to read the bit
- * Although this delay is also applied when transmitting, it only means that
- *  all the transmission bits will be delayed by this amount of cycles.
+ * Cycles taken by an interrupt of the bit timer, from its compare to its
+ *  return, prologue and epilogue included. Sending and receiving at once,
+ *  a bit must leave room for both interrupts, and a sample may be delayed
+ *  by the other interrupt, which must stay under 40% of a bit.
+ * The latency from the compare to the pin is measured by uartInit.
  */
-#define UART_OVERHEAD 90
+#define UART_ISR_CYCLES 80
 
-// Work out the prescaler value such that the output compare value fits within
-// 16-bits. 
-// 
+/**
+ * Longest wait of the timer, in half bits. Receiving, the first sample is
+ *  1.5 bit after the start edge. Detecting the baud rate, the 4 bits of 0
+ *  of a carriage return come between two edges.
+ */
+#if UART_AUTO_BAUD
+   #define UART_LONGEST_WAIT 8
+#else
+   #define UART_LONGEST_WAIT 3
+#endif
+
+// Work out the prescaler value such that the longest wait fits within the
+// 8-bits of the timer.
+//
 // Values are for clock up to 20MHz (max allowed on the AVR Tiny).
-#if (SYS_CLOCK*115/UART_BAUD/10 - UART_OVERHEAD) < 65536
+#if (SYS_CLOCK*UART_LONGEST_WAIT/2/UART_BAUD) < 256
    #define UART_TIMER_PRESCALE_VALUE 1
    #define PRESCALE_MSK   _BV(CS00)
-#elif (SYS_CLOCK*115/UART_BAUD/80 - UART_OVERHEAD) < 65536
+#elif (SYS_CLOCK*UART_LONGEST_WAIT/2/UART_BAUD/8) < 256
    #define UART_TIMER_PRESCALE_VALUE 8
    #define PRESCALE_MSK   _BV(CS01)
-#elif (SYS_CLOCK*115/UART_BAUD/640 - UART_OVERHEAD) < 65536
+#elif (SYS_CLOCK*UART_LONGEST_WAIT/2/UART_BAUD/64) < 256
    #define UART_TIMER_PRESCALE_VALUE 64
    #define PRESCALE_MSK   _BV(CS01) | _BV(CS00)
+#elif (SYS_CLOCK*UART_LONGEST_WAIT/2/UART_BAUD/256) < 256
+   #define UART_TIMER_PRESCALE_VALUE 256
+   #define PRESCALE_MSK   _BV(CS02)
 #else
    #error "Baud rate too slow or clock too fast"
 #endif
 
-// Check the rate is not too fast
-#if (SYS_CLOCK/UART_BAUD) < 64
-   #error "Baud rate too fast, or clock too slow"
+// Check the rate is not too fast. At 8.192MHz, 38400 is the fastest
+// standard rate, with 213 cycles a bit. 57600 has 142, and 115200 has 71.
+#if (SYS_CLOCK/UART_BAUD) < UART_ISR_CYCLES*5/2
+   #error "Baud rate too fast for the interrupts to send and receive at once"
 #endif
 
-/** Helper macro for working the time sampling time */
-#define UART_TIMER_COUNT_AT(n) (uint16_t)((SYS_CLOCK*(1.5+n))/UART_BAUD/UART_TIMER_PRESCALE_VALUE - UART_OVERHEAD )
+/** Helper macro for working the count of the timer n bits after an edge */
+#define UART_TIMER_COUNT_AT(n) (uint8_t)(uint16_t)((SYS_CLOCK*(double)(n))/UART_BAUD/UART_TIMER_PRESCALE_VALUE + 0.5)
 
-
-/* ---------------------------------------------------------------------------
- *   Types
+/**
+ * Fewest counts of the timer a bit detected can last, for the interrupts
+ *  to keep up, as for UART_BAUD
  */
+#define UART_AUTO_BAUD_MIN_BIT (UART_ISR_CYCLES*5/2/UART_TIMER_PRESCALE_VALUE)
 
-/**  Enumeration holding software UART's state */
-typedef enum
-{
-   /** Idle state, both transmit and receive possible */
-   uartIdle_e,
-   /** Transmitting byte */
-   uartTx_e,          
-   /** Transmitting start bit */
-   uartTxStartBit_e, 
-   /** Transmitting stop bit */
-   uartTxStopBit_e,
-   /** Receiving incomming byte */
-   uartRx_e,       
-   /** Receiving stop bit */
-   uartRxStopBit_e,
-   /** Data has been received and is ready to collect */
-   uartDataPending_e,
-} uartState_t;
+/** Index of the transmitter while uartInit measures the latency */
+#define UART_TX_CALIBRATION 0xFF
+
+/** Number of latencies measured by uartInit, the shortest being kept */
+#define UART_CALIBRATIONS 4
+
+/** Edge of the auto-baud detection once the baud rate is known */
+#define UART_AUTO_BAUD_DONE 0xFF
 
 
 /* ---------------------------------------------------------------------------
  *   Data
  */
 
-/** Hold the state of the uart */
-static volatile uartState_t uartState;
+/** true while a character is transmitted */
+static volatile bool uartTxIsBusy;
 
-/** Holds the data received or to be transmitted */
+/** Holds the data to be transmitted */
 static volatile uint8_t uartTxData;
 
-/** Hold data the was received. -1 indicates a error */
-static volatile int uartRxData;
+/** Count of the timer of the start edge transmitted */
+static volatile uint8_t uartTxOrigin;
 
-/** Index of the bit currently been processed */
-static volatile uint8_t uartIndexBitIndex;
+/** Index of the next bit transmitted */
+static volatile uint8_t uartTxBitIndex;
 
-/** Called immediatly after a bit has been detected to stop other interrupts */
-static uartShutdownCallback_t uartCallback;
+/** true while a character is received */
+static volatile bool uartRxIsBusy;
 
-/** First timer compare value set at 1.5 to sample the rx bit */
-static const uint16_t uartInitialTimerCount = UART_TIMER_COUNT_AT(0);
+/** Holds the data being received */
+static volatile uint8_t uartRxData;
 
+/** Count of the timer of the middle of the start bit received */
+static volatile uint8_t uartRxOrigin;
 
-//
-//  Hookup with the stdio library
-//
-#ifdef HOOK_UART_TO_STDIN
-   /** Setup standard stream */
-   static int uartPutChar(char c, FILE *stream);
+/** Index of the next bit sampled */
+static volatile uint8_t uartRxBitIndex;
 
-   /** Create a steam to assign to stdout */
-   static FILE serialout = FDEV_SETUP_STREAM(uartPutChar, NULL, _FDEV_SETUP_WRITE);
-#endif
+/** Counts of the timer from a compare to its interrupt, measured by uartInit */
+static volatile uint8_t uartLatencyCount;
 
+/**
+ * Count from the start edge to the middle of the start bit, less the
+ *  latencies of the pin change interrupt reading the timer and of the
+ *  compare interrupt reading the pin
+ */
+static uint8_t uartRxShift;
 
-/** Table with next timer compare value for Rx'ing or Tx'ing bits */
-const uint16_t PROGMEM aBitTime[] = 
-{
-   UART_TIMER_COUNT_AT(1),  // 0 - Rx=b0   - Tx=start
-   UART_TIMER_COUNT_AT(2),  // 1 - Rx=b1   - Tx=b0
-   UART_TIMER_COUNT_AT(3),  // 2 - Rx=b2   - Tx=b1
-   UART_TIMER_COUNT_AT(4),  // 3 - Rx=b3   - Tx=b2
-   UART_TIMER_COUNT_AT(5),  // 4 - Rx=b4   - Tx=b3
-   UART_TIMER_COUNT_AT(6),  // 5 - Rx=b5   - Tx=b4
-   UART_TIMER_COUNT_AT(7),  // 6 - Rx=b6   - Tx=b5
-   UART_TIMER_COUNT_AT(8),  // 7 - Rx=b7   - Tx=b6
-   UART_TIMER_COUNT_AT(9),  // 8 - Rx=stop - Tx=b7
-   UART_TIMER_COUNT_AT(10), // 9 - Rx=-    - Tx=stop
-   0                        // 10 - reset to 0
-};
+#if UART_AUTO_BAUD
+/** Count of the timer 1 to 10 bits after an edge, at the baud rate detected */
+static uint8_t uartBitTime[10];
 
+/** Next edge of the carriage return detecting the baud rate */
+static volatile uint8_t uartAutoBaudEdge;
 
-/** Start the timer0 clock */
-static inline void uartStartTimer(void) 
-{
-   // Clear pending interrupt on the timer
-   TIFR = _BV(OCF0A);
+/** Count of the timer of the last edge */
+static volatile uint8_t uartAutoBaudLast;
 
-   // Reset the prescaler and start the timer
-   TCCR0B = _BV(PSR0) | PRESCALE_MSK; 
-}
+/** Count of the timer of the start bit */
+static volatile uint8_t uartAutoBaudBit;
 
-/** Stop the uart sampling timer */
-static inline void uartStopTimer(void)
-{ 
-   TCCR0B = _BV(TSM);    
+/** Counts of the timer since the start edge */
+static volatile uint16_t uartAutoBaudSum;
+#endif
+
+/** Called immediatly after a bit has been detected to stop other interrupts */
+static uartShutdownCallback_t uartCallback;
+
+
+/**
+ * Table with the count of the timer 1 to 10 bits after an edge.
+ * Added to the start edge, it gives the edge of each bit to transmit.
+ * Added to the middle of the start bit, the middle of each bit to receive.
+ */
+const uint8_t PROGMEM aBitTime[] =
+{
+   UART_TIMER_COUNT_AT(1),  // 0 - Rx=b0   - Tx=b0
+   UART_TIMER_COUNT_AT(2),  // 1 - Rx=b1   - Tx=b1
+   UART_TIMER_COUNT_AT(3),  // 2 - Rx=b2   - Tx=b2
+   UART_TIMER_COUNT_AT(4),  // 3 - Rx=b3   - Tx=b3
+   UART_TIMER_COUNT_AT(5),  // 4 - Rx=b4   - Tx=b4
+   UART_TIMER_COUNT_AT(6),  // 5 - Rx=b5   - Tx=b5
+   UART_TIMER_COUNT_AT(7),  // 6 - Rx=b6   - Tx=b6
+   UART_TIMER_COUNT_AT(8),  // 7 - Rx=b7   - Tx=b7
+   UART_TIMER_COUNT_AT(9),  // 8 - Rx=stop - Tx=stop
+   UART_TIMER_COUNT_AT(10), // 9 - Rx=-    - Tx=next start
+};
+
+#if UART_AUTO_BAUD
+/**
+ * Number of bits between the edges of a carriage return, from the start
+ *  edge: the start bit, b0 set, b1 clear, b2 and b3 set, b4 to b7 clear
+ */
+static const uint8_t PROGMEM aCarriageReturnBits[] = { 1, 1, 1, 2, 4 };
+#endif
 
-   // Clear pending interrupt on the timer
-   TIFR = _BV(OCF0A);
-}
 
 /** Enable the pin change interrupt */
 static inline void uartEnablePinChangeInterrupt(void)
@@ -179,8 +224,8 @@ static inline void uartEnablePinChangeInterrupt(void)
 
 /** Disable the pin change interrupt */
 static inline void uartDisablePinChangeInterrupt(void)
-{ 
-   PCMSK_OF(UART_RX_PORT) &= ~_BV(UART_RX_BIT); 
+{
+   PCMSK_OF(UART_RX_PORT) &= ~_BV(UART_RX_BIT);
 
    // Clear pending pcint interrupt if the bit waggles
    GIFR = _BV(PCIF);
@@ -208,35 +253,253 @@ static inline bool uartIsRxPinClear(void)
 static inline bool uartIsRxPinSet(void)
    { return bit_is_set( PIN_OF(UART_RX_PORT), UART_RX_BIT ); }
 
-static inline void uartResetTimerCount(void)
-   { TCNT0H = 0; TCNT0L = 0; }
+/**
+ * @param index Index of the bit, from 0 for 1 bit after the edge
+ * @return The count of the timer from the edge
+ */
+static inline uint8_t uartGetBitTime(uint8_t index)
+#if UART_AUTO_BAUD
+   { return uartBitTime[index]; }
+#else
+   { return pgm_read_byte( &aBitTime[index] ); }
+#endif
 
-static inline void setNextTimerCompare( uint16_t compareValue )
-   { OCR0B = (uint8_t)((compareValue) >> 8); OCR0A = (uint8_t)(compareValue); }
+/**
+ * Start transmitting the oldest character of the queue, with its start
+ *  bit. The other bits are sent by the compare A interrupt of the timer.
+ * Must be called with the interrupts disabled, the queue not empty, and
+ *  the transmitter idle or done with the stop bit.
+ *
+ * @param origin Count of the timer of the start edge
+ */
+static void uartStartTx(uint8_t origin)
+{
+   uint8_t tail = uartTxTail;
 
+   // Take the character to transmit off the queue
+   uartTxData = uartTxQueue[tail & (UART_TX_QUEUE_SIZE - 1)];
+   uartTxTail = tail + 1;
 
-/** 
+   // Create the start bit
+   uartClearTxPin();
+
+   uartTxOrigin = origin;
+   uartTxBitIndex = 0;
+   uartTxIsBusy = true;
+
+   // Compare at the edge of the first bit
+   OCR0A = origin + uartGetBitTime( 0 );
+   TIFR = _BV(OCF0A);
+   TIMSK |= _BV(OCIE0A);
+}
+
+
+/**
+ * Work out where to sample the bits received, from the latency measured
+ *
+ * @param halfBit Count of the timer of half a bit
+ */
+static void uartSetRxShift(uint8_t halfBit)
+{
+   uartRxShift = halfBit - 2 * uartLatencyCount;
+}
+
+
+/**
+ * Measure the latency of the interrupts, from a compare of the timer to
+ *  the interrupt reading it, the shortest of UART_CALIBRATIONS. The other
+ *  interrupts of the system are not running yet, so the shortest is that
+ *  of the uart alone. The pin change interrupt is assumed as late.
+ * The edges transmitted and the samples received are moved earlier by
+ *  that latency.
+ * Must be called with the interrupts enabled, and the transmitter idle.
+ */
+static void uartCalibrate(void)
+{
+   uint8_t latency = UINT8_MAX;
+   uint8_t n;
+
+   for ( n=0; n<UART_CALIBRATIONS; ++n )
+   {
+      cli();
+
+      // The interrupt reads the timer and goes idle again
+      uartTxBitIndex = UART_TX_CALIBRATION;
+      uartTxIsBusy = true;
+
+      // Leave time to set the compare before the timer gets there
+      OCR0A = TCNT0L + 16;
+      TIFR = _BV(OCF0A);
+      TIMSK |= _BV(OCIE0A);
+
+      sei();
+
+      while ( uartTxIsBusy )
+      {
+         sleep_mode();
+      }
+
+      if ( uartLatencyCount < latency )
+      {
+         latency = uartLatencyCount;
+      }
+   }
+
+   uartLatencyCount = latency;
+   uartSetRxShift( UART_TIMER_COUNT_AT(0.5) );
+}
+
+
+#if UART_AUTO_BAUD
+/**
+ * Give up the carriage return detecting the baud rate, on an edge out of
+ *  place or too late, and wait for another one. The error is reported by
+ *  uartGetChar.
+ * Must be called with the interrupts disabled.
+ */
+static void uartAutoBaudFail(void)
+{
+   TIMSK &= ~_BV(OCIE0B);
+   uartAutoBaudEdge = 0;
+   uartRxIsBusy = false;
+   uartRxError = true;
+}
+
+
+/**
+ * Follow the edges of the first carriage return received, to detect the
+ *  baud rate. The time between each edge must be close to its number of
+ *  bits times the start bit. Once the last 0 bit is over, the bit times
+ *  are worked out from the 9 bits since the start edge, the carriage
+ *  return is queued, and the receiver samples the next characters.
+ * A rate leaving too few cycles a bit for the interrupts is refused, as
+ *  UART_BAUD is by the #error.
+ * The compare B gives up if an edge does not come within 255 counts.
+ * Called from the pin change interrupt.
+ *
+ * @param now Count of the timer of the edge
+ */
+static void uartAutoBaudNext(uint8_t now)
+{
+   uint8_t edge = uartAutoBaudEdge;
+   uint8_t width = now - uartAutoBaudLast;
+   uint16_t expected;
+   uint16_t sum;
+   uint8_t head;
+   uint8_t n;
+
+   // The edges alternate from the falling start edge
+   if ( uartIsRxPinClear() != ((edge & 1) == 0) )
+   {
+      if ( edge != 0 )
+      {
+         uartAutoBaudFail();
+      }
+
+      return;
+   }
+
+   if ( edge == 0 )
+   {
+      uartAutoBaudSum = 0;
+      uartRxIsBusy = true;
+
+      // Stop all other interrupts in the system
+      if ( uartCallback != NULL )
+      {
+         uartCallback();
+      }
+   }
+   else
+   {
+      if ( edge == 1 )
+      {
+         uartAutoBaudBit = width;
+      }
+
+      // Within a quarter of the bits times the start bit
+      expected = (uint16_t)pgm_read_byte( &aCarriageReturnBits[edge - 1] ) *
+         uartAutoBaudBit;
+
+      if ( width < expected - expected/4 || width > expected + expected/4 )
+      {
+         uartAutoBaudFail();
+         return;
+      }
+
+      uartAutoBaudSum += width;
+   }
+
+   uartAutoBaudLast = now;
+   ++edge;
+
+   if ( edge <= sizeof(aCarriageReturnBits) )
+   {
+      // Give up after 255 counts
+      OCR0B = now - 1;
+      TIFR = _BV(OCF0B);
+      TIMSK |= _BV(OCIE0B);
+      uartAutoBaudEdge = edge;
+      return;
+   }
+
+   // The 9 bits up to the stop bit give the time of each bit
+   sum = uartAutoBaudSum;
+
+   // A rate too fast for the interrupts is refused
+   if ( sum < 9 * UART_AUTO_BAUD_MIN_BIT )
+   {
+      uartAutoBaudFail();
+      return;
+   }
+
+   for ( n=0; n<sizeof(uartBitTime); ++n )
+   {
+      uartBitTime[n] = (uint8_t)((sum * (n + 1) + 4) / 9);
+   }
+
+   uartSetRxShift( (uint8_t)((sum + 9) / 18) );
+
+   head = uartRxHead;
+   uartRxQueue[head & (UART_RX_QUEUE_SIZE - 1)] = '\r';
+   uartRxHead = head + 1;
+
+   TIMSK &= ~_BV(OCIE0B);
+   uartRxIsBusy = false;
+   uartAutoBaudEdge = UART_AUTO_BAUD_DONE;
+}
+#endif
+
+
+/**
  * Initialise the UART API and make the serial port the stdout stream.
  *
  * @param callback  This callback will be invoke upon receiving a valid
- *         character, atomically from an interrupt (nexted interrupts 
+ *         character, atomically from an interrupt (nexted interrupts
  *         turned off) and should shutdown all other interrupts in the
  *         system to avoid un-acceptable jitter during the receive phase.
- *        Once the character has been received, it is up to the callee to 
+ *        Once the character has been received, it is up to the callee to
  *         resume normal operations.
  *        Can be NULL so no callback is made.
  */
 void uartInit( uartShutdownCallback_t callback )
 {
-   // Reset the uartState
-   uartState = uartIdle_e;
+   // Reset the transmitter and the receiver
+   uartTxIsBusy = false;
+   uartRxIsBusy = false;
+
+#if UART_AUTO_BAUD
+   // Use UART_BAUD until a carriage return gives the baud rate
+   memcpy_P( uartBitTime, aBitTime, sizeof(uartBitTime) );
+   uartAutoBaudEdge = 0;
+#endif
 
    // Store the callback
    uartCallback = callback;
 
 #ifdef HOOK_UART_TO_STDIN
    // Make this serial port the default stdout
-   stdout = &serialout;
+   stdout = &uartSerialOut;
 #endif
 
    // Configure the Tx pin as an output
@@ -261,155 +524,69 @@ void uartInit( uartShutdownCallback_t callback )
       GIMSK |= _BV( PCIE1 );
    }
 
-   // Keep the timer halted
-   uartStopTimer();
+   // Configure timer0 in 8-bit mode, counting freely, so the transmitter
+   //  uses the compare A and the receiver the compare B at the same time
+   TCCR0A = 0;
+   TCCR0B = _BV(PSR0) | PRESCALE_MSK;
 
-   // Configure timer0 in straigh 16-bit mode
-   TCCR0A = _BV(TCW0);
-
-   // Clear pending interrupt on the timer
-   TIFR |= _BV(OCF0A);
-
-   // Enable the compare interrupt
-   TIMSK |= _BV(OCIE0A);
+   // Both compare interrupts are enabled while they are in use
+   TIMSK &= ~(_BV(OCIE0A) | _BV(OCIE0B));
+   TIFR = _BV(OCF0A) | _BV(OCF0B);
 
    // Enable interrupts globally
    sei();
 
+   // Measure the latency of the interrupts, which moves the bits
+   uartCalibrate();
+
    // Unmask the PCINT
    uartEnablePinChangeInterrupt();
 }
 
 
 /**
- * Sends a character down the Tx pin.
- * This method relies on the timer 0 interrupt to send all bits,
- *  including start and stop bits.
- *
- * @pre initUart must be called in advance.
- *
- * @param  c   Byte to transmit.
+ * Start transmitting the queue if the transmitter is idle. Otherwise, the
+ *  interrupt goes on with the queue after the character in progress.
+ * Must be called with the interrupts disabled.
  */
-void uartTransmit( const uint8_t c )
+void uartKickTx(void)
 {
-   // Stop incomming characters - this will also clear pending interrupts
-   uartDisablePinChangeInterrupt();
-
-   //
-   // Wait for any ongoing rx or tx to complete
-   //
-
-   // Stop any pending interrupts to atomically read the uartState
-   cli();
-
-   // Check to see if a char is available
-   while( uartState != uartIdle_e )
+   if ( ! uartTxIsBusy && uartTxHead != uartTxTail )
    {
-      // Re-enable interrupts and wait. 
-      // The sleep is guaranteed to be exectued before any interrupts
-      sei();
-      sleep_mode();
-      cli();
+      // The start bit is set now rather than by the interrupt
+      uartStartTx( TCNT0L - uartLatencyCount );
    }
-   
-   uartState = uartTxStartBit_e;
-  
-   // Store the character to transmit
-   uartTxData = c;
-
-   // Reset bit count
-   uartIndexBitIndex = 0;
-
-   // Set the next compare at the 1st cycle so we can use the same table as Rx
-   setNextTimerCompare( uartInitialTimerCount );
-
-   // Reset the timer
-   uartResetTimerCount();
-
-   // Restart the timer which will transmit all bits
-   uartStartTimer();
-
-   // Re-enable interrupts
-   sei();
 }
 
 
-#ifdef HOOK_UART_TO_STDIN
 /**
- * Hook function to hook the uart to stdout
- * Insert carriage returns with line feeds.
- *
- * @param c     Character to send
- * @param FILE  Unused.
- * @return 0 always.
- */
-static int uartPutChar(char c, FILE *stream)
-{
-   if (c == '\n')
-   {
-      uartPutChar('\r', stream);
-   }
-
-   uartSendChar(c);
-
-   return 0;
-}
-#endif
-
-
-/** 
  * Allow the caller to check whether a character is being or
  *  has been received
  * @return true if yes
  */
 bool uartHasChar(void)
 {
-   // Atomically read into a register
-   register uartState_t state = uartState;
-
-   return state == uartRx_e || state == uartRxStopBit_e || state == uartDataPending_e;
+   return uartRxIsBusy || uartRxHead != uartRxTail || uartRxError;
 }
 
 
 /**
- * Wait for a character to come. This function will block until
- *  a character has been received.
- *
- * @return The received character
+ * Serves the interrupt where the the Rx Pin changes state
  */
-int uartGetChar(void)
+ISR( PCINT_vect )
 {
-   set_sleep_mode(0);
+   // Read the timer first, as close as possible to the edge
+   uint8_t now = TCNT0L;
 
-   // Stop any pending interrupts
-   cli();
+   profStart(profUartPin_e);
 
-   // Check to see if a char is available
-   while ( uartState != uartDataPending_e )
+#if UART_AUTO_BAUD
+   if ( uartAutoBaudEdge != UART_AUTO_BAUD_DONE )
    {
-      // Re-enable interrupts and wait. 
-      // The sleep is guaranteed to be exectued before any interrupts
-      sei();
-      sleep_mode();
-      cli();
+      uartAutoBaudNext( now );
    }
-
-   // Re-enable interrupts. A new rx may happen but it will take many cycles
-   //  before the rx buffer is altered
-   sei();
-
-   // Clear the state
-   uartState = uartIdle_e;
-
-   return uartRxData;
-}
-
-
-/**
- * Serves the interrupt where the the Rx Pin changes state
- */
-ISR( PCINT_vect )
-{
+   else
+#endif
    if ( uartIsRxPinClear() )
    {
       dbgSet(DBG_UART);
@@ -417,20 +594,17 @@ ISR( PCINT_vect )
       // Disable this interrupt
       uartDisablePinChangeInterrupt();
 
-      // Reset the timer0
-      uartResetTimerCount();
-
-      // Set the next compare at 1 1/2 cycle
-      setNextTimerCompare( uartInitialTimerCount );
-
-      // Start the timer0 clock
-      uartStartTimer();
+      // Set the next compare at 1 1/2 bit
+      uartRxOrigin = now + uartRxShift;
+      OCR0B = uartRxOrigin + uartGetBitTime( 0 );
+      TIFR = _BV(OCF0B);
+      TIMSK |= _BV(OCIE0B);
 
       // Change state to rx
-      uartState = uartRx_e;
+      uartRxIsBusy = true;
 
       // Next bit to read
-      uartIndexBitIndex = 0;
+      uartRxBitIndex = 0;
 
       // Reset the data
       uartRxData = 0;
@@ -443,104 +617,320 @@ ISR( PCINT_vect )
 
       dbgClear(DBG_UART);
    }
+
+   profStop(profUartPin_e);
 }
 
 
 /**
- * The compare interrupt is used to send or sample the next bit.
+ * The compare A interrupt is used to send the next bit.
  */
 ISR(TIMER0_COMPA_vect)
 {
-   dbgSet(DBG_UART);
+   // Read the timer first, as close as possible to the compare
+   uint8_t now = TCNT0L;
+   uint8_t index = uartTxBitIndex;
 
-   // Set next compare value in all cases
-   setNextTimerCompare( pgm_read_word( &aBitTime[uartIndexBitIndex] ) );
+   profStart(profUartTimer_e);
+   dbgSet(DBG_UART);
 
-   switch( uartState )
+   if ( index == UART_TX_CALIBRATION )
    {
-   case uartTxStartBit_e:
-      // Create a start bit
-      uartClearTxPin();
-
-      // Next state to tranmit data bits
-      uartState = uartTx_e;
-   break;
-
-   case uartTx_e:
-      if ( uartIndexBitIndex < 9 )
+      // Measured by uartInit
+      uartLatencyCount = now - OCR0A;
+      TIMSK &= ~_BV(OCIE0A);
+      uartTxIsBusy = false;
+   }
+   else if ( index < 8 )
+   {
+      if ( uartTxData & 0x01 )
       {
-         if ( uartTxData & 0x01 )
-         {
-            uartSetTxPin();
-         }
-         else
-         {
-            uartClearTxPin();
-         }
-
-         uartTxData >>= 1;
+         uartSetTxPin();
       }
       else
       {
-          // Send the stop bit
-         uartSetTxPin();
-         uartState = uartTxStopBit_e;
+         uartClearTxPin();
       }
-   break;
 
-   case uartTxStopBit_e:
-      uartStopTimer();
-      uartState = uartIdle_e;
-      uartEnablePinChangeInterrupt();
-   break;
+      uartTxData >>= 1;
+   }
+   else if ( index == 8 )
+   {
+      // Send the stop bit
+      uartSetTxPin();
+   }
+   else if ( uartTxHead != uartTxTail )
+   {
+      // Go on with the next character, its start bit follows the stop bit
+      uartStartTx( uartTxOrigin + uartGetBitTime( 9 ) );
+   }
+   else
+   {
+      // Done with the stop bit
+      TIMSK &= ~_BV(OCIE0A);
+      uartTxIsBusy = false;
+   }
+
+   if ( index < 9 )
+   {
+      // Move to next bit
+      ++index;
+      uartTxBitIndex = index;
+      OCR0A = uartTxOrigin + uartGetBitTime( index );
+   }
 
-   case uartRx_e:
-      // Count one period after the falling edge is trigged.
+   dbgClear(DBG_UART);
+   profStop(profUartTimer_e);
+}
 
-      if( uartIndexBitIndex < 8 )
+
+/**
+ * The compare B interrupt is used to sample the next bit.
+ */
+ISR(TIMER0_COMPB_vect)
+{
+   // Sample first, as close as possible to the middle of the bit
+   bool isSet = uartIsRxPinSet();
+   uint8_t index = uartRxBitIndex;
+   uint8_t head;
+
+   profStart(profUartTimer_e);
+   dbgSet(DBG_UART);
+
+#if UART_AUTO_BAUD
+   if ( uartAutoBaudEdge != UART_AUTO_BAUD_DONE )
+   {
+      // The next edge of the carriage return is too late
+      uartAutoBaudFail();
+   }
+   else
+#endif
+   if ( index < 8 )
+   {
+      // Shift due to receiving LSB first.
+      uartRxData >>= 1;
+
+      if ( isSet )
+      {
+         // If a logical 1 is read, let the data mirror this
+         uartRxData |= 0x80;
+      }
+
+      // Move to next bit
+      ++index;
+      uartRxBitIndex = index;
+      OCR0B = uartRxOrigin + uartGetBitTime( index );
+   }
+   else
+   {
+      // Check the stop bit, and the room for the character
+      if ( ! isSet || uartIsRxQueueFull() )
       {
-         // Shift due to receiving LSB first.
-         uartRxData >>= 1;
-
-         if( uartIsRxPinSet() ) 
-         {
-            // If a logical 1 is read, let the data mirror this
-            uartRxData |= 0x80;
-         }
+         uartRxError = true;
       }
       else
       {
-         // Check the stop bit
-         if( uartIsRxPinClear() ) 
-         {
-            // Framing error
-            uartRxData = -1;
-         }
+         head = uartRxHead;
+         uartRxQueue[head & (UART_RX_QUEUE_SIZE - 1)] = uartRxData;
+         uartRxHead = head + 1;
+      }
 
-         // Enter data pending once the whole byte has been received.
-         uartState = uartDataPending_e;               
+      // No more bits to sample
+      TIMSK &= ~_BV(OCIE0B);
+      uartRxIsBusy = false;
 
-         // No more bits to sample
-         uartStopTimer();
+      // Prepare for next byte
+      uartEnablePinChangeInterrupt();
+   }
 
-         // Prepare for next byte
-         uartEnablePinChangeInterrupt();
-      }
-   break;
+   dbgClear(DBG_UART);
+   profStop(profUartTimer_e);
+}
+
+#endif // defined(AVR) && ! UART_USI
+
+#ifdef AVR
+
+//----------------------------------------------------------------------------
+// Queues common to both backends
+// The backend starts the transmitter with uartKickTx, and its interrupts
+//  move the tail of the transmit queue and the head of the receive queue
+//----------------------------------------------------------------------------
+
+/** Characters waiting to be transmitted */
+volatile uint8_t uartTxQueue[UART_TX_QUEUE_SIZE];
+
+/** Number of characters ever queued, modulo 256. Only moved by the main loop */
+volatile uint8_t uartTxHead;
+
+/** Number of characters ever transmitted, modulo 256. Only moved by the interrupt */
+volatile uint8_t uartTxTail;
+
+/** Characters received, waiting to be read */
+volatile uint8_t uartRxQueue[UART_RX_QUEUE_SIZE];
+
+/** Number of characters ever received, modulo 256. Only moved by the interrupt */
+volatile uint8_t uartRxHead;
+
+/** Number of characters ever read, modulo 256. Only moved by the main loop */
+volatile uint8_t uartRxTail;
+
+/** Set on a framing error, or on a character lost to a full queue */
+volatile bool uartRxError;
+
+
+//
+//  Hookup with the stdio library
+//
+#ifdef HOOK_UART_TO_STDIN
+   /** Setup standard stream */
+   static int uartPutChar(char c, FILE *stream);
+
+   /** Create a steam to assign to stdout */
+   FILE uartSerialOut = FDEV_SETUP_STREAM(uartPutChar, NULL, _FDEV_SETUP_WRITE);
+#endif
 
-   
-   default:        
-      // Error, should not occur. Going to a safe state.
-      uartState = uartIdle_e;
+
+/**
+ * Queues a character to send down the Tx pin.
+ * This method relies on the interrupts of the backend to send all bits,
+ *  including the stop bit. It only waits while the queue is full.
+ *
+ * @pre initUart must be called in advance.
+ *
+ * @param  c   Byte to transmit.
+ */
+void uartTransmit( const uint8_t c )
+{
+   uint8_t head;
+
+   // Stop any pending interrupts to atomically read the queue
+   cli();
+
+   // Wait for some room in the queue
+   while ( uartIsTxQueueFull() )
+   {
+      // Re-enable interrupts and wait.
+      // The sleep is guaranteed to be exectued before any interrupts
+      sei();
+      sleep_mode();
+      cli();
    }
 
-   // Move to next bit in all cases
-   ++uartIndexBitIndex;
+   head = uartTxHead;
+   uartTxQueue[head & (UART_TX_QUEUE_SIZE - 1)] = c;
+   uartTxHead = head + 1;
 
-   dbgClear(DBG_UART);
+   uartKickTx();
+
+   // Re-enable interrupts
+   sei();
+}
+
+
+/**
+ * Queues as many characters as there is room for, without waiting.
+ *
+ * @param buf Characters to transmit
+ * @param len Number of characters
+ * @return The number of characters queued, from the first one
+ */
+uint8_t uartWrite( const uint8_t *buf, uint8_t len )
+{
+   uint8_t head = uartTxHead;
+   uint8_t room = UART_TX_QUEUE_SIZE - (uint8_t)(head - uartTxTail);
+   uint8_t n;
+
+   if ( len > room )
+   {
+      len = room;
+   }
+
+   for ( n=0; n<len; ++n )
+   {
+      uartTxQueue[head++ & (UART_TX_QUEUE_SIZE - 1)] = buf[n];
+   }
+
+   // Publish the characters, then start them if idle
+   cli();
+   uartTxHead = head;
+   uartKickTx();
+   sei();
+
+   return len;
+}
+
+
+#ifdef HOOK_UART_TO_STDIN
+/**
+ * Hook function to hook the uart to stdout
+ * Insert carriage returns with line feeds.
+ *
+ * @param c     Character to send
+ * @param FILE  Unused.
+ * @return 0 always.
+ */
+static int uartPutChar(char c, FILE *stream)
+{
+   if (c == '\n')
+   {
+      uartPutChar('\r', stream);
+   }
+
+   uartSendChar(c);
+
+   return 0;
 }
+#endif
+
+
+/**
+ * Wait for a character to come. This function will block until
+ *  a character has been received.
+ * A framing error of the bit banged uart, or characters lost while the
+ *  queue was full, are reported once as -1, before the characters queued.
+ *
+ * @return The received character, or -1 on error
+ */
+int uartGetChar(void)
+{
+   int c;
+   uint8_t tail;
+
+   set_sleep_mode(0);
+
+   // Stop any pending interrupts
+   cli();
+
+   // Check to see if a char is available
+   while ( uartRxHead == uartRxTail && ! uartRxError )
+   {
+      // Re-enable interrupts and wait.
+      // The sleep is guaranteed to be exectued before any interrupts
+      sei();
+      sleep_mode();
+      cli();
+   }
+
+   if ( uartRxError )
+   {
+      uartRxError = false;
+      c = -1;
+   }
+   else
+   {
+      tail = uartRxTail;
+      c = uartRxQueue[tail & (UART_RX_QUEUE_SIZE - 1)];
+      uartRxTail = tail + 1;
+   }
+
+   sei();
+
+   return c;
+}
+
 
-#endif // def AVR
+#endif // AVR
 
 //----------------------------------------------------------------------------
 // Common function
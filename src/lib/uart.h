@@ -26,6 +26,20 @@
  *  UART_RX_BIT  Bit number of the Rx pin
  *  UART_RX_POL  Set to 1 to invert the polarity on the Rx pin.
  *
+ * The characters transmitted are queued, and sent by the interrupt of the
+ *  timer 0 one after the other. uartTransmit only waits while the queue
+ *  is full. uartWrite never waits, and queues what it can.
+ * The characters received are queued too, even while transmitting, and
+ *  read by uartGetChar.
+ *
+ * The bits are timed from a table worked out at compile time from UART_BAUD,
+ *  moved by the latency of the interrupts measured by uartInit. A #error
+ *  rejects the rates leaving too few cycles a bit for the interrupts: at
+ *  8.192MHz, 38400 is accepted, 57600 and 115200 are not.
+ * With UART_AUTO_BAUD, the table is worked out again from the first
+ *  carriage return received, at a rate from UART_BAUD up to the fastest
+ *  rate accepted.
+ *
  * @author software@arreckx.com
  *****************************************************************************
  */
@@ -52,6 +66,47 @@
 #   error "Attempt to use the uart API where no UART resources have been defined"
 #endif
 
+#ifndef UART_TX_QUEUE_SIZE
+   /** Number of characters queued for transmission, a power of 2 */
+   #define UART_TX_QUEUE_SIZE 16
+#endif
+
+#if UART_TX_QUEUE_SIZE > 128 || (UART_TX_QUEUE_SIZE & (UART_TX_QUEUE_SIZE - 1)) != 0
+   #error "UART_TX_QUEUE_SIZE must be a power of 2, up to 128"
+#endif
+
+#ifndef UART_USI
+   /**
+    * Shift the bits with the USI (1), rather than one interrupt per bit.
+    *  The Tx pin is then DO and the Rx pin DI, and the uart half-duplex.
+    */
+   #define UART_USI 0
+#endif
+
+#if UART_USI && UART_AUTO_BAUD
+   #error "UART_AUTO_BAUD is not supported with UART_USI"
+#endif
+
+#ifndef UART_AUTO_BAUD
+   /**
+    * Detect the baud rate from the first carriage return received (1).
+    *  UART_BAUD is then the rate until detected, and the slowest rate
+    *  detected, as the 4 bits of 0 of the carriage return must fit the
+    *  timer. The fastest rate detected is the fastest UART_BAUD accepted:
+    *  38400 at 8.192MHz.
+    */
+   #define UART_AUTO_BAUD 0
+#endif
+
+#ifndef UART_RX_QUEUE_SIZE
+   /** Number of characters received waiting to be read, a power of 2 */
+   #define UART_RX_QUEUE_SIZE 4
+#endif
+
+#if UART_RX_QUEUE_SIZE > 128 || (UART_RX_QUEUE_SIZE & (UART_RX_QUEUE_SIZE - 1)) != 0
+   #error "UART_RX_QUEUE_SIZE must be a power of 2, up to 128"
+#endif
+
 
 /** 
  * Callback type to be passed in the init method to turn off system interrupts 
@@ -63,6 +118,7 @@ void uartInit( uartShutdownCallback_t callback );
 
 // Tx API
 void uartTransmit( const uint8_t c );
+uint8_t uartWrite( const uint8_t *buf, uint8_t len );
 void uartSendChar( const unsigned char c );
 void uartPrint( PGM_P str );
 void uartPrintln( PGM_P str );
@@ -83,6 +139,34 @@ void uartPrintNumber( int number, int digits );
 int  uartGetChar(void);
 bool uartHasChar(void);
 
+#ifdef AVR
+/*
+ * Queues of uart.c, shared with the backend of uartUsi.c
+ */
+extern volatile uint8_t uartTxQueue[UART_TX_QUEUE_SIZE];
+extern volatile uint8_t uartTxHead;
+extern volatile uint8_t uartTxTail;
+extern volatile uint8_t uartRxQueue[UART_RX_QUEUE_SIZE];
+extern volatile uint8_t uartRxHead;
+extern volatile uint8_t uartRxTail;
+extern volatile bool uartRxError;
+
+#ifdef HOOK_UART_TO_STDIN
+extern FILE uartSerialOut;
+#endif
+
+/** Provided by the backend, to start transmitting the queue if idle */
+void uartKickTx(void);
+
+/** @return true if the transmit queue has no room left */
+static inline bool uartIsTxQueueFull(void)
+   { return (uint8_t)(uartTxHead - uartTxTail) >= UART_TX_QUEUE_SIZE; }
+
+/** @return true if the receive queue has no room left */
+static inline bool uartIsRxQueueFull(void)
+   { return (uint8_t)(uartRxHead - uartRxTail) >= UART_RX_QUEUE_SIZE; }
+#endif
+
 
 #endif   /* ndef __UART_H_HAS_ALREADY_BEEN_INCLUDED__ */
 
@@ -0,0 +1,495 @@
+/**
+ *@ingroup uart
+ *@{
+ *@file
+ *****************************************************************************
+ * USI implementation of the uart API, inspired from AVR 307.
+ * The USI shifts the bits in three-wire mode, clocked by the compare of the
+ *  timer 0 counting each bit in CTC mode. The Tx pin is DO and the Rx pin
+ *  is DI, on port B, or on port A with the USI pins moved there.
+ *
+ * A character is 10 bits, and the data register holds 8, so each character
+ *  transmitted is shifted in two halves of 5 bits: the start bit and the
+ *  bits 0 to 3, then the bits 4 to 7 and the stop bit. The second half
+ *  begins with the bit 4 already on DO, so reloading the data register
+ *  does not glitch the pin, as long as the overflow interrupt reloads it
+ *  within a bit.
+ * A character received is shifted in 9 bits, from the middle of the start
+ *  bit, which the pin change interrupt aims the timer at. The stop bit is
+ *  not sampled, so no framing error is reported.
+ * This costs 2 interrupts per character each way, against 10 for the bit
+ *  banged uart, so the adc is much less delayed. The USI only has one
+ *  data register, so the uart is half-duplex: a character to transmit
+ *  waits for the one received, and the start bits coming in while
+ *  transmitting are ignored. The Tx pin is an input with its pull-up while
+ *  receiving, as DO would otherwise echo the bits shifted in.
+ *
+ * The queues of characters, and the functions using them, are those of
+ *  uart.c. This backend only starts the transmitter and serves its
+ *  interrupts.
+ *
+ * This implementation is selected by setting UART_USI to 1 in the config
+ *  file.
+ *
+ * @author software@arreckx.com
+ *****************************************************************************
+ */
+
+#include "wgx.h"
+#include "dbg.h"
+#include "prof.h"
+#include "uart.h"
+
+#if defined(AVR) && UART_USI
+
+/* ---------------------------------------------------------------------------
+ *   Defines and sanity checks
+ */
+
+#if !defined(SYS_CLOCK)
+#  error "System clock must defined in SYS_CLOCK"
+#endif
+
+#if UART_TX_BIT != 1 || UART_RX_BIT != 0
+#  error "With UART_USI, the Tx pin must be DO (bit 1) and the Rx pin DI (bit 0)"
+#endif
+
+#if UART_TX_POL || UART_RX_POL
+#  error "With UART_USI, the polarity of the pins cannot be inverted"
+#endif
+
+/**
+ * Longest latency expected of the interrupts, in cycles. Half a bit must
+ *  leave the pin change interrupt the time to aim the timer at the middle
+ *  of the start bit, and the overflow interrupt the time to reload the
+ *  data register.
+ * The actual latency is measured by uartInit.
+ */
+#define UART_LATENCY_MAX 60
+
+// Work out the prescaler value such that a bit fits within the 8-bits of
+// the timer.
+#if (SYS_CLOCK/UART_BAUD) <= 256
+   #define UART_TIMER_PRESCALE_VALUE 1
+   #define PRESCALE_MSK   _BV(CS00)
+#elif (SYS_CLOCK/UART_BAUD/8) <= 256
+   #define UART_TIMER_PRESCALE_VALUE 8
+   #define PRESCALE_MSK   _BV(CS01)
+#elif (SYS_CLOCK/UART_BAUD/64) <= 256
+   #define UART_TIMER_PRESCALE_VALUE 64
+   #define PRESCALE_MSK   _BV(CS01) | _BV(CS00)
+#elif (SYS_CLOCK/UART_BAUD/256) <= 256
+   #define UART_TIMER_PRESCALE_VALUE 256
+   #define PRESCALE_MSK   _BV(CS02)
+#else
+   #error "Baud rate too slow or clock too fast"
+#endif
+
+/** Counts of the timer of a bit, rounded */
+#define UART_BIT_COUNT \
+   ((SYS_CLOCK + UART_BAUD*UART_TIMER_PRESCALE_VALUE/2)/UART_BAUD/UART_TIMER_PRESCALE_VALUE)
+
+// Check the bit, rounded to the count of the timer, is within 2%
+#if UART_BIT_COUNT*UART_TIMER_PRESCALE_VALUE*UART_BAUD*50 > SYS_CLOCK*51 || \
+    UART_BIT_COUNT*UART_TIMER_PRESCALE_VALUE*UART_BAUD*50 < SYS_CLOCK*49
+   #error "Baud rate too far from a count of the timer"
+#endif
+
+// Check the rate is not too fast. At 8.192MHz, 57600 is the fastest
+// standard rate, with 71 cycles for half a bit. 115200 has 35.
+#if (SYS_CLOCK/UART_BAUD/2) < UART_LATENCY_MAX
+   #error "Baud rate too fast for the interrupts to keep up with the USI"
+#endif
+
+/** Number of bits shifted by each half of a character transmitted */
+#define UART_HALF_FRAME 5
+
+/** Number of bits shifted for a character received, from the start bit */
+#define UART_RX_FRAME 9
+
+/** Number of latencies measured by uartInit, the shortest being kept */
+#define UART_CALIBRATIONS 4
+
+/** USI in three-wire mode, clocked by the compare of the timer 0 */
+#define UART_USI_ON (_BV(USIOIE) | _BV(USIWM0) | _BV(USICS0))
+
+
+/* ---------------------------------------------------------------------------
+ *   Types
+ */
+
+/**  Enumeration holding software UART's state */
+typedef enum
+{
+   /** Idle state, both transmit and receive possible */
+   uartIdle_e,
+   /** Transmitting the start bit and the bits 0 to 3 */
+   uartTxFirstHalf_e,
+   /** Transmitting the bits 4 to 7 and the stop bit */
+   uartTxSecondHalf_e,
+   /** Receiving incomming byte */
+   uartRx_e,
+   /** Measuring the latency of the interrupts */
+   uartCalibrating_e,
+} uartState_t;
+
+
+/* ---------------------------------------------------------------------------
+ *   Data
+ */
+
+/** Hold the state of the uart */
+static volatile uartState_t uartState;
+
+/** Character transmitted, with its bits reversed, for the second half */
+static volatile uint8_t uartTxData;
+
+/** Counts of the timer from a compare to its interrupt, measured by uartInit */
+static volatile uint8_t uartLatencyCount;
+
+/** Count given to the timer on the start edge, so it compares mid-bit */
+static uint8_t uartRxSeed;
+
+/** Called immediatly after a bit has been detected to stop other interrupts */
+static uartShutdownCallback_t uartCallback;
+
+
+/** Enable the pin change interrupt */
+static inline void uartEnablePinChangeInterrupt(void)
+{
+   // Clear pending pcint interrupt
+   GIFR = _BV(PCIF);
+
+   // Unmask the PCINT
+   PCMSK_OF(UART_RX_PORT) |= _BV(UART_RX_BIT);
+}
+
+/** Disable the pin change interrupt */
+static inline void uartDisablePinChangeInterrupt(void)
+{
+   PCMSK_OF(UART_RX_PORT) &= ~_BV(UART_RX_BIT);
+
+   // Clear pending pcint interrupt if the bit waggles
+   GIFR = _BV(PCIF);
+}
+
+static inline bool uartIsRxPinClear(void)
+   { return bit_is_clear( PIN_OF(UART_RX_PORT), UART_RX_BIT ); }
+
+/** Restart the timer from the given count */
+static inline void uartResetTimer(uint8_t count)
+{
+   TCNT0L = count;
+   TCCR0B = _BV(PSR0) | PRESCALE_MSK;
+}
+
+/**
+ * Reverse the order of the bits, as the USI shifts the most significant
+ *  bit first, and the uart the least significant
+ *
+ * @param c Bits to reverse
+ * @return The bits reversed
+ */
+static uint8_t uartReverse(uint8_t c)
+{
+   uint8_t reversed = 0;
+   uint8_t n;
+
+   for ( n=0; n<8; ++n )
+   {
+      reversed = (reversed << 1) | (c & 0x01);
+      c >>= 1;
+   }
+
+   return reversed;
+}
+
+
+/**
+ * Start transmitting the oldest character of the queue. The start bit
+ *  goes out on DO straight away, for a whole bit of the timer.
+ * Must be called with the interrupts disabled, the queue not empty, and
+ *  the uart idle or done with the stop bit.
+ */
+static void uartStartTx(void)
+{
+   uint8_t tail = uartTxTail;
+
+   // Stop incomming characters - this will also clear pending interrupts
+   uartDisablePinChangeInterrupt();
+
+   // Take the character to transmit off the queue
+   uartTxData = uartReverse( uartTxQueue[tail & (UART_TX_QUEUE_SIZE - 1)] );
+   uartTxTail = tail + 1;
+
+   uartState = uartTxFirstHalf_e;
+
+   // The start bit, then the bits 0 to 6, of which 0 to 3 are shifted
+   USIDR = uartTxData >> 1;
+   USISR = _BV(USIOIF) | (16 - UART_HALF_FRAME);
+
+   uartResetTimer( 0 );
+
+   // DO drives the Tx pin
+   DDR_OF(UART_TX_PORT) |= _BV(UART_TX_BIT);
+   USICR = UART_USI_ON;
+}
+
+
+/**
+ * Measure the latency of the interrupts, from a compare of the timer to
+ *  the interrupt reading it, the shortest of UART_CALIBRATIONS. The other
+ *  interrupts of the system are not running yet, so the shortest is that
+ *  of the uart alone. The pin change interrupt is assumed as late, and
+ *  aims the timer earlier by that latency.
+ * Must be called with the interrupts enabled, and the uart idle.
+ */
+static void uartCalibrate(void)
+{
+   uint8_t latency = UINT8_MAX;
+   uint8_t n;
+
+   for ( n=0; n<UART_CALIBRATIONS; ++n )
+   {
+      cli();
+
+      uartState = uartCalibrating_e;
+      TIFR = _BV(OCF0A);
+      TIMSK |= _BV(OCIE0A);
+
+      sei();
+
+      while ( uartState == uartCalibrating_e )
+      {
+         sleep_mode();
+      }
+
+      if ( uartLatencyCount < latency )
+      {
+         latency = uartLatencyCount;
+      }
+   }
+
+   uartRxSeed = (UART_BIT_COUNT - 1) - (UART_BIT_COUNT / 2) + latency;
+}
+
+
+/**
+ * Initialise the UART API and make the serial port the stdout stream.
+ *
+ * @param callback  This callback will be invoke upon receiving a valid
+ *         character, atomically from an interrupt (nexted interrupts
+ *         turned off) and should shutdown all other interrupts in the
+ *         system to avoid un-acceptable jitter during the receive phase.
+ *        Once the character has been received, it is up to the callee to
+ *         resume normal operations.
+ *        Can be NULL so no callback is made.
+ */
+void uartInit( uartShutdownCallback_t callback )
+{
+   // Reset the uartState
+   uartState = uartIdle_e;
+
+   // Store the callback
+   uartCallback = callback;
+
+#ifdef HOOK_UART_TO_STDIN
+   // Make this serial port the default stdout
+   stdout = &uartSerialOut;
+#endif
+
+   // Set the Tx pin idle while the USI is off, and configure it as an output
+   UART_TX_PORT |= _BV(UART_TX_BIT);
+   DDR_OF(UART_TX_PORT) |= _BV(UART_TX_BIT);
+
+   // Configure the Rx with pull up for the cases where the port is left unconnected
+   UART_RX_PORT |= _BV(UART_RX_BIT);
+
+   // Use the USI pins of the port of the uart
+   USICR = 0;
+   USIPP = ( &UART_TX_PORT == &PORTA ) ? _BV(USIPOS) : 0;
+
+   // Set the pin change mask to enable the interrupt on the Rx pin
+   PCMSK0 = PCMSK1 = 0;
+
+   // Enable PCINT interrupts
+   if ( UART_RX_BIT >= PORT0 && UART_RX_BIT < PORT4 && &UART_RX_PORT==&PORTB )
+   {
+      GIMSK |= _BV( PCIE0 );
+   }
+   else
+   {
+      GIMSK |= _BV( PCIE1 );
+   }
+
+   // Configure timer0 in 8-bit CTC mode, comparing once a bit
+   TCCR0A = _BV(CTC0);
+   OCR0A = UART_BIT_COUNT - 1;
+   uartResetTimer( 0 );
+
+   // The compare clocks the USI, without interrupt
+   TIMSK &= ~_BV(OCIE0A);
+
+   // Enable interrupts globally
+   sei();
+
+   // Measure the latency of the interrupts, which aims the samples
+   uartCalibrate();
+
+   // Unmask the PCINT
+   uartEnablePinChangeInterrupt();
+}
+
+
+/**
+ * Start transmitting the queue if the uart is idle. Otherwise, the
+ *  interrupt goes on with the queue after the character in progress, or
+ *  after the character received.
+ * Must be called with the interrupts disabled.
+ */
+void uartKickTx(void)
+{
+   if ( uartState == uartIdle_e && uartTxHead != uartTxTail )
+   {
+      uartStartTx();
+   }
+}
+
+
+/**
+ * Allow the caller to check whether a character is being or
+ *  has been received
+ * @return true if yes
+ */
+bool uartHasChar(void)
+{
+   return uartState == uartRx_e || uartRxHead != uartRxTail || uartRxError;
+}
+
+
+/**
+ * Serves the interrupt where the the Rx Pin changes state
+ */
+ISR( PCINT_vect )
+{
+   profStart(profUartPin_e);
+
+   if ( uartIsRxPinClear() && uartState == uartIdle_e )
+   {
+      // Aim the first compare at the middle of the start bit
+      uartResetTimer( uartRxSeed );
+
+      dbgSet(DBG_UART);
+
+      // Disable this interrupt
+      uartDisablePinChangeInterrupt();
+
+      // Stop DO from echoing the bits shifted in
+      DDR_OF(UART_TX_PORT) &= ~_BV(UART_TX_BIT);
+
+      // Shift the start bit and the 8 bits
+      USISR = _BV(USIOIF) | (16 - UART_RX_FRAME);
+      USICR = UART_USI_ON;
+
+      // Change state to rx
+      uartState = uartRx_e;
+
+      // Stop all other interrupts in the system
+      if ( uartCallback != NULL )
+      {
+         uartCallback();
+      }
+
+      dbgClear(DBG_UART);
+   }
+
+   profStop(profUartPin_e);
+}
+
+
+/**
+ * The overflow of the USI counter is used to reload the data register, or
+ *  to collect the character received.
+ */
+ISR(USI_OVF_vect)
+{
+   uint8_t head;
+
+   profStart(profUartTimer_e);
+   dbgSet(DBG_UART);
+
+   switch( uartState )
+   {
+   case uartTxFirstHalf_e:
+      // The bit 4 is already on DO, followed by the bits 5 to 7 and the
+      //  stop bit, and the pin idle
+      USIDR = (uartTxData << 4) | 0x0F;
+      USISR = _BV(USIOIF) | (16 - UART_HALF_FRAME);
+      uartState = uartTxSecondHalf_e;
+   break;
+
+   case uartTxSecondHalf_e:
+      if ( uartTxHead != uartTxTail )
+      {
+         // Go on with the next character
+         uartStartTx();
+      }
+      else
+      {
+         USICR = 0;
+         USISR = _BV(USIOIF);
+         uartState = uartIdle_e;
+         uartEnablePinChangeInterrupt();
+      }
+   break;
+
+   case uartRx_e:
+      // The start bit has been shifted out of the data register
+      if ( uartIsRxQueueFull() )
+      {
+         uartRxError = true;
+      }
+      else
+      {
+         head = uartRxHead;
+         uartRxQueue[head & (UART_RX_QUEUE_SIZE - 1)] = uartReverse( USIDR );
+         uartRxHead = head + 1;
+      }
+
+      USICR = 0;
+      USISR = _BV(USIOIF);
+      DDR_OF(UART_TX_PORT) |= _BV(UART_TX_BIT);
+      uartState = uartIdle_e;
+
+      // Prepare for next byte, or send what was queued meanwhile
+      uartEnablePinChangeInterrupt();
+      uartKickTx();
+   break;
+
+   default:
+      // Error, should not occur. Going to a safe state.
+      USICR = 0;
+      uartState = uartIdle_e;
+   }
+
+   dbgClear(DBG_UART);
+   profStop(profUartTimer_e);
+}
+
+
+/**
+ * The compare interrupt is only enabled by uartInit, to measure its latency
+ */
+ISR(TIMER0_COMPA_vect)
+{
+   // The timer is cleared by the compare, so it holds the latency
+   uartLatencyCount = TCNT0L;
+
+   TIMSK &= ~_BV(OCIE0A);
+   uartState = uartIdle_e;
+}
+
+#endif // defined(AVR) && UART_USI
+
+
+/* ----------------------------  End of file  ---------------------------- */
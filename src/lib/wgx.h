@@ -45,6 +45,7 @@ typedef _Bool bool;
    #include <avr/wdt.h>
    #include <avr/interrupt.h>
    #include <avr/power.h>
+   #include <util/crc16.h>
 #else
    #include "simAvr.h"
 #endif
@@ -15,10 +15,10 @@
  *
  * Only 4 interrupts are used:
  * <ul>
- * <li>The 'timer 1 overflow' is used to drive a burst of 16 conversions
- *  at 320 bursts/sec</li>
+ * <li>The 'timer 1 overflow' is used to start 8 evenly spread conversions
+ *  per sample at 320 samples/sec</li>
  * <li>The 'ADC conversion complete' is used to collect oversampled results,
- *  and to compute decimated values</li>
+ *  and to decimate them through a CIC filter</li>
  * <li>A level change on the serial Rx pin will cause the system to enter</li>
  *  the terminal mode which allows all parameters to be changed</li>
  * <li>The 'timer 0 16-bits compare' is used to sample serial port bits</li>
@@ -32,8 +32,13 @@
  * The real time arrangement is such that the computation of the FFT
  *  is finished well before the next timer interrupt.
  *
- * For each new FFT result (every 64samples - 200ms), the state machine
- *  is updated and the relay status re-evaluated.
+ * For each new FFT result (every 64 samples - 200ms, or 32 samples with
+ *  the overlapped ffts), the state machine is updated and the relay
+ *  status re-evaluated.
+ *
+ * The phase of the fundamental between the results gives the mains
+ *  frequency (freq.c), and the sampling rate is trimmed so the fft stays
+ *  centred on it.
  *
  * <h1>Getting started</h1>
  * Lungmate entry point is implemented in lungmate.c main function
@@ -55,7 +60,10 @@
 
 #include "wgx.h"
 #include "fft.h"
+#include "freq.h"
+#include "rms.h"
 #include "uart.h"
+#include "frame.h"
 #include "console.h"
 #include "dbg.h"
 #include "stateMachine.h"
@@ -63,51 +71,127 @@
 #include "preamble.h"
 #include "nvParam.h"
 #include "key.h"
+#include "prof.h"
+
+
+/** Context of the fft measuring the load of each channel of the adc */
+static fft_t fft[ADC_CHANNELS];
+
+/**
+ * Context of the true RMS of the load of each channel, over the window of
+ *  the fft. Without RMS_TRUE, it only sums the samples, for the offset
+ */
+static rms_t rms[ADC_CHANNELS];
+
+#if RMS_TRUE
+/** true to measure the load by its true RMS rather than by the fft */
+static bool isTrueRms;
+#endif
+
+#if ADC_CHANNELS > 8
+#  error "The idle channels are kept in 8 bits"
+#endif
+
+/** Bit of each channel whose last result was idle, to track its offset */
+static uint8_t quietChannels;
+
+/** Number of conversions of each channel clipped since the last results */
+static uint16_t clips[ADC_CHANNELS];
+
+/** Calibration for converting the FFT magnitude into Watts, in milli-Watts */
+static uint16_t fftToWattRatio;
+
+/**
+ * Index of the next character to transmit (negative numbers to send carriage return etc.),
+ *  or the number of bytes of the frame left to transmit with FRAME_RESULTS
+ */
+static int8_t txCharIndex = INT8_MIN;
+
+#if FRAME_RESULTS
+/**
+ * Size of the payload of a frame: its format, its sequence number, the
+ *  state of the state machine, the clipped channels, the overruns of the
+ *  adc, the power of each channel in watt, and the mains frequency in
+ *  1/100th of Hz when tracked. The words are least significant byte first
+ */
+#  define TX_PAYLOAD_SIZE (6 + 2 * ADC_CHANNELS + 2 * FREQ_TRACKING)
 
+/**
+ * Format of the payload, its first byte: the number of channels, and the
+ *  bit 4 set when the frequency follows. The host decoder reads the
+ *  payload from it
+ */
+#  define TX_FORMAT (ADC_CHANNELS | (FREQ_TRACKING ? 0x10 : 0))
+
+#  if FRAME_SIZE_OF(TX_PAYLOAD_SIZE) > INT8_MAX
+#     error "The frame is indexed by txCharIndex"
+#  endif
 
-/** Mutltiplier for converting the FFT result into Watts */
-static float fftToWatt;
+/** Frame of the last know fft result */
+static uint8_t txFrame[FRAME_SIZE_OF(TX_PAYLOAD_SIZE)];
 
-/** Index of the next character to transmit (negative numbers to send carriage return etc.) */
-static int8_t txCharIndex;
+/** Size of the frame of the last result */
+static uint8_t txFrameSize;
 
-/** Stores the string value of the last know fft result (watt) */
-static char acFFTResult[CONSOLE_MAX_CHARACTERS_IN_UINT16];
+#else
+/**
+ * Size of the text of a result: the power of each channel in watt,
+ *  followed by a '+' when clipped, separated by spaces, preceded by the
+ *  mains frequency with 2 decimals and a space when tracked
+ */
+#if FREQ_TRACKING
+#  define TX_RESULT_SIZE \
+      ((ADC_CHANNELS + 1) * (CONSOLE_MAX_CHARACTERS_IN_UINT16 + 1) + ADC_CHANNELS)
+#else
+#  define TX_RESULT_SIZE (ADC_CHANNELS * (CONSOLE_MAX_CHARACTERS_IN_UINT16 + 2) - 1)
+#endif
+
+/** Stores the string value of the last know fft result, last character first */
+static char acFFTResult[TX_RESULT_SIZE];
+#endif
 
 
 /**
- * Sends the fftResult down the serial link a character at a time
- *  to leave plenty of time before the next interrupt.
- * This happens after each partial fft computation.
+ * Queues the fftResult for the serial link, as far as the queue of the
+ *  uart has room, without waiting. The uart interrupt sends it meanwhile.
+ * This happens after each new sample, until all is queued.
  *
  * @return true if more characters remain to send
  */
 static inline bool sendResult(void)
 {
-   bool retval = true;
-
-   if ( txCharIndex >= 0 )
+#if FRAME_RESULTS
+   // The frame is sent from its start, txCharIndex counting the bytes left
+   if ( txCharIndex > 0 )
    {
-      uartTransmit( acFFTResult[txCharIndex] );
-      --txCharIndex;
+      txCharIndex -= uartWrite( &txFrame[txFrameSize - txCharIndex], (uint8_t)txCharIndex );
    }
-   else if ( txCharIndex == -1 )
+
+   // Ready for the next result once all is queued
+   if ( txCharIndex == 0 )
    {
-      uartTransmit('\n');
-      --txCharIndex;
+      txCharIndex = INT8_MIN;
    }
 
-   else if ( txCharIndex == -2 )
+   return txCharIndex > 0;
+#else
+   static const uint8_t endOfLine[] = { '\r', '\n' };
+
+   while ( txCharIndex >= 0 &&
+           uartWrite( (const uint8_t *)&acFFTResult[txCharIndex], 1 ) != 0 )
    {
-      uartTransmit('\r');
       --txCharIndex;
    }
-   else
+
+   // -1 sends the line feed, then -2 the carriage return
+   while ( txCharIndex < 0 && txCharIndex >= -2 &&
+           uartWrite( &endOfLine[txCharIndex + 2], 1 ) != 0 )
    {
-      retval = false;
+      --txCharIndex;
    }
 
-   return retval;
+   return txCharIndex >= -2;
+#endif
 }
 
 
@@ -127,13 +211,74 @@ static inline void enterConsole(void)
          continue;
       }
 
+      // Report the values lost by a late main loop since power up
+      uartPrint( PSTR("# ADC overruns ") );
+      uartPrintNumber( (int)adcGetOverruns(), 0 );
+      uartSendChar('\n');
+
+#if ADC_JITTER
+      // Report the spread of the conversions since the console was last
+      //  entered, in CPU cycles from the tick of the timer
+      {
+         uint16_t earliest, latest;
+
+         adcGetJitter( &earliest, &latest );
+         uartPrint( PSTR("# ADC jitter ") );
+         uartPrintNumber( (int)earliest, 0 );
+         uartSendChar(' ');
+         uartPrintNumber( (int)latest, 0 );
+         uartSendChar('\n');
+      }
+#endif
+
+      // Report the gain each input had reached, and the offset removed
+      {
+         uint8_t channel;
+
+         uartPrint( PSTR("# ADC gain") );
+
+         for ( channel=0; channel<ADC_CHANNELS; ++channel )
+         {
+            uartSendChar(' ');
+            uartPrintNumber( adcGetGain(channel), 0 );
+         }
+
+         uartSendChar('\n');
+
+         uartPrint( PSTR("# ADC offset") );
+
+         for ( channel=0; channel<ADC_CHANNELS; ++channel )
+         {
+            uartSendChar(' ');
+            uartPrintNumber( adcGetOffset(channel), 0 );
+         }
+
+         uartSendChar('\n');
+      }
+
+#if PROF_ENABLED
+      // Report the time taken by the main loop and each interrupt since
+      //  the console was last entered
+      profReport();
+#endif
+
       // Enter console mode
       consolePrompt();
    }
 
    // Resume measurements and re-enable the interrupts that were
    //  disabled when a new character was received through a callback
-   fftReset();
+   {
+      uint8_t channel;
+
+      for ( channel=0; channel<ADC_CHANNELS; ++channel )
+      {
+         fftReset(&fft[channel]);
+         rmsReset(&rms[channel]);
+      }
+   }
+
+   freqReset();
    adcInit();
 
    // Reset the index of the next char to send
@@ -141,41 +286,264 @@ static inline void enterConsole(void)
 }
 
 
-/** Process new adc value */
+/**
+ * Combine the bins of the fft into a single measurement.
+ * The fundamental and its harmonics add up as the root of the sum of
+ *  their squares, so non-linear loads drawing harmonic currents are
+ *  accounted for. The squared results simply add up. The estimated
+ *  magnitudes are combined two at a time by the same estimator.
+ *
+ * @param ctx Context of the fft of a channel
+ * @return The combined result of all bins, in the unit of fftGetResult
+ */
+static inline uint32_t fftGetCombinedResult(fft_t *ctx)
+{
+#if FFT_MAX_BINS > 1 && FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   uint32_t sum = 0;
+   uint8_t n;
+
+   for ( n=0; n<FFT_MAX_BINS; ++n )
+   {
+      sum += fftGetResult(ctx, n);
+   }
+
+   return sum;
+#elif FFT_MAX_BINS > 1
+   uint32_t sum = fftGetResult(ctx, 0);
+   uint8_t n;
+
+   for ( n=1; n<FFT_MAX_BINS; ++n )
+   {
+      sum = fftMagnitude( (uint16_t)sum, (uint16_t)fftGetResult(ctx, n) );
+   }
+
+   return sum;
+#else
+   return fftGetResult(ctx, 0);
+#endif
+}
+
+
+/**
+ * Convert a result of the fft into Watts, for display only. The state
+ *  machine works on the results directly.
+ *
+ * @param result Squared magnitude, or magnitude, as given by fftGetResult
+ * @return The power in Watts, clipped at 65kW
+ */
+static uint16_t fftResultToWatts(uint32_t result)
+{
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   uint32_t watts = (uint32_t)rmsSquareRoot( result ) * fftToWattRatio;
+#else
+   uint32_t watts = (uint32_t)(uint16_t)result * fftToWattRatio;
+#endif
+
+   // Remove the fractional bits of the magnitude and the milli-Watts
+   watts = (watts + (500UL << FFT_RESULT_FRACTION_BITS)) /
+      (1000UL << FFT_RESULT_FRACTION_BITS);
+
+   return watts > UINT16_MAX ? UINT16_MAX : (uint16_t)watts;
+}
+
+
+#if FRAME_RESULTS
+/**
+ * Write a word in a payload, least significant byte first
+ *
+ * @param payload Where to write the word
+ * @param value   Word to write
+ * @return The byte following the word
+ */
+static inline uint8_t *appendWord(uint8_t *payload, uint16_t value)
+{
+   *payload++ = (uint8_t)value;
+   *payload++ = (uint8_t)(value >> 8);
+
+   return payload;
+}
+
+
+/**
+ * Frame a result for the serial link. The sequence number counts the
+ *  frames, so the host can tell the frames lost
+ *
+ * @param results Result of each channel, as given by fftGetResult
+ */
+static void frameResult(const uint32_t *results)
+{
+   static uint8_t sequence;
+   uint8_t payload[TX_PAYLOAD_SIZE];
+   uint8_t *next = payload;
+   uint8_t clipped = 0;
+   uint8_t channel;
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
+   {
+      if ( clips[channel] != 0 )
+      {
+         clipped |= 1 << channel;
+      }
+   }
+
+   *next++ = TX_FORMAT;
+   *next++ = sequence++;
+   *next++ = smGetState();
+   *next++ = clipped;
+   next = appendWord( next, adcGetOverruns() );
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
+   {
+      next = appendWord( next, fftResultToWatts(results[channel]) );
+   }
+
+#if FREQ_TRACKING
+   next = appendWord( next, freqGet() );
+#endif
+
+   txFrameSize = frameEncode( txFrame, payload, TX_PAYLOAD_SIZE );
+   txCharIndex = (int8_t)txFrameSize;
+}
+
+#else
+/**
+ * Write a number in the text of the result, last digit first, since the
+ *  text is transmitted from its end
+ *
+ * @param index Index of acFFTResult to write the last digit at
+ * @param value Number to write
+ * @param point Number of decimals, or 0 for a whole number
+ * @return The index following the first digit
+ */
+static int8_t appendNumber(int8_t index, uint16_t value, uint8_t point)
+{
+   uint8_t n;
+
+   for ( n=0; value != 0 || n <= point; ++n, value /= 10 )
+   {
+      if ( point != 0 && n == point )
+      {
+         acFFTResult[index++] = '.';
+      }
+
+      acFFTResult[index++] = (value % 10) + '0';
+   }
+
+   return index;
+}
+#endif
+
+
+/** Process the new adc values of all the channels */
 static inline void processAdcValue(void)
 {
-   // Compute part of the FFT and check whether this calculation has yeilded a new result
-   if ( fftNext( adcGetValue() ) )
+   int16_t samples[ADC_CHANNELS];
+   uint8_t sampleClips[ADC_CHANNELS];
+   uint32_t results[ADC_CHANNELS];
+   bool isReady = false;
+   uint8_t channel;
+
+   adcGetValues( samples, sampleClips );
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
    {
-      // Get the power from the FFT
-      float result = fftGetResult() * fftToWatt;
-      uint16_t fftResult = -1;
+      // The results are short of the load from the first clipped conversion
+      clips[channel] += sampleClips[channel];
+
+      // Accumulate the true RMS over the windows of the FFT. Its result is
+      //  ready by the time the FFT has the result of the same window.
+      //  The mean of each window of an idle channel is its offset
+      if ( rmsNext( &rms[channel], samples[channel] ) &&
+           (quietChannels & (1 << channel)) )
+      {
+         adcTrackOffset( channel, rmsGetSum(&rms[channel]), rms[channel].m );
+      }
 
-      // Clip at 65kw and pass to the state machine
-      if ( result < 65535.0 )
+      // Compute part of the FFT and check whether this calculation has yeilded a new result.
+      //  The ffts of all the channels follow the same windows
+      if ( fftNext( &fft[channel], samples[channel] ) )
       {
-         // Cast to short
-         fftResult = (uint16_t)result;
+         // Get the squared magnitude, or the magnitude, from the FFT or the true RMS
+#if RMS_TRUE
+         results[channel] = isTrueRms ?
+            rmsGetResult(&rms[channel]) : fftGetCombinedResult(&fft[channel]);
+#else
+         results[channel] = fftGetCombinedResult(&fft[channel]);
+#endif
+         isReady = true;
+
+         if ( smIsQuiet( results[channel] ) )
+         {
+            quietChannels |= 1 << channel;
+         }
+         else
+         {
+            quietChannels &= ~(1 << channel);
+         }
       }
+   }
 
-      // Pass to the stateMachine
-      smProcessFFTResult(fftResult);
+   if ( isReady )
+   {
+      // Pass to the stateMachine which compares with thresholds in the same unit
+      smProcessFFTResult(results, clips);
+
+#if FREQ_TRACKING
+      // Follow the mains with the phase of the fundamental of the first channel
+      freqNext( fftGetComplexResult( &fft[0], 0 ) );
+#endif
+
+      // Store the string representation, or the frame, in our buffer to transmit later on
+      // The sliding DFT has a result for every sample, so only the results
+      //  arriving once the previous one has been sent are transmitted
+      // The power in Watts is only worked out then. The last channel is
+      //  written first, since the text is transmitted from its end
+      if ( txCharIndex < -2 )
+      {
+#if FRAME_RESULTS
+         frameResult( results );
+#else
+         txCharIndex = 0;
+
+         for ( channel=ADC_CHANNELS; channel-- != 0; )
+         {
+            // The power of a clipped channel is a lower bound
+            if ( clips[channel] != 0 )
+            {
+               acFFTResult[txCharIndex++] = '+';
+            }
+
+            txCharIndex = appendNumber( txCharIndex, fftResultToWatts(results[channel]), 0 );
+
+            if ( channel != 0 )
+            {
+               acFFTResult[txCharIndex++] = ' ';
+            }
+         }
+
+#if FREQ_TRACKING
+         acFFTResult[txCharIndex++] = ' ';
+         txCharIndex = appendNumber( txCharIndex, freqGet(), 2 );
+#endif
+
+         // Start from the first character written last
+         --txCharIndex;
+#endif
+      }
 
-      // Store the string representation in our text buffer to transmit later on
-      for( txCharIndex=0; fftResult != 0 || txCharIndex == 0 ; ++txCharIndex, fftResult /= 10)
+      // Count the clipped conversions of the next results afresh
+      for ( channel=0; channel<ADC_CHANNELS; ++channel )
       {
-         acFFTResult[txCharIndex] = (fftResult % 10) + '0';
+         clips[channel] = 0;
       }
 
       // This is the best place to reset the watchdog
       // Reaching this point indicates all interrupts and computations
-      //  are running fine. (every 200ms)
+      //  are running fine. (every 200ms at most)
       wdt_reset();
    }
-   else
-   {
-      sendResult();
-   }
+
+   sendResult();
 }
 
 
@@ -189,8 +557,38 @@ int main(void)
    // Initialise all APIs
    preamble();
 
-   // Read from eeprom the power conversion
-   fftToWatt = nvParam( fftToWattRatio_e ) / 1000;
+   // Read from eeprom the power conversion, compensated for the droop of
+   //  the decimation filter at the mains
+   fftToWattRatio = adcCompensateDroop(
+      (uint16_t)nvParam( fftToWattRatio_e ), (uint8_t)nvParam( centerFrequency_e ) );
+
+   // Initialise the fft with the fundamental, followed by its odd harmonics
+   {
+      uint16_t frequencies[FFT_MAX_BINS];
+      uint8_t channel;
+      uint8_t n;
+
+      for ( n=0; n<FFT_MAX_BINS; ++n )
+      {
+         frequencies[n] = nvParam(centerFrequency_e) * (2 * n + 1);
+      }
+
+      // Each channel has its own fft, all measuring the same frequencies
+      for ( channel=0; channel<ADC_CHANNELS; ++channel )
+      {
+         fftInit( &fft[channel], (uint8_t)nvParam(fftWindow_e), frequencies, FFT_MAX_BINS );
+         rmsInit( &rms[channel], (uint8_t)nvParam(fftWindow_e) );
+      }
+
+      adcSetGainWindow( FFT_CTX_M(&fft[0]) );
+#if RMS_TRUE
+      isTrueRms = nvParam(trueRms_e) == 1;
+#endif
+
+#if FREQ_TRACKING
+      freqInit( frequencies[0], FFT_CTX_M(&fft[0]) );
+#endif
+   }
 
    // Enter the main loop where we wait for the decimation to have completed
    for (;;)
@@ -202,10 +600,14 @@ int main(void)
       //  process the data in this loop. It will stay set in console mode.
       // This pin should clear before the next timer interrupt.
       dbgSet(DBG_MAIN_LOOP);
+      profStart(profMainLoop_e);
 
       if ( uartHasChar() ) // Is the serial port receiving a new character?
       {
          enterConsole();
+
+         // The time spent waiting for the user is not part of the budget
+         profStart(profMainLoop_e);
       }
       else if ( adcTick() ) // Is the adc is about to start a new conversion batch?
       {
@@ -213,9 +615,14 @@ int main(void)
       }
       else if ( adcHasNewValue() ) // Do we have a decimated value to process?
       {
-         processAdcValue();
+         // Drain all the values queued, in case this loop was late
+         do
+         {
+            processAdcValue();
+         } while ( adcHasNewValue() );
       }
 
+      profStop(profMainLoop_e);
       dbgClear(DBG_MAIN_LOOP);
    }
 
@@ -11,7 +11,7 @@
 # Build the lungmate hex file
 #
 lungmate.C=preamble lungmate stateMachine fusesAndLockBits
-lungmate.PICK=uart console adc fft key nvParam
+lungmate.PICK=uart uartUsi frame console adc fft sdft freq rms key nvParam prof
 
 $(eval $(call makeHex,lungmate))
 
@@ -20,7 +20,7 @@ $(eval $(call makeHex,lungmate))
 # Build the board test software
 #
 boardTest.C=boardTest
-boardTest.PICK=adc uart nvParam fft key
+boardTest.PICK=adc uart uartUsi nvParam fft sdft key prof
 
 $(eval $(call makeTest,boardTest))
 
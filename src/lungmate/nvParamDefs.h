@@ -37,18 +37,40 @@ NV_PARAM_TABLE_BEGIN
    NV_PARAM( keepOnAfter,       "Post delay (seconds)",  0, 99, 5 )
 
    /** 
-    * Ratio of the FFT measurement to watt.
+    * Ratio of the FFT measurement to watt, in milli-Watts per sample unit
+    *  of the magnitude measured by the fft. The droop of the decimation
+    *  filter of the adc at centerFrequency is compensated on top, so the
+    *  ratio does not depend on ADC_CIC_ORDER.
     * This parameter can be used to adjust the power measurement, for example
     *  to allow for the power factor correction.
     * For example, to increase the measure value by 10%, multiply the current
-    *  value by 1.1 and round to the nearest. For 3380 (default) this would
-    *  be 3718.
+    *  value by 1.1 and round to the nearest. For 2967 (default) this would
+    *  be 3264.
+    * The first firmware used 3380 as 3, the thousands only, and read 1.1%
+    *  low at 50Hz from its burst of conversions. 2967 gives the same
+    *  readings, as 989 times the thousands of an older value would.
     */
-   NV_PARAM( fftToWattRatio,    "Calibration",  1, 32767, 3380 )
+   NV_PARAM( fftToWattRatio,    "Calibration",  1, 32767, 2967 )
 
    /** Center frequency to measure */
    NV_PARAM( centerFrequency,   "Center frequency (Hz)", 40, 70, 50 )
 
+   /**
+    * Size of the fft window in 2^n points, from FFT_MIN_M to FFT_M, so
+    *  5 for 32 points, 6 for 64 points or 7 for 128 points. A smaller
+    *  window responds faster, a larger one rejects the neighbouring
+    *  frequencies better.
+    */
+   NV_PARAM( fftWindow,         "FFT window (2^n points)", FFT_MIN_M, FFT_M, FFT_M )
+
+   /**
+    * Measure the power from the bins of the fft (0), or from the true RMS
+    *  of the samples over the same window (1). The true RMS accounts for
+    *  all the harmonics drawn by non-linear loads, but also for the noise.
+    *  Ignored unless built with RMS_TRUE.
+    */
+   NV_PARAM( trueRms,           "Measure (1=true RMS, 0=FFT)", 0, 1, 0 )
+
 NV_PARAM_TABLE_END
 
 #endif /* ndef __NV_PARAM_DEFINED__ */
@@ -15,7 +15,6 @@
 #include "wgx.h"
 #include "uart.h"
 #include "nvParamDefs.h"
-#include "fft.h"
 #include "uart.h"
 #include "dbg.h"
 #include "stateMachine.h"
@@ -123,8 +122,10 @@ void exit( int why )
  */
 void preamble(void)
 {
+#if ! UART_USI
    // Shutdown the USI to help reduce the digital noise
    power_usi_disable() ;
+#endif
 
    // Initialise the debug ports
    dbgInit();
@@ -160,9 +161,6 @@ void preamble(void)
    // Initialise the parameter storage in eeprom
    nvParamInit();
 
-   // Initialise the fft
-   fftInit( nvParam(centerFrequency_e) );
-
    // Initialise the single key. The callbacks update the statemachine
    keyInit( smProcessShortKey, smProcessLongKey );
 
@@ -183,6 +181,9 @@ void preamble(void)
 
    // Set the sleep mode to idle - (ADC save is not an option as we need the timers)
    set_sleep_mode(0);
+
+   // Measure the offset of the inputs, which is then removed from the samples
+   adcZero();
 }
 
 
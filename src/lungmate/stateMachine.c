@@ -51,10 +51,10 @@ typedef enum
 static uint32_t timeStamp;
 
 /** Consecutive above the threshold */
-static uint8_t countOn;
+static uint16_t countOn;
 
 /** Consecutive below the threshold */
-static uint8_t countOff;
+static uint16_t countOff;
 
 /** Current status */
 static smStatus_t status;
@@ -65,14 +65,22 @@ static smMode_t mode;
 /** For the blinking */
 static uint8_t blinkCycle;
 
-/** Trigger off thresholds in Watts */
-static uint16_t thresholdLow;
+/** Trigger off thresholds, in the unit of the fft results */
+static uint32_t thresholdLow;
 
-/** Trigger on thresholds in Watts */
-static uint16_t thresholdHigh;
+/** Trigger on thresholds, in the unit of the fft results */
+static uint32_t thresholdHigh;
 
-/** Keep relay on n * 200ms after the load has dropped */
-static uint8_t countOffDeactivate;
+/**
+ * Turn the relay on after n fft results above the threshold. The time
+ *  unit of SM_COUNT_ON_ACTIVATE is an fft cycle of the progressive fft
+ *  (.2s), so the count is scaled to the rate of the results to keep the
+ *  same delay whatever the fft and its window.
+ */
+static uint16_t countOnActivate;
+
+/** Keep relay on for n fft results after the load has dropped */
+static uint16_t countOffDeactivate;
 
 
 /*-
@@ -147,6 +155,37 @@ static void smUpdateModeLed(void)
 }
 
 
+/**
+ * Convert a power in Watts into the fft result it measures as, so the fft
+ *  results are compared without taking their square root.
+ * The magnitude is computed with 4 extra fractional bits, which are
+ *  dropped once squared, or straight away if the fft reports magnitudes.
+ *
+ * @param watts Power to convert
+ * @param ratio Calibration in milli-Watts per sample unit (fftToWattRatio),
+ *              compensated for the droop of the adc
+ * @return The squared magnitude, or the magnitude, as given by fftGetResult
+ */
+static uint32_t smThreshold(uint16_t watts, uint16_t ratio)
+{
+   uint32_t magnitude = (uint32_t)watts * (1000UL << (FFT_RESULT_FRACTION_BITS + 4));
+
+   magnitude = (magnitude + ratio/2) / ratio;
+
+#if FFT_MAGNITUDE == FFT_MAGNITUDE_SQUARED
+   // Saturate thresholds too large to ever be reached
+   if ( magnitude > UINT16_MAX )
+   {
+      return UINT32_MAX;
+   }
+
+   return (magnitude * magnitude) >> 8;
+#else
+   return (magnitude + 8) >> 4;
+#endif
+}
+
+
 /**
  * Initialise the state machine and the front panel
  */
@@ -177,24 +216,76 @@ void smInit(void)
    countOff = 0;
    blinkCycle = 0;
 
-   // Triggering threshold given in Watts
-   thresholdHigh = (uint16_t)nvParam(powerThreshold_e);
+   // Triggering threshold given in Watts, converted once into the unit of
+   //  the fft results. Compute some hysterisis to avoid excessive on/off cycles
+   {
+      uint16_t watts = (uint16_t)nvParam(powerThreshold_e);
+      uint16_t ratio = adcCompensateDroop(
+         (uint16_t)nvParam(fftToWattRatio_e), (uint8_t)nvParam(centerFrequency_e) );
+
+      thresholdHigh = smThreshold( watts, ratio );
+      thresholdLow  = smThreshold( watts - THRESHOLD_HYSTERISIS, ratio );
+   }
+
+   // Delays expressed in fft results, which come at the rate of the window
+   {
+      uint16_t resultFrequency = FFT_RESULT_FREQUENCY_OF( nvParam(fftWindow_e) );
+
+      countOnActivate = SM_COUNT_ON_ACTIVATE * resultFrequency / 5;
+
+      // Time to keep the relay on after the load has come off
+      countOffDeactivate = (uint16_t)nvParam(keepOnAfter_e) * resultFrequency;
+   }
+}
+
+
+/**
+ * Work out the load of all the circuits monitored. The relay follows the
+ *  largest, so the extractor starts as soon as any of the circuits draws
+ *  power. The results are in the same unit, whether squared or not.
+ * A clipped channel measures short of its load, which is beyond the full
+ *  scale of the adc, so it counts as drawing power.
+ *
+ * @param values Measured power of each channel of the adc
+ * @param clips  Number of conversions clipped for each result
+ * @return The largest power
+ */
+static inline uint32_t smAggregate( const uint32_t *values, const uint16_t *clips )
+{
+   uint32_t retval = 0;
+   uint8_t channel;
+
+   for ( channel=0; channel<ADC_CHANNELS; ++channel )
+   {
+      uint32_t value = values[channel];
+
+      if ( clips[channel] != 0 && value < thresholdHigh )
+      {
+         value = thresholdHigh;
+      }
 
-   // Compute some hysterisis to avoid excessive on/off cycles
-   thresholdLow = thresholdHigh - THRESHOLD_HYSTERISIS;
+      if ( value > retval )
+      {
+         retval = value;
+      }
+   }
 
-   // Time to keep the relay on after the load has come off, expressed as 1/5th of seconds
-   countOffDeactivate = (uint8_t)nvParam(keepOnAfter_e) * 5;
+   return retval;
 }
 
 
 /**
- * Process a new value computed by the FFT
+ * Process the new values computed by the FFT of each channel
  *
- * @param value Measured power in Watt
+ * @param values Measured power of each channel of the adc, as given by
+ *               fftGetResult
+ * @param clips  Number of conversions of each channel clipped since the
+ *               last results
  */
-void smProcessFFTResult( uint16_t value )
+void smProcessFFTResult( const uint32_t *values, const uint16_t *clips )
 {
+   uint32_t value = smAggregate( values, clips );
+
    // Determine whether we should be on or off
    //  independently of the state we're in (on/off/auto)
    // This is to allow the system to come on instantanously when
@@ -204,7 +295,7 @@ void smProcessFFTResult( uint16_t value )
    {
       countOff = 0;
 
-      if ( ++countOn > SM_COUNT_ON_ACTIVATE )
+      if ( ++countOn > countOnActivate )
       {
          status = smRelayOn_e;
       }
@@ -242,6 +333,44 @@ void smProcessFFTResult( uint16_t value )
 }
 
 
+/**
+ * Tell whether a circuit is idle, so the offset of its sensor can be
+ *  measured
+ *
+ * @param value Measured power of the circuit, as given by fftGetResult
+ * @return true if the power is under the threshold to turn off
+ */
+bool smIsQuiet( uint32_t value )
+{
+   return value <= thresholdLow;
+}
+
+
+/**
+ * Give the mode, the load detected and the state of the relay, for the
+ *  telemetry
+ *
+ * @return The mode in SM_STATE_MODE_MASK, with SM_STATE_LOAD and
+ *  SM_STATE_RELAY
+ */
+uint8_t smGetState(void)
+{
+   uint8_t state = (uint8_t)mode;
+
+   if ( status == smRelayOn_e )
+   {
+      state |= SM_STATE_LOAD;
+   }
+
+   if ( RELAY_PORT & _BV(RELAY_BIT) )
+   {
+      state |= SM_STATE_RELAY;
+   }
+
+   return state;
+}
+
+
 /**
  * Called by the key pad to indicate a single push was detected
  * Single push cycles the modes:
@@ -13,9 +13,20 @@
 
 #include "wgx.h"
 
+/** The mode given by smGetState: 0 for off, 1 for on, 2 for auto */
+#define SM_STATE_MODE_MASK 0x03
+
+/** Set in smGetState when a load is detected */
+#define SM_STATE_LOAD _BV(2)
+
+/** Set in smGetState when the relay is closed */
+#define SM_STATE_RELAY _BV(3)
+
 void smInit(void);
 
-void smProcessFFTResult(uint16_t value);
+void smProcessFFTResult(const uint32_t *values, const uint16_t *clips);
+bool smIsQuiet(uint32_t value);
+uint8_t smGetState(void);
 void smProcessTick(void);
 void smProcessShortKey(void);
 void smProcessLongKey(void);
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+#
+# Test the compact layout of the fft (FFT_COMPACT) against the standard
+#  layout for all the fft sizes from 8 to 256 points, in floating and fixed
+#  point, for a single bin and for several bins. Each build also tests all
+#  the smaller windows down to 8 points (FFT_MIN_M).
+# testFFTLayout is built with the host compiler for each configuration.
+#
+# Usage (from the root of the project):
+#  src/scripts/fftLayoutTest.sh
+#
+
+CC=${CC:-gcc}
+EXE=$(mktemp)
+trap "rm -f $EXE" EXIT
+
+for bins in 1 4; do
+   for fixedPoint in 0 1; do
+      for m in 3 4 5 6 7 8; do
+         $CC -O0 -Wall -Isrc -Isrc/lib -Isrc/cfg -DCFG=fftLayoutTestCfg \
+            -DFFT_LAYOUT_TEST_M=$m \
+            -DFFT_LAYOUT_TEST_FIXED_POINT=$fixedPoint \
+            -DFFT_LAYOUT_TEST_BINS=$bins \
+            src/lib/test/testFFTLayout.c src/lib/test/fftCompact.c \
+            src/lib/fft.c -lm -o $EXE || exit 1
+
+         $EXE || exit 1
+      done
+   done
+done
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+
+#
+# Decode the binary frames of the results sent by lungmate built with
+#  FRAME_RESULTS, and print a line per result.
+# Each frame is stuffed with COBS and ends with a 0. Its payload is followed
+#  by a CRC16 (CRC-16/MCRF4XX), least significant byte first. The frames
+#  corrupted are counted and dropped, and the frames lost are told from the
+#  gaps in the sequence numbers.
+#
+# Usage:
+#  telemetry.py /dev/ttyUSB0
+#   Read the serial port at 19200 bauds. Requires pyserial
+#  telemetry.py -b 38400 /dev/ttyUSB0
+#   Same at another rate, for a build with a different UART_BAUD
+#  telemetry.py < capture.bin
+#   Decode the frames captured in a file
+#
+
+import sys
+import argparse
+
+parser = argparse.ArgumentParser(description="Decode the frames of lungmate")
+parser.add_argument("-b", "--baud", type=int, default=19200,
+    help="Rate of the serial port")
+parser.add_argument("port", nargs="?",
+    help="Serial port to read. The standard input by default")
+args = parser.parse_args()
+
+# Names of the modes of the state machine
+modes = [ "off", "on", "auto", "?" ]
+
+# Bits of the state, as in stateMachine.h
+SM_STATE_MODE_MASK = 0x03
+SM_STATE_LOAD = 0x04
+SM_STATE_RELAY = 0x08
+
+# Bits of the format, the first byte of the payload
+FORMAT_CHANNELS_MASK = 0x0F
+FORMAT_FREQUENCY = 0x10
+
+# The frame is cut in blocks of bytes up to the next 0
+def cobsDecode(frame):
+    data = bytearray()
+    index = 0
+    while index < len(frame):
+        code = frame[index]
+        if code == 0 or index + code > len(frame):
+            return None
+        data += frame[index+1:index+code]
+        index += code
+        # The last block has no 0
+        if index < len(frame):
+            data.append(0)
+    return bytes(data)
+
+# Same as _crc_ccitt_update of the avr-libc, from 0xFFFF
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for bit in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+def word(payload, index):
+    return payload[index] | (payload[index+1] << 8)
+
+# Give the text of a payload, or None if it does not match its format
+def decode(payload):
+    channels = payload[0] & FORMAT_CHANNELS_MASK
+    hasFrequency = (payload[0] & FORMAT_FREQUENCY) != 0
+    if len(payload) != 6 + 2*channels + (2 if hasFrequency else 0):
+        return None
+    state = payload[2]
+    clipped = payload[3]
+    text = "#%3d %-4s relay:%-3s load:%-3s overruns:%d" % (payload[1],
+        modes[state & SM_STATE_MODE_MASK],
+        "on" if state & SM_STATE_RELAY else "off",
+        "yes" if state & SM_STATE_LOAD else "no",
+        word(payload, 4))
+    # The power of a clipped channel is a lower bound
+    for channel in range(channels):
+        text += " %5dW%s" % (word(payload, 6 + 2*channel),
+            "+" if clipped & (1 << channel) else " ")
+    if hasFrequency:
+        text += " %.2fHz" % (word(payload, 6 + 2*channels) / 100.0)
+    return text
+
+if args.port:
+    import serial
+    stream = serial.Serial(args.port, args.baud)
+else:
+    stream = getattr(sys.stdin, "buffer", sys.stdin)
+
+frame = bytearray()
+sequence = None
+lost = 0
+corrupted = 0
+
+try:
+    while True:
+        byte = stream.read(1)
+        if not byte:
+            break
+        if byte[0] != 0:
+            frame += byte
+            continue
+        data = cobsDecode(bytes(frame))
+        frame = bytearray()
+        # The frame of a payload has its format, its CRC and a sequence number
+        if data is None or len(data) < 4 or crc16(data[:-2]) != word(data, len(data) - 2):
+            corrupted += 1
+            continue
+        payload = data[:-2]
+        text = decode(payload)
+        if text is None:
+            corrupted += 1
+            continue
+        if sequence is not None and payload[1] != (sequence + 1) & 0xFF:
+            gap = (payload[1] - sequence - 1) & 0xFF
+            lost += gap
+            text += "   (%d lost)" % gap
+        sequence = payload[1]
+        print(text)
+        sys.stdout.flush()
+except KeyboardInterrupt:
+    pass
+
+sys.stderr.write("%d frames lost, %d corrupted\n" % (lost, corrupted))
@@ -3,34 +3,161 @@
 #
 # Compute the twiddle factor for different size fft, and create some
 #  lookup table in C for AVR
+# Two tables are created: one in floating point, and one in Q15 fixed point
+#  for when the fft is built with FFT_FIXED_POINT.
 #
-#
+# Usage:
+#  wgen.py [twiddle.c]
+#   Create the full tables of all fft sizes
+#  wgen.py -n 64 -b 8-14 [twiddlePath.c]
+#   Create the tables of the factors read along the path of each given bin,
+#    in the order the progressive fft uses them, for FFT_TWIDDLE_PATH
 #
 
 import sys
+import argparse
 from math import *
 
-# The fisrt argument is taken to be the output file
-if len(sys.argv) > 1:
-    out = open(sys.argv[1], "w")
+# FFT sizes supported, from 8pt to 256 points
+fftSizes = [ 8, 16, 32, 64, 128, 256 ]
+
+parser = argparse.ArgumentParser(description="Create the fft twiddle factors")
+parser.add_argument("-n", "--size", type=int, choices=fftSizes, default=64,
+    help="Size of the fft of the per-bin tables")
+parser.add_argument("-b", "--bins", action="append", default=[],
+    help="Bin, or range of bins (ex: 8-14), to create a per-bin table for")
+parser.add_argument("output", nargs="?",
+    help="Output file. The standard output by default")
+args = parser.parse_args()
+
+# The positional argument is taken to be the output file
+if args.output:
+    out = open(args.output, "w")
 else:
     out = sys.__stdout__
 
+# Convert a value in the range [-1:1] into a Q15 integer
+def q15(value):
+    return max(-32768, min(32767, int(floor(value*32768.0 + 0.5))))
+
+# Format of each factor in fixed and floating point
+formatQ15 = lambda re, im: "   { %6d, %6d }" % (q15(re), q15(im))
+formatFloat = lambda re, im: "   { % .6f, % .6f }" % (re, im)
+
+# Write the list of factors given by their index, for the given fft size
+def writeFactors(fftSize, indexes, formatter):
+    sector=2*pi/fftSize
+    for n, i in enumerate(indexes):
+        out.write( formatter(cos(i*sector), sin(i*sector)) )
+        if n<len(indexes)-1:
+            out.write( "," )
+        out.write( "\n" )
+
+# Write one table per fft size for the given line format
+def writeTables(formatter):
+    for fftSize in fftSizes:
+        # Write the preprocessor header for each fft size
+        out.write("#  if ( FFT_N == %d )\n" % fftSize)
+
+        # Pre-compute Twiddle factors Ws
+        writeFactors(fftSize, range(0,fftSize//2), formatter)
+
+        # Close the preprocessor header
+        out.write("#  endif /* FFT_N == %d */\n" % fftSize)
+
+# Index of the factors read along the path of a bin, in the order of use.
+# The pass p (from 0) reads the factors j*2^p of the group of size N/2^(p+1)
+#  if the bit p of the bin is set.
+def pathIndexes(fftSize, bin):
+    indexes = []
+    gSize = fftSize//2
+    shift = 0
+    while gSize:
+        if bin & (1 << shift):
+            indexes += [ j << shift for j in range(0, gSize) ]
+        gSize //= 2
+        shift += 1
+    return indexes
+
+# Write the per-bin tables and their index
+def writePathTables(fftSize, bins):
+    # Bins reading no factor at all do not need a table
+    bins = [ bin for bin in bins if pathIndexes(fftSize, bin) ]
+
+    out.write("#if ( FFT_N == %d )\n" % fftSize)
+
+    for name, formatter in (("FFT_FIXED_POINT", formatQ15),
+                            ("! FFT_FIXED_POINT", formatFloat)):
+        out.write("#  if %s\n" % name)
+
+        for bin in bins:
+            out.write(
+                "static const twiddle_t fftTwiddlePath%d[] PROGMEM = {\n" % bin)
+            writeFactors(fftSize, pathIndexes(fftSize, bin), formatter)
+            out.write("};\n")
+
+        out.write("#  endif /* %s */\n" % name)
+
+    out.write("\nstatic const fftTwiddlePath_t fftTwiddlePaths[] PROGMEM = {\n")
+    out.write(",\n".join(
+        [ "   { %d, fftTwiddlePath%d }" % (bin, bin) for bin in bins ]))
+    out.write("\n};\n")
+
+    out.write("#else\n")
+    out.write("#  error \"twiddlePath.c was created for a %d point fft. "
+        "Run wgen.py again\"\n" % fftSize)
+    out.write("#endif /* FFT_N == %d */\n" % fftSize)
+
+# Read the list of bins, given one by one or as ranges
+bins = []
+for arg in args.bins:
+    for part in arg.split(","):
+        if "-" in part:
+            first, last = part.split("-")
+            bins += range(int(first), int(last)+1)
+        else:
+            bins.append(int(part))
+
+if bins:
+    out.write("""/**
+ *@ingroup fft
+ *@{
+ *@file
+ *****************************************************************************
+ * Specifies the twiddle factors read along the path of some bins.
+ * This file was generated by wgen.py - DO NOT EDIT this file.
+ *
+ * Each table holds the factors read by the progressive fft to compute a
+ *  single bin, in the order of use. They are used in place of the full
+ *  table of twiddle.c when FFT_TWIDDLE_PATH is set.
+ *  If FFT_FIXED_POINT is set to 1, the coefficients are given in Q15.
+ * The index type must be defined as follow:
+ * typedef struct { fftIndex_t bin; const twiddle_t *table; } fftTwiddlePath_t;
+ *****************************************************************************
+ */
+
+""")
+    writePathTables(args.size, sorted(set(bins)))
+    sys.exit(0)
+
 # Prepare the file header
-out.write("""/*-
-/**@file
+out.write("""/**
+ *@ingroup fft
+ *@{
+ *@file
  *****************************************************************************
  * Specifies twiddle factors for the fft.
- * This file was generated by %s - DO NOT EDIT this file.
- * This file should be included by the application where the FFT algorithm
- *  is implements and not compiled directly.
+ * This file was generated by wgen.py - DO NOT EDIT this file.
  *
  * This files defines all twiddle factors coefficients as lookup tables
  *  stored in flash memory.
  *  The table selected depends on the size of the FFT which must be defined
  *   in the pre-processor variable FFT_N. If not specified, the FFT is 64pt.
- * The complex type must be defined as follow:
- * typedef struct { float real; float imag; } complex_t;
+ *  If FFT_FIXED_POINT is set to 1, the coefficients are given in Q15.
+ * The twiddle type must be defined as follow:
+ * typedef struct { float real; float imag; } twiddle_t;
+ *  or in fixed point:
+ * typedef struct { int16_t real; int16_t imag; } twiddle_t;
  *****************************************************************************
  */
 
@@ -39,26 +166,18 @@ out.write("""/*-
 #  define FFT_N 64
 #endif
 
-static complex_t fftTwiddle[] PROGMEM = {
-""" % sys.argv[0])
-
-# Compute for fft ranging from 8pt to 256 points
-for fftSize in [ 8, 16, 32, 64, 128, 256 ]:
+#if FFT_FIXED_POINT
+static const twiddle_t fftTwiddle[] PROGMEM = {
+""")
 
-    # Write the preprocessor header for each fft size
-    out.write("#  if ( FFT_N == %d )\n" % fftSize);
+writeTables(formatQ15)
 
-    # Pre-compute Twiddle factors Ws
-    sector=2*pi/fftSize
-    for i in range(0,fftSize/2):
-        out.write( "   { % .6f, % .6f }" % (cos(i*sector), sin(i*sector) ) )
-        if i<fftSize/2-1:
-            out.write( "," )
-        out.write( "\n" )
+out.write("""};
+#else
+static const twiddle_t fftTwiddle[] PROGMEM = {
+""")
 
-    # Close the preprocessor header
-    out.write("#  endif /* FFT_N == %d */\n" % fftSize);
+writeTables(formatFloat)
 
 # Close the file
-out.write( "};\n" )
-
+out.write( "};\n#endif /* FFT_FIXED_POINT */\n" )